@@ -6,9 +6,14 @@
 
 #include "lexer.hh"
 
-Lexer::Lexer(std::string_view input)
+Lexer::Lexer(std::string_view input, size_t line)
 : input_{input}
 , position_{input_.begin()}
+, start_{input_.begin()}
+, end_{input_.begin()}
+, line_{line}
+, counted_{input_.begin()}
+, lines_{line}
 {
 	next();
 }
@@ -33,6 +38,7 @@ bool Lexer::swallow(char ch) noexcept
 
 void Lexer::next() noexcept
 {
+	end_ = position_;
 	token_ = nextToken();
 	//std::cout << token_.type << ", " << token_.literal << "\n"; 
 }
@@ -61,6 +67,7 @@ Token Lexer::nextToken() noexcept
 	position_ = std::find_if_not(position_, input_.end(), isWhitespace);
 
 	// check if we're already off the end
+	start_ = position_;
 	if (position_ >= input_.end())
 		return { TokenType::Eof };
 
@@ -163,11 +170,17 @@ Token Lexer::nextToken() noexcept
 	return { TokenType::Illegal, { start_position, start_position + 1} };
 }
 
+size_t Lexer::line(std::string_view::iterator position) noexcept
+{
+	lines_ += std::count(counted_, position, '\n');
+	counted_ = position;
+	return lines_;
+}
 
 void Lexer::error(const std::string& error)
 {
 	auto isNewline = [](const char ch) { return ch == '\n'; };
-	auto line = 1 + std::count_if(input_.begin(), position_, isNewline);
+	auto line = line_ + std::count_if(input_.begin(), position_, isNewline);
 	const auto rpos = std::make_reverse_iterator(position_);
 	auto previousLine = std::find_if(
 		rpos,
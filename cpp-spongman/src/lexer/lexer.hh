@@ -8,7 +8,8 @@
 class Lexer final
 {
 	public:
-		Lexer(std::string_view);
+		// input starts on line, for the errors of a function body parsed on its own
+		Lexer(std::string_view, size_t line = 1);
 		void next() noexcept;
 		Token fetch(TokenType type);
 		bool get(TokenType type);
@@ -20,6 +21,13 @@ class Lexer final
 		bool peekIs(TokenType tokenType) const noexcept { return type() == tokenType; }
 		bool eof() const noexcept { return peekIs(TokenType::Eof); }
 
+		// where the current token starts, and the source from there to the end of the last token consumed
+		auto position() const noexcept { return start_; }
+		std::string_view since(std::string_view::iterator position) const noexcept { return { position, end_ }; }
+
+		// the line of position, which mustn't be before one asked for earlier
+		size_t line(std::string_view::iterator position) noexcept;
+
 		[[noreturn]]
 		void error(const std::string& error);
 
@@ -31,5 +39,11 @@ class Lexer final
 
 		const std::string_view input_;
 		std::string_view::iterator position_;
+		std::string_view::iterator start_;	// of the current token
+		std::string_view::iterator end_;	// of the token before it
+
+		const size_t line_;
+		std::string_view::iterator counted_;	// newlines before here have been counted,
+		size_t lines_;						// giving its line
 		std::vector<std::string> stringPool_;
 };
@@ -1,12 +1,23 @@
 #include <unistd.h>
+#include <getopt.h>
+#include <cstring>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <variant>
+#include <utility>
 
 #include "lexer/lexer.hh"
 #include "parser/program.hpp"
 #include "parser/environment.hpp"
 #include "parser/builtins.hpp"
+#include "parser/optimizer.hpp"
+#include "parser/pool.hpp"
+#include "parser/snapshot.hpp"
+#include "parser/collector.hpp"
+#include "parser/stack.hpp"
+#include "parser/memo.hpp"
+#include "vm/vm.hpp"
 
 int main(int argc, char *const argv[])
 {
@@ -19,10 +30,149 @@ int main(int argc, char *const argv[])
 	std::vector<ExpressionP> statements;
 	std::vector<Lexer> lexers;
 
+	auto engine = Engine::Ast;
+	auto optimizer = Optimizer{};
+	auto dump = false;
+	auto stats = false;
+	auto pure = false;
+	auto installed = false;
+	VM vm;
+
+	// the native library, before the first statement is evaluated. --pure-prelude leaves it to prelude.pure
+	const auto install = [&]() {
+		if (std::exchange(installed, true) || pure)
+			return;
+		for (const auto& builtin : BuiltinFunctionExpression::library)
+			global->set(builtin.name, Value{BoundFunction{&builtin, {}}});
+	};
+
+	// resolve and optimize a parsed statement, printing the result in dump mode
+	const auto prepare = [&](ExpressionP& statement) {
+		Scope::resolve(*statement);
+		optimizer.optimize(statement);
+		if (dump)
+			std::cout << *statement << "\n";
+	};
+	const auto evaluate = [&](const Statement& statement) {
+		auto value = engine == Engine::Vm
+			? vm.run(statement, global)
+			: statement.eval(*global);
+
+		if (value.failed()) {
+			std::cout << "error: " << value.get<String>() << "\n";
+			return Value{};
+		}
+		value.setCompletion(Completion::Normal);
+		return value;
+	};
+
+	static const option longOptions[] {
+		{ "engine",       required_argument, nullptr, 'e' },
+		{ "dump",         no_argument,       nullptr, 'd' },
+		{ "stats",        no_argument,       nullptr, 's' },
+		{ "pure-prelude", no_argument,       nullptr, 'p' },
+		{ "threads",      required_argument, nullptr, 't' },
+		{ "max-stack",    required_argument, nullptr, 'm' },
+		{ "snapshot-out", required_argument, nullptr, 'o' },
+		{ "snapshot-in",  required_argument, nullptr, 'i' },
+		{ "memo",         optional_argument, nullptr, 'M' },
+		{ nullptr,        0,                 nullptr, 0   },
+	};
+
 	for(;;)
 	{
-		switch(getopt(argc, argv, "f:")) // note the colon (:) to indicate that 'b' has a parameter and is not a switch
+		switch(getopt_long(argc, argv, "f:O:", longOptions, nullptr)) // note the colon (:) to indicate that 'b' has a parameter and is not a switch
 		{
+			case 'e':
+				if (std::strcmp(optarg, "vm") == 0)
+					engine = Engine::Vm;
+				else if (std::strcmp(optarg, "ast") == 0)
+					engine = Engine::Ast;
+				else {
+					std::cerr << "unknown engine: " << optarg << " (expected 'vm' or 'ast')\n";
+					exit(1);
+				}
+				continue;
+
+			case 'O':
+				if (std::strcmp(optarg, "0") == 0)
+					optimizer = Optimizer{Optimizer::levels[0]};
+				else if (std::strcmp(optarg, "1") == 0)
+					optimizer = Optimizer{Optimizer::levels[1]};
+				else {
+					std::cerr << "unknown optimization level: " << optarg << " (expected 0 or 1)\n";
+					exit(1);
+				}
+				continue;
+
+			case 'd':
+				dump = true;
+				continue;
+
+			case 's':
+				stats = true;
+				continue;
+
+			case 'p':
+				pure = true;
+				continue;
+
+			case 't':
+			{
+				const auto threads = std::atoi(optarg);
+				if (threads < 1 || !ThreadPool::configure(threads)) {
+					std::cerr << "invalid thread count: " << optarg << "\n";
+					exit(1);
+				}
+				continue;
+			}
+
+			case 'm':
+			{
+				const auto megabytes = std::atoi(optarg);
+				if (megabytes < 1) {
+					std::cerr << "invalid stack size: " << optarg << "\n";
+					exit(1);
+				}
+				Stack::limit = size_t(megabytes) << 20;
+				continue;
+			}
+
+			case 'M':
+				if (optarg) {
+					const auto entries = std::atoi(optarg);
+					if (entries < 1) {
+						std::cerr << "invalid memo size: " << optarg << "\n";
+						exit(1);
+					}
+					Memo::capacity = size_t(entries);
+				}
+				Memo::automatic = true;
+				continue;
+
+			// the globals so far, and those of an image, which take the place of the library
+			case 'o':
+				install();
+				try {
+					Snapshot::save(optarg, *global);
+				}
+				catch (const std::exception& ex) {
+					std::cerr << ex.what() << "\n";
+					exit(1);
+				}
+				continue;
+
+			case 'i':
+				try {
+					global->restore(Snapshot::open(optarg));
+					installed = true;
+				}
+				catch (const std::exception& ex) {
+					std::cerr << ex.what() << "\n";
+					exit(1);
+				}
+				continue;
+
 			case 'f':
 			{
 				std::ifstream ifs(optarg);
@@ -32,9 +182,11 @@ int main(int argc, char *const argv[])
 				}
 				std::string content{(std::istreambuf_iterator<char>(ifs)), (std::istreambuf_iterator<char>())};
 
+				install();
 				Lexer lexer{content};
 				auto statementList = StatementList::parse(lexer);
-				statementList->eval(global);
+				prepare(statementList);
+				evaluate(*statementList);
 				statements.push_back(std::move(statementList));
 				lexers.push_back(std::move(lexer));
 				continue;
@@ -43,7 +195,7 @@ int main(int argc, char *const argv[])
 			case '?':
 			case 'h':
 			default :
-				printf("Help/Usage Example\n");
+				printf("usage: %s [--engine=vm|ast] [-O0|-O1] [--dump] [--stats] [--pure-prelude] [--threads=n] [--max-stack=megabytes] [--memo[=entries]] [--snapshot-in=file] [-f file]... [--snapshot-out=file]\n", argv[0]);
 				break;
 
 			case -1:
@@ -55,6 +207,7 @@ int main(int argc, char *const argv[])
 	//for (const auto& [key, value] : global->values)
 	//	std::cout << "\t" << key << " = " << value << "\n";
 
+	install();
 	std::cout << "repl\n> ";
 
 	for (std::string line; std::getline(std::cin, line); std::cout << "\n> ") {
@@ -64,7 +217,8 @@ int main(int argc, char *const argv[])
 		while (!lexer.eof()) {
 			try {
 				if (auto statement = Statement::parseStatement(lexer); statement) {
-					value = statement->eval(global);
+					prepare(statement);
+					value = evaluate(*statement);
 					statements.push_back(std::move(statement));
 					lexer.get(TokenType::Semicolon);
 				}
@@ -80,4 +234,16 @@ int main(int argc, char *const argv[])
 
 		std::cout << value << "\n";
 	}
+
+	// counters of the interpreter, on leaving the repl
+	if (stats) {
+		std::cerr << "functions: " << FunctionExpression::deferrals << " deferred, "
+			<< FunctionExpression::materializations << " of them parsed on their first call\n";
+		const auto collections = Collector::stats();
+		std::cerr << "collector: " << collections.young << " young and " << collections.full << " full collections, "
+			<< collections.freed << " environments freed\n";
+		const auto memos = Memo::stats();
+		std::cerr << "memo: " << memos.hits << " hits, " << memos.misses << " misses, "
+			<< memos.bypassed << " calls not cached, " << memos.evicted << " results evicted\n";
+	}
 }
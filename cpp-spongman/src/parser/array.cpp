@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <iterator>
+
+#include "value.hpp"
+
+
+// Array
+
+Array::Array(std::initializer_list<Value> values)
+: Array(std::vector<Value>(values))
+{
+}
+
+Array::Array(std::vector<Value>&& values)
+: Array(build(values, 0, values.size()))
+{
+}
+
+Array::Array(NodeP tree)
+: root{std::move(tree)}
+, length{root ? root->count : 0}
+{
+	if (length > 0) {
+		head = locate(0);
+		tail = locate(length - 1);
+	}
+}
+
+const Value& Array::operator[](size_t index) const
+{
+	const auto position = locate(offset + index);
+	return position.leaf->elements[position.index];
+}
+
+Array Array::rest() const
+{
+	if (length <= 1)
+		return {};
+
+	Array result(*this);
+	result.offset++;
+	result.length--;
+	result.head = (head.index + 1 < head.leaf->elements.size())
+		? Position{head.leaf, head.index + 1}
+		: locate(offset + 1);
+	return result;
+}
+
+Array Array::take(size_t count) const
+{
+	if (count >= length)
+		return *this;
+	if (count == 0)
+		return {};
+
+	Array result(*this);
+	result.length = count;
+	result.tail = locate(offset + count - 1);
+	return result;
+}
+
+Array Array::drop(size_t count) const
+{
+	if (count == 0)
+		return *this;
+	if (count >= length)
+		return {};
+
+	Array result(*this);
+	result.offset += count;
+	result.length -= count;
+	result.head = locate(result.offset);
+	return result;
+}
+
+Array operator+(const Array& left, const Array& right)
+{
+	if (left.empty())
+		return right;
+	if (right.empty())
+		return left;
+	return Array(Array::join(left.slice(), right.slice()));
+}
+
+Array::Position Array::locate(size_t index) const noexcept
+{
+	const Node* node = root.get();
+	while (!node->leaf()) {
+		const auto leftCount = node->left->count;
+		if (index < leftCount) {
+			node = node->left.get();
+		}
+		else {
+			index -= leftCount;
+			node = node->right.get();
+		}
+	}
+	return {node, index};
+}
+
+Array::NodeP Array::slice() const
+{
+	if (offset == 0 && root && length == root->count)
+		return root;
+	return take(drop(root, offset), length);
+}
+
+
+// tree
+
+Array::NodeP Array::leaf(std::vector<Value>&& elements)
+{
+	if (elements.empty())
+		return {};
+
+	auto node = new Node{};
+	node->count = elements.size();
+	node->elements = std::move(elements);
+	return NodeP{node};
+}
+
+Array::NodeP Array::branch(NodeP left, NodeP right)
+{
+	auto node = new Node{};
+	node->count = left->count + right->count;
+	node->height = 1 + std::max(left->height, right->height);
+	node->left = std::move(left);
+	node->right = std::move(right);
+	return NodeP{node};
+}
+
+// join two trees whose heights differ by at most 2, rotating to restore the balance
+Array::NodeP Array::balance(NodeP left, NodeP right)
+{
+	if (left->height > right->height + 1) {
+		if (left->left->height >= left->right->height)
+			return branch(left->left, branch(left->right, std::move(right)));
+		return branch(
+			branch(left->left, left->right->left),
+			branch(left->right->right, std::move(right))
+		);
+	}
+	if (right->height > left->height + 1) {
+		if (right->right->height >= right->left->height)
+			return branch(branch(std::move(left), right->left), right->right);
+		return branch(
+			branch(std::move(left), right->left->left),
+			branch(right->left->right, right->right)
+		);
+	}
+	return branch(std::move(left), std::move(right));
+}
+
+// concatenate, in O(height difference). small leaves are pushed down the spine of
+// the other tree and merged, so repeated [x] + xs doesn't fragment the leaves.
+Array::NodeP Array::join(const NodeP& left, const NodeP& right)
+{
+	if (!left)
+		return right;
+	if (!right)
+		return left;
+
+	if (left->leaf() && right->leaf()) {
+		if (left->count + right->count > leafSize)
+			return branch(left, right);
+
+		std::vector<Value> elements;
+		elements.reserve(left->count + right->count);
+		elements.insert(elements.end(), left->elements.begin(), left->elements.end());
+		elements.insert(elements.end(), right->elements.begin(), right->elements.end());
+		return leaf(std::move(elements));
+	}
+
+	if (left->leaf() || right->height > left->height + 1)
+		return balance(join(left, right->left), right->right);
+	if (right->leaf() || left->height > right->height + 1)
+		return balance(left->left, join(left->right, right));
+
+	return branch(left, right);
+}
+
+// the first count elements
+Array::NodeP Array::take(const NodeP& node, size_t count)
+{
+	if (count == 0 || !node)
+		return {};
+	if (count >= node->count)
+		return node;
+
+	if (node->leaf())
+		return leaf({node->elements.begin(), node->elements.begin() + count});
+
+	const auto leftCount = node->left->count;
+	if (count <= leftCount)
+		return take(node->left, count);
+	return join(node->left, take(node->right, count - leftCount));
+}
+
+// all but the first count elements
+Array::NodeP Array::drop(const NodeP& node, size_t count)
+{
+	if (count == 0 || !node)
+		return node;
+	if (count >= node->count)
+		return {};
+
+	if (node->leaf())
+		return leaf({node->elements.begin() + count, node->elements.end()});
+
+	const auto leftCount = node->left->count;
+	if (count >= leftCount)
+		return drop(node->right, count - leftCount);
+	return join(drop(node->left, count), node->right);
+}
+
+// a perfectly balanced tree of full leaves
+Array::NodeP Array::build(std::vector<Value>& values, size_t first, size_t last)
+{
+	const auto count = last - first;
+	if (count <= leafSize) {
+		return leaf({
+			std::make_move_iterator(values.begin() + first),
+			std::make_move_iterator(values.begin() + last)
+		});
+	}
+
+	const auto leaves = (count + leafSize - 1) / leafSize;
+	const auto middle = first + (leaves / 2) * leafSize;
+	return branch(build(values, first, middle), build(values, middle, last));
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vector>
+#include <iterator>
+#include <initializer_list>
+
+#include "value.hpp"
+
+// persistent vector: an immutable, height-balanced tree of small leaf chunks.
+// arrays are views [offset, offset + length) onto a shared tree, so rest() and first/last are O(1),
+// while indexing and concatenation are O(log n) and share all untouched nodes.
+class Array
+{
+	struct Node;
+	using NodeP = Ref<const Node>;
+
+public:
+	class const_iterator;
+	using iterator = const_iterator;
+	using value_type = Value;
+	using size_type = size_t;
+
+	static constexpr size_t leafSize = 32;
+
+	Array() noexcept = default;
+	Array(std::initializer_list<Value> values);
+	explicit Array(std::vector<Value>&& values);
+
+	template<std::input_iterator Iterator>
+	Array(Iterator first, Iterator last)
+	: Array{std::vector<Value>(first, last)} {}
+
+	size_t size() const noexcept { return length; }
+	bool empty() const noexcept { return length == 0; }
+
+	const Value& operator[](size_t index) const;
+	const Value& front() const noexcept;
+	const Value& back() const noexcept;
+
+	// all but the first element
+	Array rest() const;
+
+	// the first count elements, and all but them
+	Array take(size_t count) const;
+	Array drop(size_t count) const;
+
+	friend Array operator+(const Array& left, const Array& right);
+
+	const_iterator begin() const noexcept;
+	const_iterator end() const noexcept;
+
+private:
+	friend class Collector;
+
+	struct Position
+	{
+		const Node* leaf = nullptr;
+		size_t index = 0;
+	};
+
+	Array(NodeP root);
+
+	Position locate(size_t index) const noexcept;
+	NodeP slice() const;
+
+	static NodeP leaf(std::vector<Value>&& elements);
+	static NodeP branch(NodeP left, NodeP right);
+	static NodeP balance(NodeP left, NodeP right);
+	static NodeP join(const NodeP& left, const NodeP& right);
+	static NodeP take(const NodeP& node, size_t count);
+	static NodeP drop(const NodeP& node, size_t count);
+	static NodeP build(std::vector<Value>& values, size_t first, size_t last);
+
+	NodeP root;
+	size_t offset = 0;
+	size_t length = 0;
+	Position head;
+	Position tail;
+};
+
+struct Array::Node : Object
+{
+	std::vector<Value> elements;	// leaves only
+	NodeP left;
+	NodeP right;
+	size_t count = 0;
+	uint8_t height = 0;	// 0 for leaves
+
+	bool leaf() const noexcept { return height == 0; }
+};
+
+class Array::const_iterator
+{
+public:
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = Value;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const Value*;
+	using reference = const Value&;
+
+	const_iterator() noexcept = default;
+
+	reference operator*() const noexcept { return position.leaf->elements[position.index]; }
+	pointer operator->() const noexcept { return &**this; }
+
+	const_iterator& operator++() noexcept
+	{
+		if (++index < array->length && ++position.index == position.leaf->elements.size())
+			position = array->locate(array->offset + index);
+		return *this;
+	}
+
+	const_iterator operator++(int) noexcept
+	{
+		auto previous = *this;
+		++*this;
+		return previous;
+	}
+
+	bool operator==(const const_iterator& other) const noexcept { return index == other.index; }
+
+private:
+	friend class Array;
+
+	const_iterator(const Array* array, size_t index, Position position) noexcept
+	: array{array}, index{index}, position{position} {}
+
+	const Array* array = nullptr;
+	size_t index = 0;
+	Position position;
+};
+
+inline const Value& Array::front() const noexcept
+{
+	return head.leaf->elements[head.index];
+}
+
+inline const Value& Array::back() const noexcept
+{
+	return tail.leaf->elements[tail.index];
+}
+
+inline Array::const_iterator Array::begin() const noexcept
+{
+	return {this, 0, head};
+}
+
+inline Array::const_iterator Array::end() const noexcept
+{
+	return {this, length, {}};
+}
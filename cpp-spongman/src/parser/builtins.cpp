@@ -1,9 +1,169 @@
 #include <unordered_map>
 #include <string_view>
 #include <iostream>
+#include <optional>
+#include <algorithm>
 
 #include "token.hpp"
 #include "builtins.hpp"
+#include "statement.hpp"
+#include "pool.hpp"
+#include "memo.hpp"
+
+
+namespace
+{
+	using B = BuiltinBinaryFunctionExpression;
+
+	Value invalid(std::string_view name, const Value& value)
+	{
+		return Value::error("invalid argument to " + std::string{name} + "(): " + std::to_string(value));
+	}
+
+	Value wrongArguments(std::string_view name, Arguments arguments)
+	{
+		return Value::error("wrong number of arguments to " + std::string{name} + "(): " + std::to_string(arguments.size()));
+	}
+
+	// call a function value with evaluated arguments, as a call expression would
+	template<typename... Values>
+	Value invoke(const Value& function, const Values&... values)
+	{
+		if (!function.is<BoundFunction>())
+			return CallExpression::notCallable(function);
+
+		const auto& [fn, closureEnv] = function.get<BoundFunction>();
+		const Value arguments[] = { values... };
+		return fn->apply(closureEnv, arguments);
+	}
+
+	// the truth of left op right, as an if would test it
+	Value test(const B& op, const Value& left, const Value& right)
+	{
+		const auto result = op.call(left, right);
+		if (result.failed())
+			return result;
+		return IfStatement::truthy(result);
+	}
+
+	// the elements of an array, or the characters of a string, as first() and rest() see them. an empty
+	// hash has none either, as len() sees it
+	std::optional<Array> elements(const Value& xs)
+	{
+		if (xs.is<Array>())
+			return xs.get<Array>();
+		if (xs.is<Hash>() && xs.get<Hash>().empty())
+			return Array{};
+		if (!xs.is<String>())
+			return std::nullopt;
+
+		std::vector<Value> characters;
+		for (const auto character : xs.get<String>())
+			characters.push_back(Value{std::string{character}});
+		return Array{std::move(characters)};
+	}
+
+	// the error a recursion of the prelude over len(), first() and rest() fails with on xs, which elements()
+	// rejected: len() takes a hash, but first() doesn't
+	Value unlisted(const Value& xs)
+	{
+		return invalid(xs.is<Hash>() ? "first" : "len", xs);
+	}
+
+	// the error the prelude's test of a count n that isn't an Integer fails with, as n op 0
+	Value uncounted(std::string_view name, const B& op, const Value& n)
+	{
+		const auto result = test(op, n, Value{0});
+		return result.failed() ? result : invalid(name, n);
+	}
+
+	// merge the sorted values[first, middle) and values[middle, last) as the prelude's merge sort does:
+	// on a <= b, so comparisons are made in the same order. a comparison that fails is the result
+	Value merge(std::vector<Value>& values, size_t first, size_t middle, size_t last, std::vector<Value>& merged)
+	{
+		merged.clear();
+		auto a = first, b = middle;
+		while (a < middle && b < last) {
+			const auto result = test(B::le, values[a], values[b]);
+			if (result.failed())
+				return result;
+			merged.push_back(result.get<bool>() ? values[a++] : values[b++]);
+		}
+		merged.insert(merged.end(), values.begin() + a, values.begin() + middle);
+		merged.insert(merged.end(), values.begin() + b, values.begin() + last);
+		std::move(merged.begin(), merged.end(), values.begin() + first);
+		return {};
+	}
+
+	// the prelude's merge sort of values[first, last): the first half, then the second, then merging them
+	Value mergeSort(std::vector<Value>& values, size_t first, size_t last, std::vector<Value>& merged)
+	{
+		if (last - first <= 1)
+			return {};
+		const auto middle = first + (last - first) / 2;
+		if (auto failure = mergeSort(values, first, middle, merged); failure.failed())
+			return failure;
+		if (auto failure = mergeSort(values, middle, last, merged); failure.failed())
+			return failure;
+		return merge(values, first, middle, last, merged);
+	}
+
+	// whether the values are all integers, which compare without failing
+	bool integral(const std::vector<Value>& values)
+	{
+		return std::all_of(values.begin(), values.end(), [](const Value& x) { return x.is<Integer>(); });
+	}
+
+	bool lessInteger(const Value& a, const Value& b)
+	{
+		return a.get<Integer>() < b.get<Integer>();
+	}
+
+	// call body(first, last) on the pool for each of count chunks of [0, size), concurrently.
+	// the results of the calls, in order
+	template<typename Body>
+	std::vector<Value> parallel(size_t size, size_t count, const Body& body)
+	{
+		std::vector<Value> results(count);
+		ThreadPool::instance().run(count, [&](size_t chunk) {
+			results[chunk] = body(size * chunk / count, size * (chunk + 1) / count);
+		});
+		return results;
+	}
+
+	// chunks for the pool to balance: a few per thread
+	size_t chunks(size_t size)
+	{
+		return std::min(size, ThreadPool::instance().concurrency() * 4);
+	}
+
+	// the first failed result, or nil
+	Value failure(const std::vector<Value>& results)
+	{
+		const auto failed = std::find_if(results.begin(), results.end(), [](const Value& result) { return result.failed(); });
+		return failed == results.end() ? Value{} : *failed;
+	}
+
+	// fold the rest of xs into its first element, from the left, as foldl(op, first(xs), rest(xs))
+	template<typename Op>
+	Value fold1(const Value& xs, Op op)
+	{
+		if (!xs.is<Array>() && !xs.is<String>())
+			return invalid("first", xs);
+		// and foldl() of rest() of an empty one is len() of nil
+		const auto array = elements(xs);
+		if (array->empty())
+			return invalid("len", Value{});
+
+		auto result = array->front();
+		for (const auto& x : array->rest()) {
+			result = op(result, x);
+			if (result.failed())
+				return result;
+		}
+		return result;
+	}
+}
 
 
 // BuiltinFunctionExpression
@@ -11,88 +171,505 @@
 std::vector<BuiltinFunctionExpression> BuiltinFunctionExpression::builtins{
 
 	{ "len", {"val"},
-		[](const Array& arguments) {
-			if (arguments.size() != 1)
-				throw std::runtime_error("wrong number of arguments to len(): " + std::to_string(arguments.size()));
-
-			return Value{std::visit(overloaded{
-				[](const String& str) { return static_cast<Integer>(str.length()); },
-				[](const Array& array) { return static_cast<Integer>(array.size()); },
-				[](const auto& value) -> Integer {
-					throw std::runtime_error("invalid argument to len(): " + std::to_string(value));
+		[](const Value& argument) {
+			return visit(overloaded{
+				[](const String& str) { return Value{str.length()}; },
+				[](const Array& array) { return Value{array.size()}; },
+				[](const Hash& hash) { return Value{hash.size()}; },
+				[](const auto& value) {
+					return Value::error("invalid argument to len(): " + std::to_string(value));
 				}
-			}, arguments[0].data)};
+			}, argument);
 		}
 	},
 	{ "first", {"arr"},
-		[](const Array& arguments) {
-			if (arguments.size() != 1)
-				throw std::runtime_error("wrong number of arguments to first(): " + std::to_string(arguments.size()));
-
-			return std::visit(overloaded{
+		[](const Value& argument) {
+			return visit(overloaded{
 				[](const String& str) { return str.empty() ? Value{} : Value{std::string{str.front()}}; },
 				[](const Array& array) { return array.empty() ? Value{} : array.front(); },
-				[](const auto& value) -> Value {
-					throw std::runtime_error("invalid argument to first(): " + std::to_string(value));
+				[](const auto& value) {
+					return Value::error("invalid argument to first(): " + std::to_string(value));
 				}
-			}, arguments[0].data);
+			}, argument);
 		}
 	},
 	{ "last", {"arr"},
-		[](const Array& arguments) {
-			if (arguments.size() != 1)
-				throw std::runtime_error("wrong number of arguments to last(): " + std::to_string(arguments.size()));
-
-			return std::visit(overloaded{
+		[](const Value& argument) {
+			return visit(overloaded{
 				[](const String& str) { return str.empty() ? Value{} : Value{std::string{str.back()}}; },
 				[](const Array& array) { return array.empty() ? Value{} : array.back(); },
-				[](const auto& value) -> Value {
-					throw std::runtime_error("invalid argument to last(): " + std::to_string(value));
+				[](const auto& value) {
+					return Value::error("invalid argument to last(): " + std::to_string(value));
 				}
-			}, arguments[0].data);
+			}, argument);
 		}
 	},
 	{ "rest", {"arr"},
-		[](const Array& arguments) {
-			if (arguments.size() != 1)
-				throw std::runtime_error("wrong number of arguments to rest(): " + std::to_string(arguments.size()));
-
-			return std::visit(overloaded{
+		[](const Value& argument) {
+			return visit(overloaded{
 				[](const String& str) { return str.empty() ? Value{} : Value{str.substr(1)}; },
-				[](const Array& array) {
-					if (array.empty())
-						return Value{};
-					Array rest;
-					std::copy(++array.cbegin(), array.cend(), std::back_inserter(rest));
-					return Value{rest};
-				},
-				[](const auto& value) -> Value {
-					throw std::runtime_error("invalid argument to rest(): " + std::to_string(value));
+				[](const Array& array) { return array.empty() ? Value{} : Value{array.rest()}; },
+				[](const auto& value) {
+					return Value::error("invalid argument to rest(): " + std::to_string(value));
 				}
-			}, arguments[0].data);
+			}, argument);
 		}
 	},
 	{ "puts", {"str"},
-		[](const Array& arguments) {
+		[](Arguments arguments) {
 			bool first = true;
 			for (const auto& argument : arguments) {
 				if (!first)
 					std::cout << " ";
 				first = false;
 
-				std::visit(overloaded{
+				visit(overloaded{
 					[](const String& str) {
 						std::cout << str;
 					},
 					[](const auto& value) {
 						std::cout << std::to_string(value);
 					}
-				}, argument.data);
+				}, argument);
 			}
 			std::cout << "\n";
 			return Value{};
 		}
 	},
+
+	// map, filter, foldl and sort, with the elements split between the threads of the ThreadPool.
+	// the functions passed must be pure: they are called concurrently, and in no particular order
+	{ "pmap", {"f", "xs"},
+		[](const Value& f, const Value& xs) {
+			const auto array = elements(xs);
+			if (!array)
+				return invalid("pmap", xs);
+
+			const std::vector<Value> values(array->begin(), array->end());
+			std::vector<Value> results(values.size());
+			const auto failed = failure(parallel(values.size(), chunks(values.size()), [&](size_t first, size_t last) {
+				for (auto i = first; i < last; i++) {
+					auto result = invoke(f, values[i]);
+					if (result.failed())
+						return result;
+					results[i] = std::move(result);
+				}
+				return Value{};
+			}));
+			if (failed.failed())
+				return failed;
+			return Value{Array{std::move(results)}};
+		}
+	},
+	{ "pfilter", {"f", "xs"},
+		[](const Value& f, const Value& xs) {
+			const auto array = elements(xs);
+			if (!array)
+				return invalid("pfilter", xs);
+
+			// filter tests the last element first, so fails on the last element that fails
+			const std::vector<Value> values(array->begin(), array->end());
+			std::vector<char> kept(values.size());
+			auto results = parallel(values.size(), chunks(values.size()), [&](size_t first, size_t last) {
+				for (auto i = last; i-- > first; ) {
+					auto result = invoke(f, values[i]);
+					if (!result.failed())
+						result = IfStatement::truthy(result);
+					if (result.failed())
+						return result;
+					kept[i] = result.get<bool>();
+				}
+				return Value{};
+			});
+			std::reverse(results.begin(), results.end());
+			if (const auto failed = failure(results); failed.failed())
+				return failed;
+
+			std::vector<Value> filtered;
+			for (size_t i = 0; i < values.size(); i++) {
+				if (kept[i])
+					filtered.push_back(values[i]);
+			}
+			return Value{Array{std::move(filtered)}};
+		}
+	},
+	{ "preduce", {"op", "r", "xs"},
+		[](Arguments arguments) {
+			if (arguments.size() != 3)
+				return wrongArguments("preduce", arguments);
+			const auto array = elements(arguments[2]);
+			if (!array)
+				return invalid("preduce", arguments[2]);
+
+			// as foldl, for an associative op: each chunk is folded, then r and the chunks are
+			const auto& op = arguments[0];
+			const std::vector<Value> values(array->begin(), array->end());
+			const auto folds = parallel(values.size(), chunks(values.size()), [&](size_t first, size_t last) {
+				auto result = values[first];
+				for (auto i = first + 1; i < last; i++) {
+					result = invoke(op, result, values[i]);
+					if (result.failed())
+						return result;
+				}
+				return result;
+			});
+
+			auto result = arguments[1];
+			for (const auto& fold : folds) {
+				if (fold.failed())
+					return fold;
+				result = invoke(op, result, fold);
+				if (result.failed())
+					return result;
+			}
+			return result;
+		}
+	},
+	{ "psort", {"xs"},
+		[](const Value& xs) {
+			const auto array = elements(xs);
+			if (!array)
+				return invalid("psort", xs);
+			if (array->size() <= 1)
+				return xs;
+
+			// the prelude's merge sort, its halves sorted on the pool down to a range per thread, then
+			// merged back up a level at a time. a range's result is that of its first half, its second,
+			// then its merge, so the failure is the one that sorting in order fails on
+			std::vector<Value> values(array->begin(), array->end());
+			const auto integers = integral(values);
+			const auto at = [&values](size_t index) { return values.begin() + index; };
+
+			// the bounds of the ranges at each level of halving
+			std::vector<std::vector<size_t>> levels{{0, values.size()}};
+			const auto count = std::min(values.size(), ThreadPool::instance().concurrency());
+			while (2 * (levels.back().size() - 1) <= count) {
+				const auto& bounds = levels.back();
+				std::vector<size_t> halves;
+				for (size_t i = 0; i + 1 < bounds.size(); i++) {
+					halves.push_back(bounds[i]);
+					halves.push_back(bounds[i] + (bounds[i + 1] - bounds[i]) / 2);
+				}
+				halves.push_back(values.size());
+				levels.push_back(std::move(halves));
+			}
+
+			auto bounds = levels.back();
+			std::vector<Value> failures(bounds.size() - 1);
+			ThreadPool::instance().run(failures.size(), [&](size_t range) {
+				if (integers) {
+					std::stable_sort(at(bounds[range]), at(bounds[range + 1]), lessInteger);
+					return;
+				}
+				std::vector<Value> merged;
+				failures[range] = mergeSort(values, bounds[range], bounds[range + 1], merged);
+			});
+
+			for (levels.pop_back(); !levels.empty(); levels.pop_back()) {
+				const auto halves = std::move(bounds);
+				const auto halved = std::move(failures);
+				bounds = levels.back();
+				failures.assign(bounds.size() - 1, Value{});
+				ThreadPool::instance().run(failures.size(), [&](size_t range) {
+					const auto* half = &halves[2 * range];
+					if (halved[2 * range].failed())
+						failures[range] = halved[2 * range];
+					else if (halved[2 * range + 1].failed())
+						failures[range] = halved[2 * range + 1];
+					else if (integers)
+						std::inplace_merge(at(half[0]), at(half[1]), at(half[2]), lessInteger);
+					else {
+						std::vector<Value> merged;
+						failures[range] = merge(values, half[0], half[1], half[2], merged);
+					}
+				});
+			}
+
+			if (failures.front().failed())
+				return failures.front();
+			return Value{Array{std::move(values)}};
+		}
+	},
+
+	// a function that keeps the results of f by their arguments, while f is pure (see MemoFunctionExpression)
+	{ "memo", {"f"},
+		[](const Value& f) {
+			return MemoFunctionExpression::wrap(f);
+		}
+	},
+
+	// hashes are persistent: these return a new hash, sharing all but O(log32 n) of the old one's nodes
+	{ "put", {"h", "k", "v"},
+		[](Arguments arguments) {
+			if (arguments.size() != 3)
+				return wrongArguments("put", arguments);
+			if (!arguments[0].is<Hash>())
+				return invalid("put", arguments[0]);
+			return Value{arguments[0].get<Hash>().put(arguments[1], arguments[2])};
+		}
+	},
+	{ "remove", {"h", "k"},
+		[](const Value& h, const Value& k) {
+			if (!h.is<Hash>())
+				return invalid("remove", h);
+			return Value{h.get<Hash>().remove(k)};
+		}
+	},
+	{ "has", {"h", "k"},
+		[](const Value& h, const Value& k) {
+			if (!h.is<Hash>())
+				return invalid("has", h);
+			return Value{h.get<Hash>().contains(k)};
+		}
+	},
+	// in the order the keys were added
+	{ "keys", {"h"},
+		[](const Value& h) {
+			if (!h.is<Hash>())
+				return invalid("keys", h);
+			std::vector<Value> keys;
+			keys.reserve(h.get<Hash>().size());
+			for (const auto& [key, value] : h.get<Hash>())
+				keys.push_back(key);
+			return Value{Array{std::move(keys)}};
+		}
+	},
+	{ "values", {"h"},
+		[](const Value& h) {
+			if (!h.is<Hash>())
+				return invalid("values", h);
+			std::vector<Value> values;
+			values.reserve(h.get<Hash>().size());
+			for (const auto& [key, value] : h.get<Hash>())
+				values.push_back(value);
+			return Value{Array{std::move(values)}};
+		}
+	},
+};
+
+
+// library
+
+// each has the semantics of the monkey definition in prelude.pure, down to the order functions are called and
+// elements compared in, and the error a call fails with. only a call with the wrong number of arguments differs:
+// it fails, where the monkey definition takes the missing arguments as nil
+std::vector<BuiltinFunctionExpression> BuiltinFunctionExpression::library{
+
+	{ "map", {"f", "xs"},
+		[](const Value& f, const Value& xs) {
+			const auto array = elements(xs);
+			if (!array)
+				return unlisted(xs);
+
+			std::vector<Value> results;
+			results.reserve(array->size());
+			for (const auto& x : *array) {
+				auto result = invoke(f, x);
+				if (result.failed())
+					return result;
+				results.push_back(std::move(result));
+			}
+			return Value{Array{std::move(results)}};
+		}
+	},
+	{ "filter", {"f", "xs"},
+		[](const Value& f, const Value& xs) {
+			const auto array = elements(xs);
+			if (!array)
+				return unlisted(xs);
+
+			// the last element is tested first
+			const std::vector<Value> values(array->begin(), array->end());
+			std::vector<Value> kept;
+			for (auto x = values.rbegin(); x != values.rend(); ++x) {
+				auto result = invoke(f, *x);
+				if (!result.failed())
+					result = IfStatement::truthy(result);
+				if (result.failed())
+					return result;
+				if (result.get<bool>())
+					kept.push_back(*x);
+			}
+			std::reverse(kept.begin(), kept.end());
+			return Value{Array{std::move(kept)}};
+		}
+	},
+	{ "foldl", {"op", "r", "xs"},
+		[](Arguments arguments) {
+			if (arguments.size() != 3)
+				return wrongArguments("foldl", arguments);
+			const auto array = elements(arguments[2]);
+			if (!array)
+				return unlisted(arguments[2]);
+
+			auto result = arguments[1];
+			for (const auto& x : *array) {
+				result = invoke(arguments[0], result, x);
+				if (result.failed())
+					return result;
+			}
+			return result;
+		}
+	},
+	{ "foldr", {"op", "r", "xs"},
+		[](Arguments arguments) {
+			if (arguments.size() != 3)
+				return wrongArguments("foldr", arguments);
+			const auto array = elements(arguments[2]);
+			if (!array)
+				return unlisted(arguments[2]);
+
+			const std::vector<Value> values(array->begin(), array->end());
+			auto result = arguments[1];
+			for (auto x = values.rbegin(); x != values.rend(); ++x) {
+				result = invoke(arguments[0], *x, result);
+				if (result.failed())
+					return result;
+			}
+			return result;
+		}
+	},
+	{ "reverse", {"xs"},
+		[](const Value& xs) {
+			const auto array = elements(xs);
+			if (!array)
+				return unlisted(xs);
+
+			std::vector<Value> values(array->begin(), array->end());
+			std::reverse(values.begin(), values.end());
+			return Value{Array{std::move(values)}};
+		}
+	},
+	{ "take", {"n", "xs"},
+		[](const Value& n, const Value& xs) {
+			// n <= 0 || (len(xs) == 0), which evaluates both
+			if (!n.is<Integer>())
+				return uncounted("take", B::le, n);
+			if (!xs.is<Array>() && !xs.is<String>() && !xs.is<Hash>())
+				return invalid("len", xs);
+			if (n.get<Integer>() <= 0)
+				return Value{Array{}};
+			const auto array = elements(xs);
+			if (!array)
+				return unlisted(xs);
+
+			const auto count = std::clamp<Integer>(n.get<Integer>(), 0, array->size());
+			return Value{array->take(count)};
+		}
+	},
+	{ "drop", {"n", "xs"},
+		[](const Value& n, const Value& xs) {
+			if (!n.is<Integer>())
+				return uncounted("drop", B::gt, n);
+			const auto count = n.get<Integer>();
+			if (count <= 0)
+				return xs;
+
+			// rest() of an empty array or string is nil, and there's no rest() of nil
+			size_t size = 0;
+			if (xs.is<Array>())
+				size = xs.get<Array>().size();
+			else if (xs.is<String>())
+				size = xs.get<String>().size();
+			else
+				return invalid("rest", xs);
+
+			if (static_cast<size_t>(count) == size + 1)
+				return Value{};
+			if (static_cast<size_t>(count) > size)
+				return invalid("rest", Value{});
+
+			if (xs.is<Array>())
+				return Value{xs.get<Array>().drop(count)};
+			return Value{xs.get<String>().substr(count)};
+		}
+	},
+	{ "sort", {"xs"},
+		[](const Value& xs) {
+			const auto array = elements(xs);
+			if (!array) {
+				if (xs.is<Hash>() && xs.get<Hash>().size() <= 1)
+					return xs;
+				return unlisted(xs);
+			}
+			if (array->size() <= 1)
+				return xs;
+
+			// integers compare without failing, so any stable sort has the same result
+			std::vector<Value> values(array->begin(), array->end());
+			if (integral(values)) {
+				std::stable_sort(values.begin(), values.end(), lessInteger);
+				return Value{Array{std::move(values)}};
+			}
+
+			std::vector<Value> merged;
+			merged.reserve(values.size());
+			if (auto failure = mergeSort(values, 0, values.size(), merged); failure.failed())
+				return failure;
+			return Value{Array{std::move(values)}};
+		}
+	},
+	{ "concat", {"xs"},
+		[](const Value& xs) {
+			const auto array = elements(xs);
+			if (!array)
+				return unlisted(xs);
+
+			const std::vector<Value> values(array->begin(), array->end());
+			auto result = Value{Array{}};
+			for (auto x = values.rbegin(); x != values.rend(); ++x) {
+				result = B::plus.call(*x, result);
+				if (result.failed())
+					return result;
+			}
+			return result;
+		}
+	},
+	{ "sum", {"xs"},
+		[](const Value& xs) {
+			const auto array = elements(xs);
+			if (!array)
+				return unlisted(xs);
+
+			auto result = Value{0};
+			for (const auto& x : *array) {
+				result = B::plus.call(result, x);
+				if (result.failed())
+					return result;
+			}
+			return result;
+		}
+	},
+	{ "product", {"xs"},
+		[](const Value& xs) {
+			return fold1(xs, [](const Value& a, const Value& b) { return B::asterisk.call(a, b); });
+		}
+	},
+	{ "max", {"xs"},
+		[](const Value& xs) {
+			return fold1(xs, [](const Value& a, const Value& b) {
+				const auto result = test(B::ge, a, b);
+				return result.failed() ? result : result.get<bool>() ? a : b;
+			});
+		}
+	},
+	{ "min", {"xs"},
+		[](const Value& xs) {
+			return fold1(xs, [](const Value& a, const Value& b) {
+				const auto result = test(B::gt, a, b);
+				return result.failed() ? result : result.get<bool>() ? b : a;
+			});
+		}
+	},
+	{ "rep", {"c", "x"},
+		[](const Value& c, const Value& x) {
+			if (!c.is<Integer>())
+				return uncounted("rep", B::le, c);
+
+			const auto count = std::max<Integer>(c.get<Integer>(), 0);
+			return Value{Array{std::vector<Value>(count, x)}};
+		}
+	},
 };
 
 void BuiltinFunctionExpression::print(std::ostream& os) const
@@ -106,165 +683,173 @@ void BuiltinFunctionExpression::print(std::ostream& os) const
 // BuiltinBinaryFunctionExpression
 
 Value BuiltinBinaryFunctionExpression::call(
-	EnvironmentP closureEnv,
-	EnvironmentP callerEnv,
+	const EnvironmentP& closureEnv,
+	Environment& callerEnv,
 	const std::vector<ExpressionP>& arguments
 ) const
 {
 	if (arguments.size() != 2)
-		throw std::runtime_error("wrong number of arguments to " + name + "(): " + std::to_string(arguments.size()));
+		return Value::error("wrong number of arguments to " + name + "(): " + std::to_string(arguments.size()));
 
 	auto leftValue = arguments[0]->eval(callerEnv);
+	if (leftValue.abrupt())
+		return leftValue;
 	auto rightValue = arguments[1]->eval(callerEnv);
+	if (rightValue.abrupt())
+		return rightValue;
 	return call(leftValue, rightValue);
 }
 
+Value BuiltinBinaryFunctionExpression::apply(const EnvironmentP& closureEnv, Arguments arguments) const
+{
+	if (arguments.size() != 2)
+		return Value::error("wrong number of arguments to " + name + "(): " + std::to_string(arguments.size()));
+
+	return call(arguments[0], arguments[1]);
+}
+
 
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::asterisk {
 	"*",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left * right}; },
 			// TODO: function composition?
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("*", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("*", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::slash {
 	"/",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left / right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("/", left, right); return Value{};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("/", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::percent {
 	"%",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left % right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("%", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("%", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::plus {
 	"+",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left + right}; },
 			[](const String& left, const String& right) { return Value{left + right}; },
 			[](const String& left, const Integer right) { return Value{left + std::to_string(right)}; },
-			[](const Array& left, const Array& right) {
-				Array result;
-				std::copy(left.cbegin(), left.cend(), std::back_inserter(result));
-				std::copy(right.cbegin(), right.cend(), std::back_inserter(result));
-				return Value{result};
-			},
+			[](const Array& left, const Array& right) { return Value{left + right}; },
 			[](const Hash& left, const Hash& right) {
-				Hash result;
-				for (const auto& [key, value] : left)  result[key] = value;
-				for (const auto& [key, value] : right) result[key] = value;
-				return Value{result};
+				// left's entries are shared, and right's are put over them
+				auto result = left;
+				for (const auto& [key, value] : right)
+					result.insert_or_assign(key, value);
+				return Value{std::move(result)};
 			},
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("+", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("+", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::minus {
 	"-",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left - right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("-", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("-", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::bitAnd {
 	"&",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left & right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("&", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("&", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::bitOr {
 	"|",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left | right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("|", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("|", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::bitEor {
 	"^",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left ^ right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("^", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("^", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::lt {
 	"<",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left < right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("<", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("<", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::gt {
 	">",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left > right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error(">", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error(">", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::le {
 	"<=",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left <= right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("<=", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("<=", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::ge {
 	">=",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const Integer left, const Integer right) { return Value{left >= right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error(">=", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error(">=", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::eq {
@@ -282,23 +867,23 @@ BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::neq {
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::and_ {
 	"&&",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const bool left, const bool right) { return Value{left && right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("&&", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("&&", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 BuiltinBinaryFunctionExpression BuiltinBinaryFunctionExpression::or_ {
 	"||",
 	[](const Value& left, const Value& right) {
-		return std::visit(overloaded{
+		return visit(overloaded{
 			[](const bool left, const bool right) { return Value{left || right}; },
-			[](const auto& left, const auto& right) -> Value {
-				BuiltinBinaryFunctionExpression::error("||", left, right); return {};
+			[](const auto& left, const auto& right) {
+				return BuiltinBinaryFunctionExpression::error("||", left, right);
 			}
-		}, left.data, right.data);
+		}, left, right);
 	}
 };
 
@@ -8,36 +8,51 @@
 
 struct BuiltinFunctionExpression : public AbstractFunctionExpression
 {
-	BuiltinFunctionExpression(
-		std::string&& name,
-		std::vector<std::string>&& parameters,
-		std::function<Value(const Array& arguments)>&& body)
-	: AbstractFunctionExpression{std::move(parameters)}
-	, name{std::move(name)}
-	, body{std::move(body)}
-	{}
+	// a builtin taking one or two arguments gets them directly, any other gets a span over them.
+	// calls evaluate arguments into a buffer on the stack, so calling a builtin doesn't allocate.
+	using Unary = Value (*)(const Value& argument);
+	using Binary = Value (*)(const Value& left, const Value& right);
+	using Variadic = Value (*)(Arguments arguments);
+
+	BuiltinFunctionExpression(std::string&& name, std::vector<std::string>&& parameters, Unary body)
+	: AbstractFunctionExpression{std::move(parameters)}, name{std::move(name)}, arity{1}, unary{body} {}
+	BuiltinFunctionExpression(std::string&& name, std::vector<std::string>&& parameters, Binary body)
+	: AbstractFunctionExpression{std::move(parameters)}, name{std::move(name)}, arity{2}, binary{body} {}
+	BuiltinFunctionExpression(std::string&& name, std::vector<std::string>&& parameters, Variadic body)
+	: AbstractFunctionExpression{std::move(parameters)}, name{std::move(name)}, variadic{body} {}
 
 	void print(std::ostream& os) const override;
 	Value call(
-		EnvironmentP closureEnv,
-		EnvironmentP callerEnv,
+		const EnvironmentP& closureEnv,
+		Environment& callerEnv,
 		const std::vector<ExpressionP>& arguments
 	) const override;
+	Value apply(const EnvironmentP& closureEnv, Arguments arguments) const override;
+	const BuiltinFunctionExpression* builtin() const override { return this; }
 
 	const std::string name;
 
 	static std::vector<BuiltinFunctionExpression> builtins;
 
+	// the list functions of the prelude (map, filter, foldl, sort, ...), implemented natively.
+	// prelude.pure has them in monkey, for --pure-prelude
+	static std::vector<BuiltinFunctionExpression> library;
+
 private:
-	const std::function<Value(const Array& arguments)> body;
+	// arguments evaluated into a buffer on the stack, more than this go to the heap
+	static constexpr size_t buffered = 4;
+
+	const size_t arity = 0;	// of a Unary or Binary body, 0 for a Variadic one
+	const Unary unary = nullptr;
+	const Binary binary = nullptr;
+	const Variadic variadic = nullptr;
 };
 
 struct BuiltinBinaryFunctionExpression : public AbstractFunctionExpression
 {
-	BuiltinBinaryFunctionExpression(
-		std::string&& name,
-		std::function<Value(const Value& left, const Value& right)>&& body
-	)
+	using Body = Value (*)(const Value& left, const Value& right);
+
+	BuiltinBinaryFunctionExpression(std::string&& name, Body body)
 	: AbstractFunctionExpression{{"x", "y"}}
 	, name{std::move(name)}
 	, body{std::move(body)}
@@ -45,18 +60,19 @@ struct BuiltinBinaryFunctionExpression : public AbstractFunctionExpression
 
 	//void print(std::ostream& os) const override;
 	Value call(
-		EnvironmentP closureEnv,
-		EnvironmentP callerEnv,
+		const EnvironmentP& closureEnv,
+		Environment& callerEnv,
 		const std::vector<ExpressionP>& arguments
 	) const override;
+	Value apply(const EnvironmentP& closureEnv, Arguments arguments) const override;
 
 	Value call(const Value& left, const Value& right) const { return body(left, right); }
 
 	const std::string name;
 
 	template<typename T1, typename T2>
-	static void error(std::string_view name, const T1& left, const T2& right) {
-		throw std::runtime_error("invalid infix operation " + std::to_string(left) + " " + std::string{name} + " " + std::to_string(right));
+	static Value error(std::string_view name, const T1& left, const T2& right) {
+		return Value::error("invalid infix operation " + std::to_string(Value{left}) + " " + std::string{name} + " " + std::to_string(Value{right}));
 	}
 
 	static BuiltinBinaryFunctionExpression asterisk;
@@ -79,5 +95,5 @@ struct BuiltinBinaryFunctionExpression : public AbstractFunctionExpression
 	static std::unordered_map<TokenType, BuiltinBinaryFunctionExpression*> builtins;
 
 private:
-	const std::function<Value(const Value& left, const Value& right)> body;
+	const Body body;
 };
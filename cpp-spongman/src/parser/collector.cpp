@@ -0,0 +1,373 @@
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <unordered_map>
+
+#include "collector.hpp"
+#include "environment.hpp"
+#include "snapshot.hpp"
+#include "array.hpp"
+#include "hash.hpp"
+
+// Tracer
+
+struct Collector::Tracer
+{
+	// the kinds of object a collection traces through
+	enum class Kind : uint8_t
+	{
+		Environment,
+		Layer,
+		Snapshot,
+		Function,
+		Array,
+		Node,	// of an Array
+		Hash,
+		Trie,	// a node of a Hash
+	};
+
+	struct Target
+	{
+		Kind kind;
+		const void* address;
+	};
+
+	// call f(target, count) for each object target refers to, with its reference count
+	template<typename F>
+	static void references(Target target, F&& f);
+
+private:
+	// a boxed value that may refer to an environment
+	template<typename F>
+	static void reference(const Value& value, F& f)
+	{
+		const auto* object = value.object();
+		switch (value.type()) {
+			case ValueType::Function: f(Target{Kind::Function, object}, object->refcount()); break;
+			case ValueType::Array:    f(Target{Kind::Array, object}, object->refcount()); break;
+			case ValueType::Hash:     f(Target{Kind::Hash, object}, object->refcount()); break;
+		}
+	}
+
+	template<typename T, typename F>
+	static void reference(Kind kind, const std::shared_ptr<T>& pointer, F& f)
+	{
+		if (pointer)
+			f(Target{kind, pointer.get()}, pointer.use_count());
+	}
+};
+
+template<typename F>
+void Collector::Tracer::references(Target target, F&& f)
+{
+	const auto* address = target.address;
+	switch (target.kind) {
+		case Kind::Environment:
+		{
+			const auto& env = *static_cast<const Environment*>(address);
+			reference(Kind::Environment, env.parent, f);
+			for (size_t slot = 0; slot < env.slotCount; slot++)
+				reference(env.slots[slot], f);
+			for (const auto& [name, value] : env.values)
+				reference(value, f);
+			reference(Kind::Layer, env.layers, f);
+			break;
+		}
+
+		case Kind::Layer:
+		{
+			const auto& layer = *static_cast<const Environment::Layer*>(address);
+			for (const auto& [name, value] : layer.values)
+				reference(value, f);
+			reference(Kind::Layer, layer.next, f);
+			reference(Kind::Snapshot, layer.snapshot, f);
+			break;
+		}
+
+		case Kind::Snapshot:
+		{
+			const auto& snapshot = *static_cast<const Snapshot*>(address);
+			std::lock_guard lock{snapshot.mutex};
+			for (const auto& [name, value] : snapshot.values)
+				reference(value, f);
+			for (const auto& [index, frame] : snapshot.frames)
+				reference(Kind::Environment, frame, f);
+			break;
+		}
+
+		case Kind::Function:
+			reference(Kind::Environment, static_cast<const Boxed<BoundFunction>*>(address)->value.second, f);
+			break;
+
+		case Kind::Array:
+			if (const auto& root = static_cast<const Boxed<Array>*>(address)->value.root)
+				f(Target{Kind::Node, root.get()}, root->refcount());
+			break;
+
+		case Kind::Node:
+		{
+			const auto& node = *static_cast<const Array::Node*>(address);
+			for (const auto& element : node.elements)
+				reference(element, f);
+			for (const auto* child : {node.left.get(), node.right.get()}) {
+				if (child)
+					f(Target{Kind::Node, child}, child->refcount());
+			}
+			break;
+		}
+
+		case Kind::Hash:
+			if (const auto& root = static_cast<const Boxed<Hash>*>(address)->value.root)
+				f(Target{Kind::Trie, root.get()}, root->refcount());
+			break;
+
+		case Kind::Trie:
+		{
+			const auto& node = *static_cast<const Hash::Node*>(address);
+			for (const auto& entry : node.entries) {
+				reference(entry.binding.first, f);
+				reference(entry.binding.second, f);
+			}
+			for (const auto& child : node.nodes)
+				f(Target{Kind::Trie, child.get()}, child->refcount());
+			break;
+		}
+	}
+}
+
+
+// Collector
+
+struct Collector::Heap
+{
+	std::mutex mutex;	// tasks of a parallel section track environments at once
+	std::vector<std::weak_ptr<Environment>> young;
+	std::vector<std::weak_ptr<Environment>> old;
+	size_t pruned = 0;	// old's size when its expired environments were last dropped
+	size_t collections = 0;	// young ones since the last full one
+	size_t promoted = 0;	// since the last full collection
+	std::atomic<size_t> sections{0};
+
+	// collects a thread's own heap as the thread exits
+	~Heap();
+};
+
+namespace
+{
+	// what threads that have exited left tracked, which the next collection on any thread adopts.
+	// any thread may hand it environments, so it's always in a section: it's never collected itself
+	Collector::Heap orphans{.sections{1}};
+
+	thread_local Collector::Heap own;
+	thread_local Collector::Heap* current = &own;
+}
+
+Collector::Heap::~Heap()
+{
+	if (this == &orphans)
+		return;
+
+	// the thread's stacks are gone, so what it tracked is only reachable from other threads, or not at all.
+	// what survives, and what's tracked as the thread's other objects are destroyed, goes to orphans
+	current = &orphans;
+	collect(*this, true);
+	std::lock_guard lock{orphans.mutex};
+	orphans.young.insert(orphans.young.end(), young.begin(), young.end());
+	orphans.old.insert(orphans.old.end(), old.begin(), old.end());
+}
+
+std::atomic<size_t> Collector::young{0};
+std::atomic<size_t> Collector::full{0};
+std::atomic<size_t> Collector::freed{0};
+
+void Collector::track(const EnvironmentP& env)
+{
+	if (!env || env->tracked.load(std::memory_order_relaxed) || env->tracked.exchange(true))
+		return;
+
+	// only the tasks of a parallel section track in the same heap at once
+	auto& heap = *current;
+	if (heap.sections.load(std::memory_order_acquire) == 0)
+		return heap.young.push_back(env);
+	std::lock_guard lock{heap.mutex};
+	heap.young.push_back(env);
+}
+
+void Collector::poll()
+{
+	auto& heap = *current;
+	if (heap.sections.load(std::memory_order_acquire) > 0)
+		return;
+
+	if (heap.young.size() < nursery)
+		return;
+
+	// a full collection once old has grown by a quarter, at most every ratio young ones
+	const auto all = ++heap.collections >= ratio && heap.promoted * 4 >= heap.old.size();
+	collect(heap, all);
+}
+
+size_t Collector::collect(bool full)
+{
+	auto& heap = *current;
+	if (heap.sections.load(std::memory_order_acquire) > 0)
+		return 0;
+	return collect(heap, full);
+}
+
+size_t Collector::collect(Heap& heap, bool all)
+{
+	using Kind = Tracer::Kind;
+	using Target = Tracer::Target;
+
+	std::lock_guard lock{heap.mutex};
+
+	// adopt the environments of threads that have exited, the old ones to be collected with the old generation
+	{
+		std::lock_guard adopting{orphans.mutex};
+		heap.young.insert(heap.young.end(), orphans.young.begin(), orphans.young.end());
+		heap.old.insert(heap.old.end(), orphans.old.begin(), orphans.old.end());
+		heap.promoted += orphans.old.size();
+		orphans.young.clear();
+		orphans.old.clear();
+	}
+
+	// the candidates, kept alive until the end. old environments aren't traced by a young collection,
+	// so references from them count as coming from outside, like those from sealed ones
+	std::vector<EnvironmentP> candidates;
+	// a sealed one goes straight to the old generation, to be collected once it's unsealed
+	const auto gather = [&](std::vector<std::weak_ptr<Environment>>& generation) {
+		for (const auto& weak : generation) {
+			auto env = weak.lock();
+			if (!env)
+				continue;
+			if (!env->sealed.load(std::memory_order_acquire))
+				candidates.push_back(std::move(env));
+			else if (!std::exchange(env->old, true))
+				heap.old.push_back(env);
+		}
+	};
+	gather(heap.young);
+	if (all)
+		gather(heap.old);
+
+	const auto opaque = [all](const Target& target) {
+		if (target.kind != Kind::Environment)
+			return false;
+		const auto& env = *static_cast<const Environment*>(target.address);
+		return env.sealed.load(std::memory_order_acquire) || (!all && env.old);
+	};
+
+	// the references to each object reached from the candidates, less those from the objects reached.
+	// what's left are references from outside: an object with none is garbage, unless a root reaches it
+	struct Entry
+	{
+		Kind kind;
+		int64_t refs;
+		bool live = false;
+	};
+	std::unordered_map<const void*, Entry> entries;
+	std::vector<Target> pending;
+
+	for (const auto& env : candidates) {
+		// less the reference in candidates
+		const auto [iter, inserted] = entries.try_emplace(env.get(), Entry{Kind::Environment, env.use_count() - 1});
+		if (inserted)
+			pending.push_back({Kind::Environment, env.get()});
+	}
+
+	while (!pending.empty()) {
+		const auto target = pending.back();
+		pending.pop_back();
+		Tracer::references(target, [&](const Target& referenced, int64_t count) {
+			if (opaque(referenced))
+				return;
+			const auto [iter, inserted] = entries.try_emplace(referenced.address, Entry{referenced.kind, count});
+			if (inserted)
+				pending.push_back(referenced);
+			iter->second.refs--;
+		});
+	}
+
+	// everything reached from an object referred to from outside is live
+	for (const auto& [address, entry] : entries) {
+		if (entry.refs > 0)
+			pending.push_back({entry.kind, address});
+	}
+	for (auto& target : pending)
+		entries.at(target.address).live = true;
+	while (!pending.empty()) {
+		const auto target = pending.back();
+		pending.pop_back();
+		Tracer::references(target, [&](const Target& referenced, int64_t) {
+			if (const auto iter = entries.find(referenced.address); iter != entries.end() && !iter->second.live) {
+				iter->second.live = true;
+				pending.push_back(referenced);
+			}
+		});
+	}
+
+	// clear the garbage environments, holding on to them until they all are
+	std::vector<EnvironmentP> garbage;
+	for (const auto& [address, entry] : entries) {
+		if (!entry.live && entry.kind == Kind::Environment)
+			garbage.push_back(const_cast<Environment*>(static_cast<const Environment*>(address))->shared_from_this());
+	}
+	for (const auto& env : garbage)
+		env->clear();
+	const auto count = garbage.size();
+
+	// the survivors are promoted, and the old environments that have gone since are dropped
+	for (auto& env : candidates) {
+		if (!env->old && entries.at(env.get()).live) {
+			env->old = true;
+			heap.old.push_back(env);
+			heap.promoted++;
+		}
+	}
+	heap.young.clear();
+	candidates.clear();
+	garbage.clear();
+
+	if (all || heap.old.size() >= 2 * heap.pruned) {
+		std::erase_if(heap.old, [](const auto& weak) { return weak.expired(); });
+		heap.pruned = heap.old.size();
+	}
+
+	if (all) {
+		heap.collections = 0;
+		heap.promoted = 0;
+		full.fetch_add(1, std::memory_order_relaxed);
+	}
+	else {
+		young.fetch_add(1, std::memory_order_relaxed);
+	}
+	freed.fetch_add(count, std::memory_order_relaxed);
+	return count;
+}
+
+Collector::Stats Collector::stats() noexcept
+{
+	return {young.load(std::memory_order_relaxed), full.load(std::memory_order_relaxed), freed.load(std::memory_order_relaxed)};
+}
+
+Collector::Section::Section() noexcept
+: heap{*current}
+{
+	heap.sections.fetch_add(1, std::memory_order_acq_rel);
+}
+
+Collector::Section::~Section()
+{
+	heap.sections.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+Collector::Task::Task(Heap& heap) noexcept
+: previous{std::exchange(current, &heap)}
+{
+}
+
+Collector::Task::~Task()
+{
+	current = previous;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+struct Environment;
+using EnvironmentP = std::shared_ptr<Environment>;
+
+// reclaims the environments that reference counting can't: a closure stored where its own environment
+// can reach it, like a recursive local function, keeps that environment alive after the call has returned.
+// every such cycle passes through an environment some closure was bound to, so those are tracked, and a
+// collection finds the ones that nothing outside of the environments and values they reach refers to.
+// the roots are whatever holds such a reference: a program's global environment, and the interpreter's
+// stacks, both the vm's and the frames of the tree walk. garbage environments are cleared, which breaks
+// their cycles, and reference counting frees the rest.
+//
+// environments are tracked in a nursery, which is collected on its own, and survivors are promoted to an old
+// generation, which is only collected with it every so often. each thread collects what it tracked, between
+// the parallel sections it starts, whose tasks track in the same heap, and collects it once more as it
+// exits, handing what survives to the next collection on another thread. the sealed global environment of
+// a Prelude, which other threads may be using, is never collected.
+class Collector
+{
+public:
+	struct Stats
+	{
+		size_t young = 0;	// collections of the nursery
+		size_t full = 0;	// collections of both generations
+		size_t freed = 0;	// environments cleared
+	};
+
+	// a closure was bound to env, which may be part of a cycle from here on
+	static void track(const EnvironmentP& env);
+
+	// collect, if the nursery is full and the calling thread isn't in a parallel section.
+	// evaluation calls it where it's about to bind a closure
+	static void poll();
+
+	// collect the nursery, or both generations, of the calling thread: the number of environments freed
+	static size_t collect(bool full = true);
+
+	// the counts so far, of all threads
+	static Stats stats() noexcept;
+
+	struct Heap;
+
+	// the calling thread's parallel section, which its heap isn't collected during
+	struct Section
+	{
+		Section() noexcept;
+		~Section();
+		Section(const Section&) = delete;
+		Section& operator=(const Section&) = delete;
+
+		Heap& heap;
+	};
+
+	// the calling thread runs a task of a section, tracking environments in its heap
+	struct Task
+	{
+		explicit Task(Heap& heap) noexcept;
+		~Task();
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+
+		Heap* previous;
+	};
+
+	static constexpr size_t nursery = 1000;	// environments tracked between collections
+	static constexpr size_t ratio = 10;	// young collections to a full one
+
+private:
+	// follows the references between the objects a collection traces through
+	struct Tracer;
+
+	static size_t collect(Heap& heap, bool full);
+
+	static std::atomic<size_t> young, full, freed;
+};
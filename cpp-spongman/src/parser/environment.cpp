@@ -1,19 +1,95 @@
+#include <new>
+
 #include "value.hpp"
 
 #include "environment.hpp"
+#include "snapshot.hpp"
+
+
+// FramePool
+
+thread_local FramePool::FreeLists FramePool::freeLists;
+thread_local bool FramePool::exited = false;
+
+FramePool::FreeLists::~FreeLists()
+{
+	exited = true;
+	for (auto& head : heads) {
+		while (auto block = head) {
+			head = block->next;
+			::operator delete(block);
+		}
+	}
+}
+
+void* FramePool::allocate(size_t bytes)
+{
+	const auto sizeClass = (bytes + granularity - 1) / granularity;
+	if (sizeClass == 0 || sizeClass > classes || exited)
+		return ::operator new(bytes);
+
+	auto& freeList = freeLists.heads[sizeClass - 1];
+	if (auto block = freeList) {
+		freeList = block->next;
+		return block;
+	}
+	return ::operator new(sizeClass * granularity);
+}
+
+void FramePool::deallocate(void* memory, size_t bytes) noexcept
+{
+	const auto sizeClass = (bytes + granularity - 1) / granularity;
+	if (sizeClass == 0 || sizeClass > classes || exited)
+		return ::operator delete(memory);
+
+	auto& freeList = freeLists.heads[sizeClass - 1];
+	freeList = new(memory) Block{freeList};
+}
+
+
+// Environment
+
+std::atomic<uint64_t> Environment::versions{1};
+thread_local const Environment* Environment::current = nullptr;
 
 Environment::Environment(EnvironmentP parent)
 : parent{parent}
+, stamp{++versions}
+{
+}
+
+Environment::Environment(EnvironmentP parent, size_t slots)
+: parent{std::move(parent)}
+{
+	allocate(slots);
+}
+
+Environment::~Environment()
+{
+	release();
+}
+
+EnvironmentP Environment::frame(EnvironmentP parent, size_t slots)
 {
+	return std::allocate_shared<Environment>(FrameAllocator<Environment>{}, std::move(parent), slots);
 }
 
 static const Value nil{NullValue{}};
 
 const Value& Environment::get(std::string_view name) const
 {
-	for (auto ptr = shared_from_this(); ptr; ptr = ptr->parent) {
+	for (auto ptr = this; ptr; ptr = ptr->parent.get()) {
 		if (const auto iter = ptr->values.find(name); iter != ptr->values.end())
 			return iter->second;
+		for (auto layer = ptr->layers.get(); layer; layer = layer->next.get()) {
+			if (layer->snapshot) {
+				if (const auto* value = layer->snapshot->find(name))
+					return *value;
+			}
+			else if (const auto iter = layer->values.find(name); iter != layer->values.end()) {
+				return iter->second;
+			}
+		}
 	}
 	return nil;
 }
@@ -24,4 +100,118 @@ void Environment::set(std::string_view name, Value&& value)
 		iter->second = std::move(value);
 	else
 		values.emplace(std::string{name}, std::move(value));
-}
\ No newline at end of file
+
+	stamp.store(++versions, std::memory_order_release);
+}
+
+EnvironmentP Environment::fork()
+{
+	// this environment's own bindings go in a layer the two share
+	freeze();
+
+	auto forked = std::make_shared<Environment>(parent);
+	forked->layers = layers;
+	forked->origins.reserve(origins.size() + 1);
+	forked->origins.push_back(this);
+	forked->origins.insert(forked->origins.end(), origins.begin(), origins.end());
+	return forked;
+}
+
+Environment::Running::Running(const Environment* global) noexcept
+: previous{std::exchange(current, global)}
+{
+}
+
+Environment::Running::~Running()
+{
+	current = previous;
+}
+
+void Environment::restore(std::shared_ptr<Snapshot> snapshot)
+{
+	freeze();
+	snapshot->restore(shared_from_this());
+
+	const size_t depth = layers ? layers->depth + 1 : 1;
+	layers = std::make_shared<const Layer>(Layer{{}, std::move(layers), depth, std::move(snapshot)});
+	stamp.store(++versions, std::memory_order_release);
+}
+
+string_map<Value> Environment::bindings() const
+{
+	// the newest binding of a name wins, as insert() leaves an existing one be
+	auto bindings = values;
+	for (auto layer = layers.get(); layer; layer = layer->next.get()) {
+		if (layer->snapshot)
+			layer->snapshot->decode(bindings);
+		else
+			bindings.insert(layer->values.begin(), layer->values.end());
+	}
+	return bindings;
+}
+
+void Environment::freeze()
+{
+	if (values.empty())
+		return;
+
+	// the nodes of values move into the layer, so the GlobalCaches' bindings stay put
+	const size_t depth = layers ? layers->depth + 1 : 1;
+	if (depth <= maxLayers) {
+		layers = std::make_shared<const Layer>(Layer{std::move(values), std::move(layers), depth});
+	}
+	else {
+		layers = std::make_shared<const Layer>(Layer{bindings(), nullptr, 1});
+		stamp.store(++versions, std::memory_order_release);
+	}
+	values.clear();
+}
+
+void Environment::reset(EnvironmentP parent, size_t slots)
+{
+	this->parent = std::move(parent);
+	if (slots == slotCount) {
+		std::fill_n(this->slots, slotCount, Value{});
+	}
+	else {
+		release();
+		allocate(slots);
+	}
+}
+
+const Environment& Environment::outer(size_t depth) const noexcept
+{
+	auto ptr = this;
+	while (depth-- > 0)
+		ptr = ptr->parent.get();
+	return *ptr;
+}
+
+void Environment::clear() noexcept
+{
+	parent.reset();
+	release();
+	values.clear();
+	layers.reset();
+}
+
+void Environment::allocate(size_t count)
+{
+	if (count == 0)
+		return;
+
+	slots = static_cast<Value*>(FramePool::allocate(count * sizeof(Value)));
+	std::uninitialized_default_construct_n(slots, count);
+	slotCount = count;
+}
+
+void Environment::release() noexcept
+{
+	if (!slots)
+		return;
+
+	std::destroy_n(slots, slotCount);
+	FramePool::deallocate(slots, slotCount * sizeof(Value));
+	slots = nullptr;
+	slotCount = 0;
+}
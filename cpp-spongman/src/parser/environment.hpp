@@ -1,7 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
+#include <vector>
 #include <string_view>
+#include <atomic>
+#include <cstdint>
+#include <utility>
 
 #include "utils.hpp"
 
@@ -10,14 +15,197 @@
 struct Environment;
 using EnvironmentP = std::shared_ptr<Environment>;
 
+class Snapshot;
+
+// recycles the memory of call frames through free-lists by size class, so a call doesn't go to malloc.
+// the free-lists are per thread, and given back to the system when the thread exits. a block may be
+// freed on another thread than it was allocated on, and goes to that thread's lists.
+struct FramePool
+{
+	static void* allocate(size_t bytes);
+	static void deallocate(void* memory, size_t bytes) noexcept;
+
+private:
+	struct Block
+	{
+		Block* next;
+	};
+
+	static constexpr size_t granularity = 16;
+	static constexpr size_t classes = 32;	// blocks of up to 512 bytes are pooled
+
+	// a thread's free-lists, which frees their blocks as the thread exits
+	struct FreeLists
+	{
+		~FreeLists();
+
+		Block* heads[classes]{};
+	};
+
+	static thread_local FreeLists freeLists;
+	static thread_local bool exited;	// frames released after the lists were freed go straight to the system
+};
+
+template<typename T>
+struct FrameAllocator
+{
+	using value_type = T;
+
+	FrameAllocator() noexcept = default;
+
+	template<typename U>
+	FrameAllocator(const FrameAllocator<U>&) noexcept {}
+
+	T* allocate(size_t count) { return static_cast<T*>(FramePool::allocate(count * sizeof(T))); }
+	void deallocate(T* memory, size_t count) noexcept { FramePool::deallocate(memory, count * sizeof(T)); }
+
+	template<typename U>
+	bool operator==(const FrameAllocator<U>&) const noexcept { return true; }
+};
+
+// inline cache of the binding of a global, valid while the version of the global environment it was found in is current.
+// threads running over different environments, a fork and its parent, may fill it at once: one claims it while it
+// writes, and the others don't cache. a get() that read a binding another claimed it for after its version was read
+// sees the claim when it reads the version again
+struct GlobalCache
+{
+	// the cached binding, or nullptr if the cache was filled at another version
+	const Value* get(uint64_t version) const noexcept
+	{
+		if (filled.load(std::memory_order_acquire) != version)
+			return nullptr;
+		const auto* value = binding.load(std::memory_order_acquire);
+		return filled.load(std::memory_order_relaxed) == version ? value : nullptr;
+	}
+
+	void set(uint64_t version, const Value& value) noexcept
+	{
+		auto expected = filled.load(std::memory_order_relaxed);
+		if (expected == claimed || !filled.compare_exchange_strong(expected, claimed, std::memory_order_acquire))
+			return;
+		binding.store(&value, std::memory_order_release);
+		filled.store(version, std::memory_order_release);
+	}
+
+private:
+	static constexpr uint64_t claimed = UINT64_MAX;	// never a version
+
+	std::atomic<uint64_t> filled{0};
+	std::atomic<const Value*> binding{nullptr};
+};
+
+// the global environment holds named values, function frames hold a flat array of slots
+// assigned by the resolver (see Scope). a program run over a Prelude has a global environment
+// of its own, whose parent is the prelude's.
+// a global environment can be forked: the fork shares its bindings in a chain of frozen layers,
+// and (re)defines names in values of its own, which shadow them. a Snapshot is restored as a layer too.
+// a program running over a fork looks the globals of the functions it inherited up in the fork (see resolve),
+// so it never reads the environments it was forked from, which can go on defining names on other threads.
 struct Environment : public std::enable_shared_from_this<Environment>
 {
 	Environment(EnvironmentP parent = {});
+	Environment(EnvironmentP parent, size_t slots);
+	Environment(const Environment&) = delete;
+	Environment& operator=(const Environment&) = delete;
+	~Environment();
+
+	// a function frame, allocated from the FramePool
+	static EnvironmentP frame(EnvironmentP parent, size_t slots);
 
 	const Value& get(std::string_view name) const;
 	void set(std::string_view name, Value&& value);
 
+	// a copy of this global environment, in constant time. neither sees what the other defines from here on,
+	// and the functions this one has look their globals up in the fork while a program runs over it.
+	// this environment must outlive the fork
+	EnvironmentP fork();
+
+	// the global environment a program runs over on the calling thread, while it's alive
+	struct Running
+	{
+		explicit Running(const Environment* global) noexcept;
+		~Running();
+		Running(const Running&) = delete;
+		Running& operator=(const Running&) = delete;
+
+		const Environment* previous;
+	};
+
+	static const Environment* running() noexcept { return current; }
+
+	// the environment to look up a global in, found as the global environment of a function: the one the
+	// running program's is a fork of goes to the fork
+	static const Environment& resolve(const Environment& global) noexcept;
+
+	// bind the names of a snapshot's image to its values, over any bindings there are.
+	// they are decoded as they are looked up
+	void restore(std::shared_ptr<Snapshot> snapshot);
+
+	// the bindings of a global environment, but not of its parent, by name
+	string_map<Value> bindings() const;
+
+	// identifies the bindings of a global environment for the GlobalCaches: it is unique to the environment,
+	// and changes whenever set() (re)defines one
+	uint64_t version() const noexcept { return stamp.load(std::memory_order_acquire); }
+
+	// reinitialize an unshared frame for another call
+	void reset(EnvironmentP parent, size_t slots);
+
+	Value& operator[](size_t slot) noexcept { return slots[slot]; }
+	const Value& operator[](size_t slot) const noexcept { return slots[slot]; }
+
+	// the environment depth levels up the parent chain
+	const Environment& outer(size_t depth) const noexcept;
+	Environment& outer(size_t depth) noexcept { return const_cast<Environment&>(std::as_const(*this).outer(depth)); }
+
+	// a sealed environment may be in use on other threads, and isn't collected (see Collector)
+	void seal(bool sealed = true) noexcept { this->sealed.store(sealed, std::memory_order_release); }
+
 private:
+	friend struct SnapshotWriter;
+	friend class Collector;
+
+	// bindings frozen by a fork, and shared with it, or restored from a snapshot
+	struct Layer
+	{
+		string_map<Value> values;
+		std::shared_ptr<const Layer> next;	// older bindings, which these shadow
+		size_t depth;
+		std::shared_ptr<Snapshot> snapshot;	// the bindings, instead of values
+	};
+
+	static constexpr size_t maxLayers = 8;	// a fork that would chain more flattens them into one
+
+	// move the environment's own bindings into a new layer
+	void freeze();
+
+	void allocate(size_t count);
+	void release() noexcept;
+
+	// drop every reference the environment holds, which breaks the cycles of a garbage one
+	void clear() noexcept;
+
+	static std::atomic<uint64_t> versions;
+	static thread_local const Environment* current;	// see Running
+
 	EnvironmentP parent{};
+	Value* slots = nullptr;
+	size_t slotCount = 0;
 	string_map<Value> values;
-};
\ No newline at end of file
+	std::shared_ptr<const Layer> layers;
+	std::vector<const Environment*> origins;	// of a fork: the environments it was forked from, the latest first
+	std::atomic<uint64_t> stamp{0};
+	std::atomic<bool> tracked{false};	// by a Collector
+	std::atomic<bool> sealed{false};
+	bool old = false;	// survived a collection
+};
+
+inline const Environment& Environment::resolve(const Environment& global) noexcept
+{
+	const auto* running = current;
+	if (!running || running == &global)
+		return global;
+
+	const auto& origins = running->origins;
+	return std::find(origins.begin(), origins.end(), &global) != origins.end() ? *running : global;
+}
@@ -1,11 +1,250 @@
+#include <algorithm>
 #include <charconv>
 #include <sstream>
 #include <iostream>
+#include <mutex>
+#include <utility>
 
 #include "lexer.hh"
 #include "expression.hpp"
 #include "statement.hpp"
 #include "builtins.hpp"
+#include "optimizer.hpp"
+#include "collector.hpp"
+#include "stack.hpp"
+#include "vm.hpp"
+
+
+namespace
+{
+	// finds where a statement ends, by the grammar of the parser, without building it.
+	// it follows the parser token for token, so a body it skips is one the parser will take, and the
+	// syntax errors of a deferred body are found where the function is, not when it's first called
+	class Preparser
+	{
+	public:
+		explicit Preparser(Lexer& lexer)
+		: lexer{lexer} {}
+
+		// BlockStatement::parse
+		void block()
+		{
+			if (!get(TokenType::Lsquirly)) {
+				statement();
+				return;
+			}
+			while (get(TokenType::Semicolon), !get(TokenType::Rsquirly))
+				statement();
+		}
+
+		size_t tokens = 0;	// skipped so far
+		std::vector<std::string_view> identifiers;	// skipped so far, but for the names of lets
+
+		// each identifier skipped once
+		std::vector<std::string> names()
+		{
+			std::sort(identifiers.begin(), identifiers.end());
+			identifiers.erase(std::unique(identifiers.begin(), identifiers.end()), identifiers.end());
+			return {identifiers.begin(), identifiers.end()};
+		}
+
+	private:
+		void next()
+		{
+			if (lexer.type() == TokenType::Identifier)
+				identifiers.push_back(lexer.literal());
+			lexer.next();
+			tokens++;
+		}
+
+		bool get(TokenType type)
+		{
+			if (!lexer.peekIs(type))
+				return false;
+			next();
+			return true;
+		}
+
+		// Lexer::fetch
+		void fetch(TokenType type)
+		{
+			if (!lexer.peekIs(type))
+				lexer.fetch(type);
+			next();
+		}
+
+		// Statement::parseStatement
+		void statement()
+		{
+			switch (lexer.type()) {
+				case TokenType::Let:
+					next();
+					lexer.fetch(TokenType::Identifier);
+					lexer.fetch(TokenType::Assign);
+					tokens += 2;
+					break;
+				case TokenType::Return:
+					next();
+					break;
+			}
+			expression();
+		}
+
+		// Expression::parse, and IfStatement::parse
+		void expression()
+		{
+			if (!get(TokenType::If)) {
+				binary();
+				return;
+			}
+
+			fetch(TokenType::Lparen);
+			expression();
+			fetch(TokenType::Rparen);
+			block();
+			if (get(TokenType::Else))
+				block();
+		}
+
+		// Expression::parseOr down to parseProduct: precedence doesn't change what's accepted
+		void binary()
+		{
+			for (index(); binaryOperator(lexer.type()); index())
+				next();
+		}
+
+		// parseArrayIndex
+		void index()
+		{
+			prefix();
+			while (get(TokenType::Lbracket)) {
+				expression();
+				fetch(TokenType::Rbracket);
+			}
+		}
+
+		// parsePrefix, with ArrayLiteralExpression::parse
+		void prefix()
+		{
+			switch (lexer.type()) {
+				case TokenType::Lbracket:
+					next();
+					while (get(TokenType::Comma), !get(TokenType::Rbracket))
+						expression();
+					return;
+				case TokenType::Minus:
+				case TokenType::Bang:
+				case TokenType::Tilde:
+					next();
+					prefix();
+					return;
+				case TokenType::Lsquirly:
+					next();
+					if (get(TokenType::Rsquirly))
+						return;
+
+					statement();
+					if (get(TokenType::Colon)) {
+						expression();
+						while (get(TokenType::Comma), !get(TokenType::Rsquirly)) {
+							expression();
+							fetch(TokenType::Colon);
+							expression();
+						}
+					}
+					else {
+						while (get(TokenType::Semicolon), !get(TokenType::Rsquirly))
+							statement();
+					}
+					return;
+			}
+			call();
+		}
+
+		// parseCall, which takes one argument list, and parseGrouped, with FunctionExpression::parse
+		void call()
+		{
+			switch (lexer.type()) {
+				case TokenType::Function:
+					next();
+					fetch(TokenType::Lparen);
+					while (get(TokenType::Comma), !get(TokenType::Rparen))
+						fetch(TokenType::Identifier);
+					block();
+					break;
+				case TokenType::Lparen:
+					next();
+					expression();
+					fetch(TokenType::Rparen);
+					break;
+				default:
+					value();
+					break;
+			}
+			if (get(TokenType::Lparen)) {
+				while (get(TokenType::Comma), !get(TokenType::Rparen))
+					expression();
+			}
+		}
+
+		// parseValue
+		void value()
+		{
+			switch (lexer.type()) {
+				case TokenType::Identifier:
+				case TokenType::Integer:
+				case TokenType::String:
+				case TokenType::True:
+				case TokenType::False:
+					next();
+					return;
+				case TokenType::Dollar:
+					next();
+					if (!binaryOperator(lexer.type()))
+						lexer.error("unexpected infix operator: " + std::to_string(lexer.peek()));
+					next();
+					return;
+			}
+			lexer.error("unexpected value token: '" + std::to_string(lexer.type()) + "'");
+		}
+
+		static bool binaryOperator(TokenType type)
+		{
+			switch (type) {
+				case TokenType::Asterisk:
+				case TokenType::Slash:
+				case TokenType::Percent:
+				case TokenType::Plus:
+				case TokenType::Minus:
+				case TokenType::BitAnd:
+				case TokenType::BitOr:
+				case TokenType::BitEor:
+				case TokenType::Lt:
+				case TokenType::Gt:
+				case TokenType::Le:
+				case TokenType::Ge:
+				case TokenType::Eq:
+				case TokenType::Not_eq:
+				case TokenType::And:
+				case TokenType::Or:
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		Lexer& lexer;
+	};
+
+	// a body, to the end of lexer
+	StatementP parseBody(Lexer& lexer)
+	{
+		auto body = BlockStatement::parse(lexer);
+		if (!lexer.eof())
+			lexer.error("unexpected token after function body: '" + std::to_string(lexer.type()) + "'");
+		return body;
+	}
+}
 
 // Expression
 
@@ -321,33 +560,31 @@ std::ostream& operator<<(std::ostream& os, const Expression& expression)
 
 // BinaryExpresison
 
-Value BinaryExpression::eval(EnvironmentP env) const
-{
-	return fn.call(left->eval(env), right->eval(env));
-}
-
 void BinaryExpression::print(std::ostream& os) const
 {
-	os << *left << fn.name << *right;
+	os << "(" << *left << " " << fn.name << " " << *right << ")";
 }
 
 
 // UnaryExpression
 
-Value UnaryExpression::eval(EnvironmentP env) const
+Value UnaryExpression::apply(TokenType op, const Value& evaluatedValue)
 {
-	auto evaluatedValue = value->eval(env);
 	switch(op) {
 		case TokenType::Minus:
-			return Value{-evaluatedValue.as<Integer>()};
+			if (!evaluatedValue.is<Integer>())
+				break;
+			return Value{-evaluatedValue.get<Integer>()};
 		case TokenType::Bang:
 			if (!evaluatedValue.is<bool>())
 				return Value{false};
-			return Value{!evaluatedValue.as<bool>()};
+			return Value{!evaluatedValue.get<bool>()};
 		case TokenType::Tilde:
-			return Value{~evaluatedValue.as<Integer>()};
+			if (!evaluatedValue.is<Integer>())
+				break;
+			return Value{~evaluatedValue.get<Integer>()};
 	}
-	throw std::runtime_error("invalid unary operation: " + std::to_string(op));
+	return Value::error("invalid unary operation: " + std::to_string(op) + std::to_string(evaluatedValue));
 }
 
 void UnaryExpression::print(std::ostream& os) const
@@ -358,10 +595,72 @@ void UnaryExpression::print(std::ostream& os) const
 
 // CallExpression
 
-Value CallExpression::eval(EnvironmentP env) const
+Value CallExpression::eval(Environment& env) const
+{
+	const auto callee = function->eval(env);
+	if (callee.abrupt())
+		return callee;
+	if (!callee.is<BoundFunction>())
+		return notCallable(callee);
+
+	const auto& [fn, closureEnv] = callee.get<BoundFunction>();
+	switch (kind(fn)) {
+		case Interpreted:
+			return static_cast<const FunctionExpression*>(fn)->FunctionExpression::call(closureEnv, env, arguments);
+		case Builtin:
+			return static_cast<const BuiltinFunctionExpression*>(fn)->BuiltinFunctionExpression::call(closureEnv, env, arguments);
+		default:
+			return fn->call(closureEnv, env, arguments);
+	}
+}
+
+Value CallExpression::evalTail(Environment& env, TailCall& tail) const
+{
+	const auto callee = function->eval(env);
+	if (callee.abrupt())
+		return callee;
+	if (!callee.is<BoundFunction>())
+		return notCallable(callee);
+
+	const auto& [fn, closureEnv] = callee.get<BoundFunction>();
+	switch (kind(fn)) {
+		case Interpreted:
+		{
+			const auto* interpreted = static_cast<const FunctionExpression*>(fn);
+			if (auto result = interpreted->bind(closureEnv, env, arguments, tail.locals); result.abrupt())
+				return result;
+			tail.function = interpreted;
+			return {};
+		}
+		case Builtin:
+			return static_cast<const BuiltinFunctionExpression*>(fn)->BuiltinFunctionExpression::call(closureEnv, env, arguments);
+		default:
+			return fn->call(closureEnv, env, arguments);
+	}
+}
+
+// how to call fn, through the inline cache
+CallExpression::Callee CallExpression::kind(const AbstractFunctionExpression* fn) const
 {
-	auto [fn, closureEnv] = function->eval(env).as<BoundFunction>();
-	return fn->call(closureEnv, env, arguments);
+	constexpr uintptr_t mask = alignof(AbstractFunctionExpression) - 1;
+	static_assert(mask >= Native);
+
+	const auto address = reinterpret_cast<uintptr_t>(fn);
+	if (const auto cached = cachedCallee.load(std::memory_order_relaxed); (cached & ~mask) == address)
+		return static_cast<Callee>(cached & mask);
+
+	// an interpreted function is parsed before it's cached, and so before it's bound
+	const auto* interpreted = fn->interpreted();
+	if (interpreted)
+		interpreted->materialize();
+	const auto callee = interpreted ? Interpreted : fn->builtin() ? Builtin : Native;
+	cachedCallee.store(address | callee, std::memory_order_relaxed);
+	return callee;
+}
+
+Value CallExpression::notCallable(const Value& callee)
+{
+	return Value::error("Error trying to call " + std::to_string(callee) + ": not a function");
 }
 
 void CallExpression::print(std::ostream& os) const
@@ -377,6 +676,30 @@ void CallExpression::print(std::ostream& os) const
 	os << ")";
 }
 
+
+// InlinedCallExpression
+
+Value InlinedCallExpression::eval(Environment& env) const
+{
+	return inlined(env) ? body->eval(env) : call->eval(env);
+}
+
+Value InlinedCallExpression::evalTail(Environment& env, TailCall& tail) const
+{
+	return inlined(env) ? body->evalTail(env, tail) : call->evalTail(env, tail);
+}
+
+bool InlinedCallExpression::inlined(const Environment& env) const
+{
+	const auto& value = callee->binding(env);
+	return value.is<BoundFunction>() && value.get<BoundFunction>().first == &function;
+}
+
+void InlinedCallExpression::print(std::ostream& os) const
+{
+	os << *body;
+}
+
 // AbstractFunctionExpression
 
 AbstractFunctionExpression::AbstractFunctionExpression(std::vector<std::string>&& parameters)
@@ -384,10 +707,13 @@ AbstractFunctionExpression::AbstractFunctionExpression(std::vector<std::string>&
 {	
 }
 
-Value AbstractFunctionExpression::eval(EnvironmentP env) const
+Value AbstractFunctionExpression::eval(Environment& env) const
 {
-	//auto f = shared_from_this();
-	return Value{std::make_pair(this, env)};
+	// the one place evaluation takes a reference to an environment: the closure keeps it alive
+	auto closure = env.shared_from_this();
+	Collector::track(closure);
+	Collector::poll();
+	return Value{BoundFunction{this, std::move(closure)}};
 }
 
 void AbstractFunctionExpression::print(std::ostream& os) const
@@ -406,6 +732,9 @@ void AbstractFunctionExpression::print(std::ostream& os) const
 
 // FunctionExpression
 
+std::atomic<size_t> FunctionExpression::deferrals{0};
+std::atomic<size_t> FunctionExpression::materializations{0};
+
 FunctionExpression::FunctionExpression(
 	std::vector<std::string>&& parameters,
 	StatementP&& body
@@ -415,6 +744,19 @@ FunctionExpression::FunctionExpression(
 {
 }
 
+FunctionExpression::FunctionExpression(
+	std::vector<std::string>&& parameters,
+	std::unique_ptr<Source>&& source
+)
+: AbstractFunctionExpression{std::move(parameters)}
+, source{std::move(source)}
+, parsed{false}
+{
+	deferrals++;
+}
+
+FunctionExpression::~FunctionExpression() = default;
+
 ExpressionP FunctionExpression::parse(Lexer& lexer)
 {
 	lexer.fetch(TokenType::Function);
@@ -426,69 +768,222 @@ ExpressionP FunctionExpression::parse(Lexer& lexer)
 		parameters.push_back(std::string{token.literal});
 	}
 
-	return std::make_unique<FunctionExpression>(
-		std::move(parameters),
-		BlockStatement::parse(lexer)
-	);
+	const auto start = lexer.position();
+	const auto line = lexer.line(start);
+	Preparser preparser{lexer};
+	preparser.block();
+	const auto text = lexer.since(start);
+
+	// a short body costs little to parse, and may be inlined
+	if (preparser.tokens <= eagerTokens) {
+		Lexer bodyLexer{text, line};
+		return std::make_unique<FunctionExpression>(std::move(parameters), parseBody(bodyLexer));
+	}
+	return ExpressionP{new FunctionExpression{std::move(parameters), std::make_unique<Source>(Source{std::string{text}, line, preparser.names()})}};
+}
+
+void FunctionExpression::parseDeferred()
+{
+	static std::mutex parsing;
+	std::lock_guard lock{parsing};
+	if (!deferred())
+		return;
+
+	Lexer lexer{source->text, source->line};
+	body = parseBody(lexer);
+	resolveDeferred();
+	if (auto& optimizer = source->optimizer) {
+		optimizer->depth = globals();
+		optimizer->optimize(body);
+	}
+
+	source.reset();
+	materializations++;
+	parsed.store(true, std::memory_order_release);
+}
+
+// a flat closure is bound to an environment of copies of what it captures from env, or to the global one
+Value FunctionExpression::eval(Environment& env) const
+{
+	if (!flat)
+		return AbstractFunctionExpression::eval(env);
+
+	auto& global = env.outer(enclosing);
+	if (captures.empty())
+		return AbstractFunctionExpression::eval(global);
+
+	auto closure = Environment::frame(global.shared_from_this(), captures.size());
+	auto self = Scope::global;
+	for (size_t i = 0; i < captures.size(); i++) {
+		const auto& [depth, slot] = captures[i];
+		if (slot == Scope::global)
+			self = i;
+		else
+			(*closure)[i] = env.outer(depth)[slot];
+	}
+
+	Value function{BoundFunction{this, closure}};
+	// the only cycle a flat closure can be in
+	if (self != Scope::global) {
+		(*closure)[self] = function;
+		Collector::track(closure);
+	}
+	Collector::poll();
+	return function;
 }
 
 Value FunctionExpression::call(
-	EnvironmentP closureEnv,
-	EnvironmentP callerEnv,
+	const EnvironmentP& closureEnv,
+	Environment& callerEnv,
 	const std::vector<ExpressionP>& arguments
 ) const
 {
-	// TODO: copy-on-write
-	auto locals = std::make_shared<Environment>(closureEnv);
+	EnvironmentP locals;
+	if (auto result = bind(closureEnv, callerEnv, arguments, locals); result.abrupt())
+		return result;
+	return run(std::move(locals));
+}
 
-	auto argumentIter = arguments.begin();
-	for (const auto& parameterName : parameters) {
-		if (argumentIter != arguments.end()) {
-			const auto& argument= *(argumentIter++);
-			locals->set(parameterName, argument->eval(callerEnv));
-		}
-		else {
-			locals->set(parameterName, Value{});
-		}
+Value FunctionExpression::bind(
+	const EnvironmentP& closureEnv,
+	Environment& callerEnv,
+	const std::vector<ExpressionP>& arguments,
+	EnvironmentP& locals
+) const
+{
+	locals = Environment::frame(closureEnv, slots);
+
+	const auto count = std::min(parameters.size(), arguments.size());
+	for (size_t i = 0; i < count; i++) {
+		auto argument = arguments[i]->eval(callerEnv);
+		if (argument.abrupt())
+			return argument;
+		(*locals)[i] = std::move(argument);
 	}
+	return {};
+}
 
-	try {
-		return body->eval(locals);
-	}
-	catch (Value& value) {
-		return std::move(value);
+Value FunctionExpression::apply(const EnvironmentP& closureEnv, Arguments arguments) const
+{
+	materialize();
+	auto locals = Environment::frame(closureEnv, slots);
+
+	const auto count = std::min(parameters.size(), arguments.size());
+	for (size_t i = 0; i < count; i++)
+		(*locals)[i] = arguments[i];
+
+	return run(std::move(locals));
+}
+
+// run the body, then each call it makes in tail position, in the one C++ frame.
+// the frame of a tail call replaces the caller's, so deep tail recursion runs in constant space.
+Value FunctionExpression::run(EnvironmentP locals) const
+{
+	// past half of the native stack, the call goes on in a VM, whose frames are on the heap
+	if (Stack::deep())
+		return VM{}.run(*this, std::move(locals));
+
+	TailCall tail;
+	for (auto function = this; ; ) {
+		auto result = function->body->evalTail(*locals, tail);
+		if (result.completion() == Completion::Return)
+			result.setCompletion(Completion::Normal);
+
+		if (!tail.function)
+			return result;
+
+		function = std::exchange(tail.function, nullptr);
+		locals = std::move(tail.locals);
 	}
 }
 
 void FunctionExpression::print(std::ostream& os) const
 {
 	AbstractFunctionExpression::print(os);
-	os << *body;
+	os << definition();
 }
 
 // BuiltinFunctionExpression
 
 Value BuiltinFunctionExpression::call(
-	EnvironmentP closureEnv,
-	EnvironmentP callerEnv,
+	const EnvironmentP& closureEnv,
+	Environment& callerEnv,
 	const std::vector<ExpressionP>& arguments
 ) const
 {
-	Array argumentValues;
-	std::transform(
-		arguments.cbegin(), arguments.cend(),
-		std::back_inserter(argumentValues), [&callerEnv](const ExpressionP& element) { return element->eval(callerEnv); }
-	);
-	return body(std::move(argumentValues));
+	const auto count = arguments.size();
+	if (arity == 1 && count == 1) {
+		const auto value = arguments[0]->eval(callerEnv);
+		if (value.abrupt())
+			return value;
+		return unary(value);
+	}
+	if (arity == 2 && count == 2) {
+		const auto left = arguments[0]->eval(callerEnv);
+		if (left.abrupt())
+			return left;
+		const auto right = arguments[1]->eval(callerEnv);
+		if (right.abrupt())
+			return right;
+		return binary(left, right);
+	}
+
+	const auto evaluate = [&](std::span<Value> values) -> const Value* {
+		for (size_t i = 0; i < count; i++) {
+			values[i] = arguments[i]->eval(callerEnv);
+			if (values[i].abrupt())
+				return &values[i];
+		}
+		return nullptr;
+	};
+
+	if (count <= buffered) {
+		Value values[buffered];
+		if (const auto* abrupt = evaluate(values))
+			return *abrupt;
+		return apply(closureEnv, Arguments{values, count});
+	}
+
+	std::vector<Value> values(count);
+	if (const auto* abrupt = evaluate(values))
+		return *abrupt;
+	return apply(closureEnv, values);
+}
+
+Value BuiltinFunctionExpression::apply(const EnvironmentP& closureEnv, Arguments arguments) const
+{
+	if (arity != 0 && arguments.size() != arity)
+		return Value::error("wrong number of arguments to " + name + "(): " + std::to_string(arguments.size()));
+
+	switch (arity) {
+		case 1:  return unary(arguments[0]);
+		case 2:  return binary(arguments[0], arguments[1]);
+		default: return variadic(arguments);
+	}
 }
 
 // IdentifierExpression
 
-Value IdentifierExpression::eval(EnvironmentP env) const
+Value IdentifierExpression::eval(Environment& env) const
 {
-	auto value = env->get(identifier);
+	return binding(env);
+}
+
+const Value& IdentifierExpression::binding(const Environment& env) const
+{
+	if (slot != Scope::global)
+		return env.outer(depth)[slot];
+
+	const auto& global = Environment::resolve(env.outer(depth));
+	const auto version = global.version();
+	if (const auto* binding = cache.get(version))
+		return *binding;
+
+	const auto& value = global.get(identifier);
 	if (value.is<NullValue>())
 		std::cout << "WARNING: identifier '" + identifier + "' not found\n";
+	else
+		cache.set(version, value);
 	return value;
 }
 
@@ -500,7 +995,7 @@ void IdentifierExpression::print(std::ostream& os) const
 
 //IntegerLiteralExpression
 
-Value IntegerLiteralExpression::eval(EnvironmentP env) const
+Value IntegerLiteralExpression::eval(Environment& env) const
 {
 	return Value{value};
 }
@@ -513,27 +1008,27 @@ void IntegerLiteralExpression::print(std::ostream& os) const
 
 // BooleanLiteralExpression
 
-Value BooleanLiteralExpression::eval(EnvironmentP env) const
+Value BooleanLiteralExpression::eval(Environment& env) const
 {
 	return Value{value};
 }
 
 void BooleanLiteralExpression::print(std::ostream& os) const
 {
-	os << value;
+	os << (value ? "true" : "false");
 }
 
 
 // StringLiteralExpression
 
-Value StringLiteralExpression::eval(EnvironmentP env) const
+Value StringLiteralExpression::eval(Environment& env) const
 {
 	return Value{value};
 }
 
 void StringLiteralExpression::print(std::ostream& os) const
 {
-	os << value;
+	os << '"' << value << '"';
 }
 
 
@@ -550,14 +1045,17 @@ ExpressionP ArrayLiteralExpression::parse(Lexer& lexer)
 	return std::make_unique<ArrayLiteralExpression>(std::move(elements));
 }
 
-Value ArrayLiteralExpression::eval(EnvironmentP env) const
+Value ArrayLiteralExpression::eval(Environment& env) const
 {
-	Array value;
-	std::transform(
-		elements.cbegin(), elements.cend(),
-		std::back_inserter(value), [&env](const ExpressionP& element) { return element->eval(env); }
-	);
-	return Value{value};
+	std::vector<Value> values;
+	values.reserve(elements.size());
+	for (const auto& element : elements) {
+		auto value = element->eval(env);
+		if (value.abrupt())
+			return value;
+		values.push_back(std::move(value));
+	}
+	return Value{Array{std::move(values)}};
 }
 
 void ArrayLiteralExpression::print(std::ostream& os) const
@@ -576,12 +1074,9 @@ void ArrayLiteralExpression::print(std::ostream& os) const
 
 // IndexExpression
 
-Value IndexExpression::eval(EnvironmentP env) const
+Value IndexExpression::lookup(const Value& evluatedArray, const Value& evaluatedIndex)
 {
-	const auto& evluatedArray = array->eval(env);
-	const auto& evaluatedIndex = index->eval(env);
-
-	return std::visit(overloaded{
+	return visit(overloaded{
 		[](const Array& value, const Integer indexValue) -> Value {
 			if (indexValue < 0 || indexValue >= static_cast<Integer>(value.size()))
 				return {};
@@ -593,31 +1088,35 @@ Value IndexExpression::eval(EnvironmentP env) const
 			return Value{value.substr(indexValue, 1)};	// TODO: 'char' type?
 		},
 		[&evaluatedIndex](const Hash& value, const auto& indexValue) -> Value {
-			if (const auto iter = value.find(evaluatedIndex); iter != value.end())
-				return iter->second;
+			if (const auto* found = value.find(evaluatedIndex))
+				return *found;
 			return {};
 		},
-		[](const auto& value, auto& indexValue) -> Value {
-			throw std::runtime_error("Error: can't index into ");// + std::to_string(value));
+		[](const auto& value, auto& indexValue) {
+			return Value::error("Error: can't index into " + std::to_string(value) + " with " + std::to_string(indexValue));
 		}
-	}, evluatedArray.data, evaluatedIndex.data);
+	}, evluatedArray, evaluatedIndex);
 }
 
 void IndexExpression::print(std::ostream& os) const
 {
-	os << array << "[" << index << "]";
+	os << *array << "[" << *index << "]";
 }
 
 
 // HashLiteralExpression
 
-Value HashLiteralExpression::eval(EnvironmentP env) const
+Value HashLiteralExpression::eval(Environment& env) const
 {
 	Hash hash{};
 
 	for (const auto& [key, value] : elements) {
 		auto keyValue = key->eval(env);
+		if (keyValue.abrupt())
+			return keyValue;
 		auto valueValue = value->eval(env);
+		if (valueValue.abrupt())
+			return valueValue;
 		hash.emplace(std::move(keyValue), std::move(valueValue));
 	}
 
@@ -632,7 +1131,7 @@ void HashLiteralExpression::print(std::ostream& os) const
 		if (!first)
 			os << ",";
 		first = false;
-		os << key << "," << value;
+		os << *key << ":" << *value;
 	}
 	os << "}";
 	//os << value;
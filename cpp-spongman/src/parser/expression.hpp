@@ -4,18 +4,38 @@
 #include <vector>
 #include <iosfwd>
 #include <functional>
+#include <optional>
 
 #include "token.hpp"
 #include "value.hpp"
 #include "environment.hpp"
+#include "scope.hpp"
+#include "quickening.hpp"
 
 class Lexer;
+struct Compiler;
+struct Chunk;
+struct Optimizer;
+struct Inlining;
+struct SnapshotWriter;
+struct SnapshotReader;
+struct Purity;
 
 struct Expression;
 using ExpressionP = std::unique_ptr<Expression>;
 
 using StatementP = ExpressionP;
 
+struct FunctionExpression;
+struct BuiltinFunctionExpression;
+
+// a call in tail position, with its frame bound, left for the enclosing FunctionExpression::call loop to run in place of the caller's
+struct TailCall
+{
+	const FunctionExpression* function = nullptr;
+	EnvironmentP locals;
+};
+
 struct Expression
 {
 	virtual ~Expression() = default;
@@ -43,7 +63,28 @@ struct Expression
 	static ExpressionP parseStatement(Lexer& lexer);
 
 	virtual void print(std::ostream& str) const = 0;
-	virtual Value eval(EnvironmentP env) const = 0;
+	virtual void resolve(Scope& scope) = 0;
+	virtual Value eval(Environment& env) const = 0;
+	virtual void compile(Compiler& compiler) const = 0;
+
+	// optimize the children in place, then return a replacement for this node, or nullptr to keep it
+	virtual ExpressionP optimize(Optimizer& optimizer) { return nullptr; }
+
+	// the value of a literal
+	virtual std::optional<Value> constant() const { return {}; }
+
+	// a copy for inlining, or nullptr for nodes that can't be copied
+	virtual ExpressionP copy(Inlining& inlining) const { return nullptr; }
+
+	// evaluate in tail position of a function body: a call to an interpreted function is not made but returned in tail
+	virtual Value evalTail(Environment& env, TailCall& tail) const { return eval(env); }
+	virtual void compileTail(Compiler& compiler) const;
+
+	// append the encoding of this node and its children to a snapshot (see Snapshot)
+	virtual void save(SnapshotWriter& writer) const;
+
+	// evaluating the node can have no effect but its value, which only depends on the bindings it reads (see Purity)
+	virtual bool pure(Purity& purity) const;
 };
 
 struct UnaryExpression : public Expression
@@ -52,11 +93,36 @@ struct UnaryExpression : public Expression
 	: op{op}, value{std::move(value)} {}
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	ExpressionP optimize(Optimizer& optimizer) override;
+	ExpressionP copy(Inlining& inlining) const override;
+
+	static Value apply(TokenType op, const Value& value);
 
 private:
+	// the specialization this node has quickened to
+	enum class Quickened : uint8_t
+	{
+		Uninitialized,
+		Generic,
+		IntNegate,
+		IntComplement,
+		BoolNot,
+	};
+
+	Value profile(const Value& evaluatedValue) const;
+	Quickened specialize(uint8_t shapes) const;
+	Value deoptimize(const Value& evaluatedValue) const;
+
 	const TokenType op;
-	const ExpressionP value;
+	ExpressionP value;
+	mutable std::atomic<Quickened> quickened{Quickened::Uninitialized};
+	mutable Feedback feedback;
 };
 
 struct CallExpression : public Expression
@@ -65,11 +131,62 @@ struct CallExpression : public Expression
 	: function{std::move(function)}, arguments{std::move(arguments)} {}
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	Value evalTail(Environment& env, TailCall& tail) const override;
+	void compileTail(Compiler& compiler) const override;
+	ExpressionP optimize(Optimizer& optimizer) override;
+	ExpressionP copy(Inlining& inlining) const override;
+
+	static Value notCallable(const Value& callee);
 
 private:
-	const ExpressionP function;
-	const std::vector<ExpressionP> arguments;
+	enum Callee : uintptr_t
+	{
+		Interpreted,
+		Builtin,
+		Native,
+	};
+
+	Callee kind(const AbstractFunctionExpression* fn) const;
+
+	ExpressionP function;
+	std::vector<ExpressionP> arguments;
+
+	// monomorphic inline cache: the address of the function last called from here, tagged with its Callee kind
+	mutable std::atomic<uintptr_t> cachedCallee{0};
+};
+
+// a call to a global function, replaced by the function's body with the arguments substituted (see Optimizer).
+// the body is only evaluated while the global is still bound to that function, otherwise the call is made.
+struct InlinedCallExpression : public Expression
+{
+	InlinedCallExpression(std::unique_ptr<IdentifierExpression>&& callee, const FunctionExpression& function, ExpressionP&& body, ExpressionP&& call)
+	: callee{std::move(callee)}, function{function}, body{std::move(body)}, call{std::move(call)} {}
+
+	void print(std::ostream& str) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	Value evalTail(Environment& env, TailCall& tail) const override;
+	void compileTail(Compiler& compiler) const override;
+	ExpressionP copy(Inlining& inlining) const override;
+
+private:
+	// the body applies
+	bool inlined(const Environment& env) const;
+
+	std::unique_ptr<IdentifierExpression> callee;
+	const FunctionExpression& function;
+	ExpressionP body;
+	ExpressionP call;
 };
 
 struct AbstractFunctionExpression : public Expression, std::enable_shared_from_this<AbstractFunctionExpression>
@@ -78,13 +195,27 @@ struct AbstractFunctionExpression : public Expression, std::enable_shared_from_t
 	virtual ~AbstractFunctionExpression() = default;
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
 	virtual Value call(
-		EnvironmentP closureEnv,
-		EnvironmentP callerEnv,
+		const EnvironmentP& closureEnv,
+		Environment& callerEnv,
 		const std::vector<ExpressionP>& arguments
 	) const = 0;
 
+	// call with already-evaluated arguments
+	virtual Value apply(const EnvironmentP& closureEnv, Arguments arguments) const = 0;
+
+	// compiled body for the vm, or nullptr for natively implemented functions
+	virtual const Chunk* code() const { return nullptr; }
+
+	// the interpreted function, or nullptr for natively implemented ones
+	virtual const FunctionExpression* interpreted() const { return nullptr; }
+
+	// the builtin, or nullptr for anything else
+	virtual const BuiltinFunctionExpression* builtin() const { return nullptr; }
+
 	const auto& params() const noexcept { return parameters; }
 
 protected:
@@ -94,25 +225,100 @@ protected:
 
 struct BuiltinBinaryFunctionExpression;
 
+// a body of more than a few tokens is only pre-parsed, to find where it ends, and parsed on the first call.
+// most functions of a library are never called in a given run
 struct FunctionExpression : public AbstractFunctionExpression
 {
 	FunctionExpression(std::vector<std::string>&& parameters, StatementP&& body);
+	~FunctionExpression() override;
 
 	static ExpressionP parse(Lexer& lexer);
 	void print(std::ostream& str) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
 	Value call(
-		EnvironmentP closureEnv,
-		EnvironmentP callerEnv,
+		const EnvironmentP& closureEnv,
+		Environment& callerEnv,
 		const std::vector<ExpressionP>& arguments
 	) const override;
+	Value apply(const EnvironmentP& closureEnv, Arguments arguments) const override;
+	bool pure(Purity& purity) const override;
+	const Chunk* code() const override;
+	const FunctionExpression* interpreted() const override { return this; }
+	ExpressionP optimize(Optimizer& optimizer) override;
 
 	const auto& params() const noexcept { return parameters; }
+	const Expression& definition() const { materialize(); return *body; }
+
+	// the body hasn't been parsed yet
+	bool deferred() const noexcept { return !parsed.load(std::memory_order_acquire); }
+
+	// parse, resolve and optimize a deferred body, by whichever thread calls it first.
+	// this doesn't change what the function does. bind expects it to have been done
+	void materialize() const { if (deferred()) const_cast<FunctionExpression*>(this)->parseDeferred(); }
+
+	// depth of the global environment from a frame of the function
+	size_t globals() const noexcept { return flat ? (captures.empty() ? 1 : 2) : enclosing + 1; }
+
+	// functions whose bodies were deferred, and those of them since parsed
+	static std::atomic<size_t> deferrals;
+	static std::atomic<size_t> materializations;
 
 	std::shared_ptr<FunctionExpression> shared_from_this() { return std::static_pointer_cast<FunctionExpression>(AbstractFunctionExpression::shared_from_this()); }
 
+	// a frame for a call with arguments evaluated in callerEnv, or the abrupt completion of an argument
+	Value bind(
+		const EnvironmentP& closureEnv,
+		Environment& callerEnv,
+		const std::vector<ExpressionP>& arguments,
+		EnvironmentP& locals
+	) const;
+
 private:
-	EnvironmentP parentEnv;
+	friend struct Scope;
+	friend struct Purity;
+
+	// a deferred body
+	struct Source
+	{
+		std::string text;
+		size_t line;	// it starts on
+		std::vector<std::string> identifiers;	// in the body, which it may refer to
+		std::vector<Scope::Layout> enclosing;	// the scopes enclosing the function, outermost first
+		std::vector<std::string> captured;	// the names of its captures
+		std::unique_ptr<Optimizer> optimizer;	// as it was at the function
+	};
+
+	// a binding a flat closure copies from the environment it's made in
+	struct Capture
+	{
+		size_t depth;
+		size_t slot;	// or Scope::global for the closure itself
+	};
+
+	// a body of up to this many tokens is parsed straight away: it costs little to, and may be inlined
+	static constexpr size_t eagerTokens = 32;
+
+	FunctionExpression(std::vector<std::string>&& parameters, std::unique_ptr<Source>&& source);
+
+	void parseDeferred();
+
+	void resolveBody(Scope& scope);
+	void resolveDeferred();
+
+	Value run(EnvironmentP locals) const;
+
 	StatementP body;
+	size_t slots = 0;	// frame size: the parameters, then the lets of the body
+	bool flat = true;	// see Scope
+	size_t enclosing = 0;	// depth of the global environment from the environment it's made in
+	std::vector<Capture> captures;
+	std::unique_ptr<Source> source;
+	std::atomic<bool> parsed{true};
+	mutable std::shared_ptr<const Chunk> chunk;	// compiled on the first call, by whichever thread makes it
+	mutable std::atomic<const Chunk*> compiled{nullptr};
 };
 
 struct BinaryExpression : public Expression
@@ -121,12 +327,49 @@ struct BinaryExpression : public Expression
 	: fn{fn}, left{std::move(left)}, right{std::move(right)} {}
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	ExpressionP optimize(Optimizer& optimizer) override;
+	ExpressionP copy(Inlining& inlining) const override;
 
 private:
+	// the specialization this node has quickened to
+	enum class Quickened : uint8_t
+	{
+		Uninitialized,
+		Generic,
+		IntAdd,
+		IntSubtract,
+		IntMultiply,
+		IntBitAnd,
+		IntBitOr,
+		IntBitEor,
+		IntLt,
+		IntGt,
+		IntLe,
+		IntGe,
+		IntEq,
+		IntNeq,
+		StringConcat,
+		BoolAnd,
+		BoolOr,
+		BoolEq,
+		BoolNeq,
+	};
+
+	Value profile(const Value& leftValue, const Value& rightValue) const;
+	Quickened specialize(uint8_t shapes) const;
+	Value deoptimize(const Value& leftValue, const Value& rightValue) const;
+
 	const BuiltinBinaryFunctionExpression& fn;
-	const ExpressionP left;
-	const ExpressionP right;
+	ExpressionP left;
+	ExpressionP right;
+	mutable std::atomic<Quickened> quickened{Quickened::Uninitialized};
+	mutable Feedback feedback;
 };
 
 struct IdentifierExpression : public Expression
@@ -135,10 +378,30 @@ struct IdentifierExpression : public Expression
 	: identifier{identifier} {}
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+
+	ExpressionP copy(Inlining& inlining) const override;
+	std::unique_ptr<IdentifierExpression> copyIdentifier(Inlining& inlining) const;
+
+	// the value bound to the identifier, without copying it
+	const Value& binding(const Environment& env) const;
+
+	const Identifier& name() const noexcept { return identifier; }
+	bool global() const noexcept { return slot == Scope::global; }
+	size_t scopeDepth() const noexcept { return depth; }
+	size_t scopeSlot() const noexcept { return slot; }
+	void bind(size_t depth, size_t slot) noexcept;
 
 private:
 	Identifier identifier;
+	size_t depth = 0;
+	size_t slot = Scope::global;
+	mutable GlobalCache cache;
 };
 
 struct IntegerLiteralExpression : public Expression
@@ -147,7 +410,14 @@ struct IntegerLiteralExpression : public Expression
 	: value{value} {}
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	std::optional<Value> constant() const override;
+	ExpressionP copy(Inlining& inlining) const override;
 
 private:
 	const Integer value;
@@ -159,7 +429,14 @@ struct BooleanLiteralExpression : public Expression
 	: value{value} {}
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	std::optional<Value> constant() const override;
+	ExpressionP copy(Inlining& inlining) const override;
 
 private:
 	const bool value;
@@ -171,7 +448,14 @@ struct StringLiteralExpression : public Expression
 	: value{std::move(value)} {}
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	std::optional<Value> constant() const override;
+	ExpressionP copy(Inlining& inlining) const override;
 
 private:
 	const std::string value;
@@ -184,7 +468,14 @@ struct ArrayLiteralExpression : public Expression
 	static ExpressionP parse(Lexer& lexer);
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	ExpressionP optimize(Optimizer& optimizer) override;
+	ExpressionP copy(Inlining& inlining) const override;
 
 private:
 	std::vector<ExpressionP> elements;
@@ -199,11 +490,34 @@ struct IndexExpression : public Expression
 	}
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	ExpressionP optimize(Optimizer& optimizer) override;
+	ExpressionP copy(Inlining& inlining) const override;
+
+	static Value lookup(const Value& container, const Value& index);
 
 private:
-	const ExpressionP array;
-	const ExpressionP index;
+	// the specialization this node has quickened to
+	enum class Quickened : uint8_t
+	{
+		Uninitialized,
+		Generic,
+		ArrayElement,
+	};
+
+	Value profile(const Value& container, const Value& evaluatedIndex) const;
+	Quickened specialize(uint8_t shapes) const;
+	Value deoptimize(const Value& container, const Value& evaluatedIndex) const;
+
+	ExpressionP array;
+	ExpressionP index;
+	mutable std::atomic<Quickened> quickened{Quickened::Uninitialized};
+	mutable Feedback feedback;
 };
 
 
@@ -214,10 +528,16 @@ struct HashLiteralExpression : public Expression
 	: elements{std::move(elements)} {}
 
 	void print(std::ostream& str) const override;
-	Value eval(EnvironmentP env) const override;
+	void save(SnapshotWriter& writer) const override;
+	static ExpressionP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	ExpressionP optimize(Optimizer& optimizer) override;
 
 private:
-	const std::vector<std::pair<ExpressionP, ExpressionP>> elements;
+	std::vector<std::pair<ExpressionP, ExpressionP>> elements;
 };
 
 
@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <bit>
+#include <memory>
+
+#include "value.hpp"
+
+
+namespace
+{
+	// the shift past which there are no more bits to branch on: nodes there hold entries whose hashes are equal
+	constexpr size_t depth = 64;
+
+	// the bit of the branch hash takes at shift
+	uint32_t branch(size_t hash, size_t shift) noexcept
+	{
+		return uint32_t{1} << ((hash >> shift) & 31);
+	}
+
+	// the index in a compact array of the branch bit of map
+	size_t below(uint32_t map, uint32_t bit) noexcept
+	{
+		return std::popcount(map & (bit - 1));
+	}
+
+	// another reference to node
+	template<typename T>
+	Ref<T> share(T* node) noexcept
+	{
+		node->retain();
+		return Ref<T>{node};
+	}
+}
+
+
+// Hash
+
+Hash::Hash(std::initializer_list<value_type> entries)
+{
+	for (const auto& [key, value] : entries)
+		emplace(key, value);
+}
+
+const Value* Hash::find(const Value& key) const
+{
+	const auto hash = ValueHash{}(key);
+	const auto* node = root.get();
+	for (size_t shift = 0; node; shift += bits) {
+		if (shift >= depth) {
+			const auto found = std::find_if(node->entries.begin(), node->entries.end(), [&](const Entry& entry) {
+				return entry.binding.first == key;
+			});
+			return found == node->entries.end() ? nullptr : &found->binding.second;
+		}
+
+		const auto bit = branch(hash, shift);
+		if (node->entryMap & bit) {
+			const auto& entry = node->entries[below(node->entryMap, bit)];
+			return entry.hash == hash && entry.binding.first == key ? &entry.binding.second : nullptr;
+		}
+		if (!(node->nodeMap & bit))
+			return nullptr;
+		node = node->nodes[below(node->nodeMap, bit)].get();
+	}
+	return nullptr;
+}
+
+Hash Hash::put(Value key, Value value) const
+{
+	const auto hash = ValueHash{}(key);
+	auto added = false;
+
+	Hash result;
+	result.root = put(root.get(), Entry{{std::move(key), std::move(value)}, hash, stamps}, 0, added, true);
+	result.count = count + added;
+	result.stamps = stamps + added;
+	return result;
+}
+
+Hash Hash::remove(const Value& key) const
+{
+	auto removed = false;
+	auto node = root ? remove(root, key, ValueHash{}(key), 0, removed) : NodeP{};
+	if (!removed)
+		return *this;
+
+	Hash result;
+	result.root = std::move(node);
+	result.count = count - 1;
+	result.stamps = stamps;
+	return result;
+}
+
+bool Hash::insert(Value key, Value value, bool replace)
+{
+	const auto hash = ValueHash{}(key);
+	auto added = false;
+	put(root, Entry{{std::move(key), std::move(value)}, hash, stamps}, 0, added, replace);
+	count += added;
+	stamps += added;
+	return added;
+}
+
+const Hash::Order& Hash::order() const
+{
+	static const Order none;
+	if (!root)
+		return none;
+	if (const auto* order = root->order.load(std::memory_order_acquire))
+		return *order;
+
+	// placed by their stamps, unless removals left too many of those unused to be worth it
+	auto order = std::make_unique<Order>();
+	if (stamps <= 2 * count) {
+		order->resize(stamps);
+		auto place = [&order](const Entry& entry) { (*order)[entry.stamp] = &entry; };
+		walk(*root, place);
+		std::erase(*order, nullptr);
+	}
+	else {
+		order->reserve(count);
+		auto collect = [&order](const Entry& entry) { order->push_back(&entry); };
+		walk(*root, collect);
+		std::sort(order->begin(), order->end(), [](const Entry* left, const Entry* right) { return left->stamp < right->stamp; });
+	}
+
+	// threads iterating the same hash may each have made one
+	const Order* expected = nullptr;
+	if (root->order.compare_exchange_strong(expected, order.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+		return *order.release();
+	return *expected;
+}
+
+bool operator==(const Hash& left, const Hash& right)
+{
+	if (left.size() != right.size())
+		return false;
+	if (left.root.get() == right.root.get())
+		return true;
+
+	auto equal = true;
+	left.each([&](const Value& key, const Value& value) {
+		if (equal) {
+			const auto* other = right.find(key);
+			equal = other && *other == value;
+		}
+	});
+	return equal;
+}
+
+Hash::Node* Hash::copy(const Node* node)
+{
+	auto result = new Node{};
+	if (node) {
+		result->entryMap = node->entryMap;
+		result->nodeMap = node->nodeMap;
+		result->entries = node->entries;
+		result->nodes = node->nodes;
+	}
+	return result;
+}
+
+Hash::NodeP Hash::put(const Node* node, Entry&& entry, size_t shift, bool& added, bool replace)
+{
+	const auto& key = entry.binding.first;
+	if (shift >= depth) {
+		const auto found = std::find_if(node->entries.begin(), node->entries.end(), [&](const Entry& existing) {
+			return existing.binding.first == key;
+		});
+		if (found != node->entries.end() && !replace)
+			return share(node);
+
+		auto result = copy(node);
+		if (found != node->entries.end()) {
+			auto& existing = result->entries[found - node->entries.begin()];
+			entry.stamp = existing.stamp;
+			existing = std::move(entry);
+		}
+		else {
+			result->entries.push_back(std::move(entry));
+			added = true;
+		}
+		return NodeP{result};
+	}
+
+	const auto bit = branch(entry.hash, shift);
+	if (node && (node->nodeMap & bit)) {
+		const auto index = below(node->nodeMap, bit);
+		auto child = put(node->nodes[index].get(), std::move(entry), shift + bits, added, replace);
+		if (child.get() == node->nodes[index].get())
+			return share(node);
+		auto result = copy(node);
+		result->nodes[index] = std::move(child);
+		return NodeP{result};
+	}
+
+	if (!node || !(node->entryMap & bit)) {
+		auto result = copy(node);
+		result->entries.insert(result->entries.begin() + below(result->entryMap, bit), std::move(entry));
+		result->entryMap |= bit;
+		added = true;
+		return NodeP{result};
+	}
+
+	const auto index = below(node->entryMap, bit);
+	const auto& existing = node->entries[index];
+	if (existing.hash == entry.hash && existing.binding.first == key) {
+		if (!replace)
+			return share(node);
+		auto result = copy(node);
+		entry.stamp = existing.stamp;
+		result->entries[index] = std::move(entry);
+		return NodeP{result};
+	}
+
+	// the keys go on down together, until their hashes differ
+	auto result = copy(node);
+	auto merged = merge(std::move(result->entries[index]), std::move(entry), shift + bits);
+	result->entries.erase(result->entries.begin() + index);
+	result->entryMap &= ~bit;
+	result->nodes.insert(result->nodes.begin() + below(result->nodeMap, bit), std::move(merged));
+	result->nodeMap |= bit;
+	added = true;
+	return NodeP{result};
+}
+
+void Hash::put(NodeP& node, Entry&& entry, size_t shift, bool& added, bool replace)
+{
+	if (!node || node->refcount() != 1) {
+		node = put(node.get(), std::move(entry), shift, added, replace);
+		return;
+	}
+
+	// no other hash has node: it's changed as put would copy it, and forgets the order of the entries it had
+	auto& result = const_cast<Node&>(*node);
+	delete result.order.exchange(nullptr, std::memory_order_relaxed);
+
+	const auto& key = entry.binding.first;
+	if (shift >= depth) {
+		const auto found = std::find_if(result.entries.begin(), result.entries.end(), [&](const Entry& existing) {
+			return existing.binding.first == key;
+		});
+		if (found == result.entries.end()) {
+			result.entries.push_back(std::move(entry));
+			added = true;
+		}
+		else if (replace) {
+			entry.stamp = found->stamp;
+			*found = std::move(entry);
+		}
+		return;
+	}
+
+	const auto bit = branch(entry.hash, shift);
+	if (result.nodeMap & bit) {
+		put(result.nodes[below(result.nodeMap, bit)], std::move(entry), shift + bits, added, replace);
+		return;
+	}
+
+	if (!(result.entryMap & bit)) {
+		result.entries.insert(result.entries.begin() + below(result.entryMap, bit), std::move(entry));
+		result.entryMap |= bit;
+		added = true;
+		return;
+	}
+
+	const auto index = below(result.entryMap, bit);
+	auto& existing = result.entries[index];
+	if (existing.hash == entry.hash && existing.binding.first == key) {
+		if (replace) {
+			entry.stamp = existing.stamp;
+			existing = std::move(entry);
+		}
+		return;
+	}
+
+	auto merged = merge(std::move(existing), std::move(entry), shift + bits);
+	result.entries.erase(result.entries.begin() + index);
+	result.entryMap &= ~bit;
+	result.nodes.insert(result.nodes.begin() + below(result.nodeMap, bit), std::move(merged));
+	result.nodeMap |= bit;
+	added = true;
+}
+
+Hash::NodeP Hash::remove(const NodeP& node, const Value& key, size_t hash, size_t shift, bool& removed)
+{
+	if (shift >= depth) {
+		const auto found = std::find_if(node->entries.begin(), node->entries.end(), [&](const Entry& entry) {
+			return entry.binding.first == key;
+		});
+		if (found == node->entries.end())
+			return node;
+
+		removed = true;
+		auto result = copy(node.get());
+		result->entries.erase(result->entries.begin() + (found - node->entries.begin()));
+		return NodeP{result};
+	}
+
+	const auto bit = branch(hash, shift);
+	if (node->entryMap & bit) {
+		const auto index = below(node->entryMap, bit);
+		const auto& entry = node->entries[index];
+		if (entry.hash != hash || !(entry.binding.first == key))
+			return node;
+
+		removed = true;
+		if (node->entries.size() == 1 && node->nodes.empty())
+			return {};
+		auto result = copy(node.get());
+		result->entries.erase(result->entries.begin() + index);
+		result->entryMap &= ~bit;
+		return NodeP{result};
+	}
+
+	if (!(node->nodeMap & bit))
+		return node;
+
+	const auto index = below(node->nodeMap, bit);
+	auto child = remove(node->nodes[index], key, hash, shift + bits, removed);
+	if (!removed)
+		return node;
+
+	auto result = copy(node.get());
+	if (const auto* single = child->single()) {
+		// a node below that's left with one entry is replaced by the entry
+		result->nodes.erase(result->nodes.begin() + index);
+		result->nodeMap &= ~bit;
+		result->entries.insert(result->entries.begin() + below(result->entryMap, bit), *single);
+		result->entryMap |= bit;
+	}
+	else
+		result->nodes[index] = std::move(child);
+	return NodeP{result};
+}
+
+Hash::NodeP Hash::merge(Entry&& first, Entry&& second, size_t shift)
+{
+	auto node = new Node{};
+	if (shift >= depth) {
+		node->entries.push_back(std::move(first));
+		node->entries.push_back(std::move(second));
+		return NodeP{node};
+	}
+
+	const auto firstBit = branch(first.hash, shift);
+	const auto secondBit = branch(second.hash, shift);
+	if (firstBit == secondBit) {
+		node->nodeMap = firstBit;
+		node->nodes.push_back(merge(std::move(first), std::move(second), shift + bits));
+		return NodeP{node};
+	}
+
+	node->entryMap = firstBit | secondBit;
+	if (firstBit > secondBit)
+		std::swap(first, second);
+	node->entries.push_back(std::move(first));
+	node->entries.push_back(std::move(second));
+	return NodeP{node};
+}
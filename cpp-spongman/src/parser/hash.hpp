@@ -0,0 +1,179 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <iterator>
+#include <cstdint>
+#include <initializer_list>
+
+#include "value.hpp"
+
+// persistent hash array mapped trie: an immutable tree that branches on 5 bits of the hashes of the keys at each
+// level. a node holds the entries whose hashes it's the first to tell apart, and the nodes below it for those it
+// doesn't, each in a compact array indexed through a bitmap of the 32 branches. adding, replacing or removing an
+// entry copies the O(log32 n) nodes on its path, and shares all others with the hash it was made from.
+// each key is stamped with the order it was added in, which iteration follows: the entries in that order are
+// kept by the root they're iterated from, once they are. a hash whose nodes aren't shared, as while a literal
+// is built, is changed in place.
+class Hash
+{
+	struct Entry;
+	struct Node;
+	using NodeP = Ref<const Node>;
+	using Order = std::vector<const Entry*>;
+
+public:
+	class const_iterator;
+	using iterator = const_iterator;
+	using value_type = std::pair<Value, Value>;
+	using size_type = size_t;
+
+	static constexpr size_t bits = 5;	// of the hash that each level branches on
+
+	Hash() noexcept = default;
+	Hash(std::initializer_list<value_type> entries);
+
+	size_t size() const noexcept { return count; }
+	bool empty() const noexcept { return count == 0; }
+
+	// the value bound to key, or nullptr
+	const Value* find(const Value& key) const;
+	bool contains(const Value& key) const { return find(key); }
+
+	// a hash with key bound to value, in the place of key's entry if there is one and added last if not
+	Hash put(Value key, Value value) const;
+	// a hash without key's entry
+	Hash remove(const Value& key) const;
+
+	// bind key to value, unless it's bound already: whether it wasn't
+	bool emplace(Value key, Value value) { return insert(std::move(key), std::move(value), false); }
+	// bind key to value
+	void insert_or_assign(Value key, Value value) { insert(std::move(key), std::move(value), true); }
+
+	// call f(key, value) for each entry, in no particular order, which is cheaper than iterating
+	template<typename F>
+	void each(F&& f) const;
+
+	// in the order the keys were added
+	const_iterator begin() const;
+	const_iterator end() const;
+
+	// the same entries, in any order
+	friend bool operator==(const Hash& left, const Hash& right);
+
+private:
+	friend class Collector;
+
+	// a copy of node, or a new empty node
+	static Node* copy(const Node* node);
+
+	// bind the key of entry below node, or leave its binding be unless replace
+	static NodeP put(const Node* node, Entry&& entry, size_t shift, bool& added, bool replace);
+	// the same, changing the nodes that are only this hash's in place
+	static void put(NodeP& node, Entry&& entry, size_t shift, bool& added, bool replace);
+	static NodeP remove(const NodeP& node, const Value& key, size_t hash, size_t shift, bool& removed);
+	// a node for two entries whose hashes are the same up to shift
+	static NodeP merge(Entry&& first, Entry&& second, size_t shift);
+
+	bool insert(Value key, Value value, bool replace);
+
+	// the entries by their stamps, kept by the root
+	const Order& order() const;
+
+	// call f(entry) for each entry below node
+	template<typename F>
+	static void walk(const Node& node, F& f);
+
+	NodeP root;
+	size_t count = 0;
+	uint64_t stamps = 0;	// given to the keys added so far
+};
+
+struct Hash::Entry
+{
+	value_type binding;
+	size_t hash;	// of the key
+	uint64_t stamp;	// the order the key was added in
+};
+
+// past the last level, a node holds the entries whose hashes are equal, in neither map
+struct Hash::Node : Object
+{
+	~Node() { delete order.load(std::memory_order_relaxed); }
+
+	// the entry that's all a node below holds is kept in its parent instead
+	const Entry* single() const noexcept { return nodes.empty() && entries.size() == 1 ? &entries.front() : nullptr; }
+
+	uint32_t entryMap = 0;	// the branches with an entry
+	uint32_t nodeMap = 0;	// the branches with a node
+	std::vector<Entry> entries;	// in the order of their branches
+	std::vector<NodeP> nodes;
+	mutable std::atomic<const Order*> order{nullptr};	// the entries below, once iterated from here
+};
+
+class Hash::const_iterator
+{
+public:
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = Hash::value_type;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const value_type*;
+	using reference = const value_type&;
+
+	const_iterator() noexcept = default;
+
+	reference operator*() const noexcept { return (*entry)->binding; }
+	pointer operator->() const noexcept { return &**this; }
+
+	const_iterator& operator++() noexcept
+	{
+		++entry;
+		return *this;
+	}
+
+	const_iterator operator++(int) noexcept
+	{
+		auto previous = *this;
+		++*this;
+		return previous;
+	}
+
+	bool operator==(const const_iterator& other) const noexcept { return entry == other.entry; }
+
+private:
+	friend class Hash;
+
+	explicit const_iterator(const Entry* const* entry) noexcept
+	: entry{entry} {}
+
+	const Entry* const* entry = nullptr;	// in the root's order
+};
+
+template<typename F>
+void Hash::each(F&& f) const
+{
+	auto visit = [&f](const Entry& entry) { f(entry.binding.first, entry.binding.second); };
+	if (root)
+		walk(*root, visit);
+}
+
+template<typename F>
+void Hash::walk(const Node& node, F& f)
+{
+	for (const auto& entry : node.entries)
+		f(entry);
+	for (const auto& child : node.nodes)
+		walk(*child, f);
+}
+
+inline Hash::const_iterator Hash::begin() const
+{
+	return const_iterator{order().data()};
+}
+
+inline Hash::const_iterator Hash::end() const
+{
+	return const_iterator{order().data() + count};
+}
@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <ostream>
+
+#include "memo.hpp"
+#include "statement.hpp"
+#include "builtins.hpp"
+
+
+namespace
+{
+	// builtins that call the function they're given first
+	bool higherOrder(const BuiltinFunctionExpression& builtin)
+	{
+		static constexpr std::string_view names[] = { "map", "filter", "foldl", "foldr", "pmap", "pfilter", "preduce" };
+		return std::find(std::begin(names), std::end(names), builtin.name) != std::end(names);
+	}
+
+	// the environment of a memoized function: the function in its slot, and its results
+	struct Memoized : public Environment
+	{
+		explicit Memoized(const Value& function)
+		: Environment{{}, 1}
+		{
+			(*this)[0] = function;
+		}
+
+		// the function may be memoized: it's pure, as of the bindings the analysis found.
+		// the analysis is made again once a global of the function's environment is (re)defined and one of those changed,
+		// and from scratch when it's called over another fork of its globals, whose bindings it mustn't read
+		bool valid()
+		{
+			const auto& [fn, env] = (*this)[0].get<BoundFunction>();
+			const auto* interpreted = fn->interpreted();
+			const auto* global = interpreted ? &Environment::resolve(env->outer(interpreted->globals() - 1)) : nullptr;
+			const auto version = global ? global->version() : 0;
+			if (analyzed && global == this->global && version == this->version)
+				return pure;
+
+			if (!analyzed || global != this->global || !Purity::current(dependencies)) {
+				Purity purity;
+				pure = purity.function((*this)[0]);
+				dependencies = std::move(purity.dependencies);
+				memo.clear();
+			}
+			analyzed = true;
+			this->global = global;
+			this->version = version;
+			return pure;
+		}
+
+		std::mutex mutex;
+		Memo memo;
+		std::vector<Purity::Dependency> dependencies;
+		const Environment* global = nullptr;	// the globals of the function were looked up in
+		uint64_t version = 0;	// of those, when the analysis was last checked
+		bool analyzed = false;
+		bool pure = false;
+	};
+}
+
+
+// Purity
+
+bool Purity::Dependency::holds(const Value& binding) const
+{
+	if (!function)
+		return !binding.is<BoundFunction>() && binding == value;
+	if (!binding.is<BoundFunction>())
+		return false;
+
+	const auto& [fn, env] = binding.get<BoundFunction>();
+	return fn == function && env.get() == closure;
+}
+
+bool Purity::current(const std::vector<Dependency>& dependencies)
+{
+	return std::all_of(dependencies.begin(), dependencies.end(), [](const Dependency& dependency) {
+		return dependency.holds(dependency.env->get(dependency.name));
+	});
+}
+
+bool Purity::function(const Value& callee)
+{
+	if (!callee.is<BoundFunction>())
+		return false;
+
+	const auto& [fn, env] = callee.get<BoundFunction>();
+	if (const auto* builtin = fn->builtin())
+		return builtin->name != "puts" && !higherOrder(*builtin);
+	if (dynamic_cast<const BuiltinBinaryFunctionExpression*>(fn))
+		return true;
+	if (const auto* function = MemoFunctionExpression::wrapped(callee))
+		return this->function(*function);
+
+	const auto* interpreted = fn->interpreted();
+	if (!interpreted || !interpreted->flat)
+		return false;
+
+	const Closure closure{interpreted, env.get()};
+	if (const auto iter = std::find(visiting.begin(), visiting.end(), closure); iter != visiting.end()) {
+		recursive |= iter == visiting.begin();
+		return true;
+	}
+	if (std::find(pure.begin(), pure.end(), closure) != pure.end())
+		return true;
+
+	const auto saved = std::tuple{globals, this->closure, nesting};
+	visiting.push_back(closure);
+	globals = &Environment::resolve(env->outer(interpreted->globals() - 1));
+	this->closure = env.get();
+	nesting = 0;
+
+	const auto result = interpreted->definition().pure(*this);
+
+	std::tie(globals, this->closure, nesting) = saved;
+	visiting.pop_back();
+	// whether the functions taken to be pure meanwhile are, the outermost of them finds out
+	if (result)
+		pure.push_back(closure);
+	return result;
+}
+
+void Purity::read(const IdentifierExpression& identifier)
+{
+	if (identifier.global())
+		global(identifier.name());
+}
+
+bool Purity::call(const Expression& callee, const std::vector<ExpressionP>& arguments)
+{
+	const auto* value = known(callee);
+	if (!value)
+		return callable(callee);
+
+	// a higher-order builtin is as pure as the function it's given
+	if (value->is<BoundFunction>()) {
+		const auto* builtin = value->get<BoundFunction>().first->builtin();
+		if (builtin && higherOrder(*builtin))
+			return !arguments.empty() && callable(*arguments[0]);
+	}
+	return function(*value);
+}
+
+const Value& Purity::global(std::string_view name)
+{
+	const auto& binding = globals == defining && name == this->name ? *value : globals->get(name);
+
+	const auto found = std::find_if(dependencies.begin(), dependencies.end(), [&](const Dependency& dependency) {
+		return dependency.env == globals && dependency.name == name;
+	});
+	if (found == dependencies.end()) {
+		Dependency dependency{globals, std::string{name}};
+		if (binding.is<BoundFunction>()) {
+			const auto& [fn, env] = binding.get<BoundFunction>();
+			dependency.function = fn;
+			dependency.closure = env.get();
+		}
+		else
+			dependency.value = binding;
+		dependencies.push_back(std::move(dependency));
+	}
+	return binding;
+}
+
+const Value* Purity::known(const Expression& callee)
+{
+	const auto* identifier = dynamic_cast<const IdentifierExpression*>(&callee);
+	if (!identifier)
+		return nullptr;
+	if (identifier->global())
+		return &global(identifier->name());
+
+	// a capture of the function being analyzed, which can't change: its closure is flat
+	if (nesting == 0 && identifier->scopeDepth() == 1)
+		return &(*closure)[identifier->scopeSlot()];
+	return nullptr;
+}
+
+bool Purity::callable(const Expression& callee)
+{
+	if (const auto* value = known(callee))
+		return function(*value);
+	const auto* function = dynamic_cast<const FunctionExpression*>(&callee);
+	return function && made(*function);
+}
+
+bool Purity::made(const FunctionExpression& function)
+{
+	nesting++;
+	const auto result = function.definition().pure(*this);
+	nesting--;
+	return result;
+}
+
+
+// Memo
+
+std::atomic<size_t> Memo::capacity{size_t{1} << 16};
+std::atomic<bool> Memo::automatic{false};
+std::atomic<size_t> Memo::hits{0}, Memo::misses{0}, Memo::bypassed{0}, Memo::evicted{0};
+
+size_t Memo::ArgumentsHash::operator()(Arguments arguments) const noexcept
+{
+	size_t hash = arguments.size();
+	for (const auto& argument : arguments)
+		hash ^= ValueHash{}(argument) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+	return hash;
+}
+
+bool Memo::ArgumentsEqual::operator()(Arguments left, Arguments right) const noexcept
+{
+	return std::equal(left.begin(), left.end(), right.begin(), right.end());
+}
+
+std::optional<Value> Memo::find(Arguments arguments)
+{
+	const auto iter = index.find(arguments);
+	if (iter == index.end())
+		return std::nullopt;
+
+	entries.splice(entries.begin(), entries, iter->second);
+	return iter->second->result;
+}
+
+void Memo::insert(Arguments arguments, const Value& result)
+{
+	// another call with the same arguments may have got here first
+	if (index.contains(arguments))
+		return;
+
+	const auto limit = capacity.load(std::memory_order_relaxed);
+	while (!entries.empty() && entries.size() >= limit) {
+		index.erase(entries.back().arguments);
+		entries.pop_back();
+		evicted.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (limit == 0)
+		return;
+
+	entries.push_front({{arguments.begin(), arguments.end()}, result});
+	index.emplace(entries.front().arguments, entries.begin());
+}
+
+void Memo::clear() noexcept
+{
+	index.clear();
+	entries.clear();
+}
+
+Memo::Stats Memo::stats() noexcept
+{
+	return {
+		hits.load(std::memory_order_relaxed),
+		misses.load(std::memory_order_relaxed),
+		bypassed.load(std::memory_order_relaxed),
+		evicted.load(std::memory_order_relaxed),
+	};
+}
+
+
+// MemoFunctionExpression
+
+const MemoFunctionExpression MemoFunctionExpression::instance;
+
+void MemoFunctionExpression::print(std::ostream& os) const
+{
+	AbstractFunctionExpression::print(os);
+	os << "{ memo }";
+}
+
+Value MemoFunctionExpression::call(
+	const EnvironmentP& closureEnv,
+	Environment& callerEnv,
+	const std::vector<ExpressionP>& arguments
+) const
+{
+	const auto count = arguments.size();
+	const auto evaluate = [&](std::span<Value> values) -> const Value* {
+		for (size_t i = 0; i < count; i++) {
+			values[i] = arguments[i]->eval(callerEnv);
+			if (values[i].abrupt())
+				return &values[i];
+		}
+		return nullptr;
+	};
+
+	if (count <= buffered) {
+		Value values[buffered];
+		if (const auto* abrupt = evaluate(values))
+			return *abrupt;
+		return apply(closureEnv, Arguments{values, count});
+	}
+
+	std::vector<Value> values(count);
+	if (const auto* abrupt = evaluate(values))
+		return *abrupt;
+	return apply(closureEnv, values);
+}
+
+Value MemoFunctionExpression::apply(const EnvironmentP& closureEnv, Arguments arguments) const
+{
+	auto& memoized = static_cast<Memoized&>(*closureEnv);
+	const auto& [fn, env] = memoized[0].get<BoundFunction>();
+
+	const auto comparable = std::none_of(arguments.begin(), arguments.end(), [](const Value& argument) {
+		return argument.is<BoundFunction>();
+	});
+	std::unique_lock lock{memoized.mutex};
+	if (!comparable || !memoized.valid()) {
+		lock.unlock();
+		Memo::bypassed.fetch_add(1, std::memory_order_relaxed);
+		return fn->apply(env, arguments);
+	}
+	if (auto result = memoized.memo.find(arguments)) {
+		Memo::hits.fetch_add(1, std::memory_order_relaxed);
+		return std::move(*result);
+	}
+	lock.unlock();
+	Memo::misses.fetch_add(1, std::memory_order_relaxed);
+
+	auto result = fn->apply(env, arguments);
+	if (!result.failed()) {
+		std::lock_guard lock{memoized.mutex};
+		memoized.memo.insert(arguments, result);
+	}
+	return result;
+}
+
+Value MemoFunctionExpression::wrap(const Value& function)
+{
+	if (!function.is<BoundFunction>())
+		return Value::error("invalid argument to memo(): " + std::to_string(function));
+	if (wrapped(function))
+		return function;
+	return Value{BoundFunction{&instance, std::make_shared<Memoized>(function)}};
+}
+
+const Value* MemoFunctionExpression::wrapped(const Value& value)
+{
+	if (!value.is<BoundFunction>())
+		return nullptr;
+	const auto& [fn, env] = value.get<BoundFunction>();
+	return fn == &instance ? &(*env)[0] : nullptr;
+}
+
+Value MemoFunctionExpression::define(const Environment& env, std::string_view name, Value&& value)
+{
+	if (!Memo::automatic.load(std::memory_order_relaxed) || !value.is<BoundFunction>() || !value.get<BoundFunction>().first->interpreted())
+		return std::move(value);
+
+	Purity purity;
+	purity.defining = &env;
+	purity.name = name;
+	purity.value = &value;
+	if (!purity.function(value) || !purity.recursive)
+		return std::move(value);
+	return wrap(value);
+}
+
+
+// Expressions
+
+bool Expression::pure(Purity& purity) const
+{
+	return false;
+}
+
+bool UnaryExpression::pure(Purity& purity) const
+{
+	return value->pure(purity);
+}
+
+bool CallExpression::pure(Purity& purity) const
+{
+	return function->pure(purity)
+		&& std::all_of(arguments.begin(), arguments.end(), [&](const ExpressionP& argument) { return argument->pure(purity); })
+		&& purity.call(*function, arguments);
+}
+
+bool InlinedCallExpression::pure(Purity& purity) const
+{
+	// the body is only evaluated in place of the call while it's the same
+	return call->pure(purity);
+}
+
+bool FunctionExpression::pure(Purity& purity) const
+{
+	// making a closure is: calling it is analyzed where it's called
+	return true;
+}
+
+bool BinaryExpression::pure(Purity& purity) const
+{
+	return left->pure(purity) && right->pure(purity);
+}
+
+bool IdentifierExpression::pure(Purity& purity) const
+{
+	purity.read(*this);
+	return true;
+}
+
+bool IntegerLiteralExpression::pure(Purity& purity) const
+{
+	return true;
+}
+
+bool BooleanLiteralExpression::pure(Purity& purity) const
+{
+	return true;
+}
+
+bool StringLiteralExpression::pure(Purity& purity) const
+{
+	return true;
+}
+
+bool ArrayLiteralExpression::pure(Purity& purity) const
+{
+	return std::all_of(elements.begin(), elements.end(), [&](const ExpressionP& element) { return element->pure(purity); });
+}
+
+bool IndexExpression::pure(Purity& purity) const
+{
+	return array->pure(purity) && index->pure(purity);
+}
+
+bool HashLiteralExpression::pure(Purity& purity) const
+{
+	return std::all_of(elements.begin(), elements.end(), [&](const auto& element) {
+		return element.first->pure(purity) && element.second->pure(purity);
+	});
+}
+
+
+// Statements
+
+bool LetStatement::pure(Purity& purity) const
+{
+	return value->pure(purity);
+}
+
+bool ReturnStatement::pure(Purity& purity) const
+{
+	return value->pure(purity);
+}
+
+bool IfStatement::pure(Purity& purity) const
+{
+	return condition->pure(purity) && consequence->pure(purity) && (!alternative || alternative->pure(purity));
+}
+
+bool StatementList::pure(Purity& purity) const
+{
+	return std::all_of(statements.begin(), statements.end(), [&](const StatementP& statement) { return statement->pure(purity); });
+}
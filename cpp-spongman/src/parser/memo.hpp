@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "expression.hpp"
+
+// whether calling a function can do anything but return a result that only depends on its arguments (see Expression::pure).
+// a function is pure if its closure is flat, so the captures it reads can't change, and it only calls pure functions:
+// builtins other than puts, the higher-order ones given pure functions, and closures whose bodies are pure themselves.
+// the globals it reads, and those the functions it calls read, are recorded as they were bound: once one of them is
+// rebound, the function may not be pure any more, nor give the same results.
+struct Purity
+{
+	// a global, as the analysis found it bound
+	struct Dependency
+	{
+		// the global is still bound to it
+		bool holds(const Value& binding) const;
+
+		const Environment* env;
+		std::string name;
+		Value value;	// or nil for a function, which is compared by identity
+		const void* function = nullptr;
+		const void* closure = nullptr;
+	};
+
+	// calling the function value can only return a result
+	bool function(const Value& callee);
+
+	// the dependencies are all still bound as they were. a global function's come after the global, whose binding
+	// keeps the environment they're in alive for as long as it holds
+	static bool current(const std::vector<Dependency>& dependencies);
+
+	// for the nodes of the body being analyzed
+	void read(const IdentifierExpression& identifier);
+	bool call(const Expression& callee, const std::vector<ExpressionP>& arguments);
+
+	std::vector<Dependency> dependencies;
+	bool recursive = false;	// the function calls itself, directly or not
+
+	// a global being defined, which the analysis takes to be bound to its value already
+	const Environment* defining = nullptr;
+	std::string_view name;
+	const Value* value = nullptr;
+
+private:
+	struct Closure
+	{
+		const FunctionExpression* function;
+		const Environment* env;
+
+		bool operator==(const Closure&) const = default;
+	};
+
+	// the binding of a global of the body, which it depends on from here on
+	const Value& global(std::string_view name);
+	// the value of a callee, if it's known without running the body
+	const Value* known(const Expression& callee);
+	// the callee is a function made in the body, or one whose value is known, and calling it is pure
+	bool callable(const Expression& callee);
+	// the body of a function made in the body being analyzed
+	bool made(const FunctionExpression& function);
+
+	std::vector<Closure> visiting;	// whose bodies are being analyzed, outermost first, which are taken to be pure
+	std::vector<Closure> pure;	// found to be
+	const Environment* globals = nullptr;	// of the body being analyzed
+	const Environment* closure = nullptr;	// and the captures of the function
+	size_t nesting = 0;	// functions made in the body enclosing the node
+};
+
+// the results of a function by its arguments, up to capacity of them: the least recently used goes to make room.
+// arguments that include a function are never found, as functions don't compare equal
+struct Memo
+{
+	struct Stats
+	{
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t bypassed = 0;	// calls of impure functions, or with functions for arguments, which are never cached
+		size_t evicted = 0;
+	};
+
+	std::optional<Value> find(Arguments arguments);
+	void insert(Arguments arguments, const Value& result);
+	void clear() noexcept;
+
+	// the counts so far, of all memos
+	static Stats stats() noexcept;
+
+	static std::atomic<size_t> capacity;	// results a memo holds, which --memo=n sets
+	static std::atomic<bool> automatic;	// --memo: a global defined as a pure recursive function is memoized
+
+	static std::atomic<size_t> hits, misses, bypassed, evicted;
+
+private:
+	struct Entry
+	{
+		std::vector<Value> arguments;
+		Value result;
+	};
+
+	using Entries = std::list<Entry>;
+
+	struct ArgumentsHash
+	{
+		size_t operator()(Arguments arguments) const noexcept;
+	};
+
+	struct ArgumentsEqual
+	{
+		bool operator()(Arguments left, Arguments right) const noexcept;
+	};
+
+	Entries entries;	// most recently used first
+	std::unordered_map<Arguments, Entries::iterator, ArgumentsHash, ArgumentsEqual> index;	// over the arguments of the entries
+};
+
+// what memo(f) returns: a function that calls f, and keeps its results while f is pure. it's bound to an
+// environment whose slot 0 holds f, with the Memo of its results and the analysis they're valid under.
+// calls that are cached, or that miss, lock the memo, but never while f runs, so f may call it again
+// recursively, and on other threads.
+struct MemoFunctionExpression : public AbstractFunctionExpression
+{
+	MemoFunctionExpression()
+	: AbstractFunctionExpression{{"..."}} {}
+
+	void print(std::ostream& os) const override;
+	Value call(
+		const EnvironmentP& closureEnv,
+		Environment& callerEnv,
+		const std::vector<ExpressionP>& arguments
+	) const override;
+	Value apply(const EnvironmentP& closureEnv, Arguments arguments) const override;
+
+	// memoize a function value
+	static Value wrap(const Value& function);
+
+	// the function a memoized value wraps, or nullptr for any other value
+	static const Value* wrapped(const Value& value);
+
+	// the value a global is defined as: a pure recursive function is memoized in --memo mode
+	static Value define(const Environment& env, std::string_view name, Value&& value);
+
+	static const MemoFunctionExpression instance;
+
+private:
+	static constexpr size_t buffered = 4;
+};
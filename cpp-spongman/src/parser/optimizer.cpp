@@ -0,0 +1,466 @@
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "optimizer.hpp"
+#include "expression.hpp"
+#include "statement.hpp"
+#include "builtins.hpp"
+
+
+namespace
+{
+	// an argument that may be dropped, duplicated or reordered
+	bool trivial(const Expression& expression)
+	{
+		return expression.constant() || dynamic_cast<const IdentifierExpression*>(&expression);
+	}
+
+	// left op right overflows an Integer, which folding mustn't compute
+	bool overflows(const BuiltinBinaryFunctionExpression& fn, const Value& left, const Value& right)
+	{
+		using B = BuiltinBinaryFunctionExpression;
+
+		if (!left.is<Integer>() || !right.is<Integer>())
+			return false;
+
+		Integer result;
+		if (&fn == &B::plus)
+			return __builtin_add_overflow(left.get<Integer>(), right.get<Integer>(), &result);
+		if (&fn == &B::minus)
+			return __builtin_sub_overflow(left.get<Integer>(), right.get<Integer>(), &result);
+		if (&fn == &B::asterisk)
+			return __builtin_mul_overflow(left.get<Integer>(), right.get<Integer>(), &result);
+		return false;
+	}
+}
+
+
+// Optimizer
+
+void Optimizer::optimize(ExpressionP& expression)
+{
+	if (auto replacement = expression->optimize(*this))
+		expression = std::move(replacement);
+}
+
+void Optimizer::define(const Identifier& name, const Expression& value)
+{
+	undefine(name);
+	if (!enabled(Inline) || depth > 0 || branches > 0)
+		return;
+
+	// a body that hasn't been parsed is too long to inline
+	const auto* function = dynamic_cast<const FunctionExpression*>(&value);
+	if (!function || function->deferred())
+		return;
+
+	Inlining trial{.function = &name};
+	if (!function->definition().copy(trial) || trial.nodes > maxNodes)
+		return;
+
+	// an argument in place of a parameter is evaluated where the parameter is: after what the body does before it
+	auto linear = !trial.conditional && !trial.late && trial.uses.size() == function->params().size();
+	for (size_t i = 0; linear && i < trial.uses.size(); i++)
+		linear = trial.uses[i] == i;
+
+	edit()[name] = {function, linear};
+}
+
+void Optimizer::undefine(const Identifier& name)
+{
+	if (candidates->contains(name))
+		edit().erase(name);
+}
+
+Optimizer::Candidates& Optimizer::edit()
+{
+	if (candidates.use_count() > 1)
+		candidates = std::make_shared<Candidates>(*candidates);
+	return *candidates;
+}
+
+ExpressionP Optimizer::expand(const Expression& call, const Expression& callee, const std::vector<ExpressionP>& arguments)
+{
+	if (!enabled(Inline) || expansions >= maxExpansions)
+		return nullptr;
+
+	const auto* identifier = dynamic_cast<const IdentifierExpression*>(&callee);
+	if (!identifier || !identifier->global())
+		return nullptr;
+
+	const auto iter = candidates->find(identifier->name());
+	if (iter == candidates->end())
+		return nullptr;
+
+	const auto& [function, linear] = iter->second;
+	if (function->params().size() != arguments.size())
+		return nullptr;
+	if (!linear && !std::all_of(arguments.begin(), arguments.end(), [](const auto& argument) { return trivial(*argument); }))
+		return nullptr;
+
+	Inlining inlining{.arguments = &arguments, .depth = depth};
+	auto body = function->definition().copy(inlining);
+	if (!body)
+		return nullptr;
+
+	// the call itself is kept for when the global is redefined
+	Inlining plain;
+	auto calleeCopy = identifier->copyIdentifier(plain);
+	auto callCopy = call.copy(plain);
+	if (!calleeCopy || !callCopy)
+		return nullptr;
+
+	// the body may call other candidates
+	expansions++;
+	optimize(body);
+	expansions--;
+	return std::make_unique<InlinedCallExpression>(std::move(calleeCopy), *function, std::move(body), std::move(callCopy));
+}
+
+ExpressionP Optimizer::literal(const Value& value)
+{
+	switch (value.type()) {
+		case ValueType::Integer:
+			return std::make_unique<IntegerLiteralExpression>(value.get<Integer>());
+		case ValueType::Bool:
+			return std::make_unique<BooleanLiteralExpression>(value.get<bool>());
+		case ValueType::String:
+		{
+			auto string = value.get<String>();
+			return std::make_unique<StringLiteralExpression>(string);
+		}
+		default:
+			return nullptr;
+	}
+}
+
+
+// Expressions
+
+ExpressionP UnaryExpression::optimize(Optimizer& optimizer)
+{
+	optimizer.optimize(value);
+
+	if (const auto operand = value->constant(); operand && optimizer.enabled(Optimizer::Fold)) {
+		// leave overflow to runtime
+		if (op == TokenType::Minus && operand->is<Integer>() && operand->get<Integer>() == std::numeric_limits<Integer>::min())
+			return nullptr;
+		if (const auto result = apply(op, *operand); !result.failed())
+			return Optimizer::literal(result);
+	}
+	return nullptr;
+}
+
+ExpressionP BinaryExpression::optimize(Optimizer& optimizer)
+{
+	using B = BuiltinBinaryFunctionExpression;
+
+	optimizer.optimize(left);
+	optimizer.optimize(right);
+
+	if (!optimizer.enabled(Optimizer::Fold))
+		return nullptr;
+
+	const auto leftValue = left->constant();
+	const auto rightValue = right->constant();
+	if (!leftValue || !rightValue)
+		return nullptr;
+
+	// leave division by zero, and overflow, to runtime
+	if ((&fn == &B::slash || &fn == &B::percent) && !(rightValue->is<Integer>() && rightValue->get<Integer>() > 0))
+		return nullptr;
+	if (overflows(fn, *leftValue, *rightValue))
+		return nullptr;
+
+	if (const auto result = fn.call(*leftValue, *rightValue); !result.failed())
+		return Optimizer::literal(result);
+	return nullptr;
+}
+
+ExpressionP CallExpression::optimize(Optimizer& optimizer)
+{
+	optimizer.optimize(function);
+	for (auto& argument : arguments)
+		optimizer.optimize(argument);
+
+	return optimizer.expand(*this, *function, arguments);
+}
+
+ExpressionP FunctionExpression::optimize(Optimizer& optimizer)
+{
+	// a deferred body is optimized once it's parsed, as it would have been here
+	if (deferred()) {
+		source->optimizer = std::make_unique<Optimizer>(optimizer);
+		return nullptr;
+	}
+
+	const auto depth = std::exchange(optimizer.depth, globals());
+	optimizer.optimize(body);
+	optimizer.depth = depth;
+	return nullptr;
+}
+
+ExpressionP ArrayLiteralExpression::optimize(Optimizer& optimizer)
+{
+	for (auto& element : elements)
+		optimizer.optimize(element);
+	return nullptr;
+}
+
+ExpressionP IndexExpression::optimize(Optimizer& optimizer)
+{
+	optimizer.optimize(array);
+	optimizer.optimize(index);
+	return nullptr;
+}
+
+ExpressionP HashLiteralExpression::optimize(Optimizer& optimizer)
+{
+	for (auto& [key, value] : elements) {
+		optimizer.optimize(key);
+		optimizer.optimize(value);
+	}
+	return nullptr;
+}
+
+
+// Statements
+
+ExpressionP LetStatement::optimize(Optimizer& optimizer)
+{
+	// a function refers to its own global by name: it must not see an earlier definition inlined
+	if (slot == Scope::global)
+		optimizer.undefine(name);
+
+	optimizer.optimize(value);
+
+	if (slot == Scope::global)
+		optimizer.define(name, *value);
+	return nullptr;
+}
+
+ExpressionP ReturnStatement::optimize(Optimizer& optimizer)
+{
+	optimizer.optimize(value);
+	return nullptr;
+}
+
+ExpressionP IfStatement::optimize(Optimizer& optimizer)
+{
+	optimizer.optimize(condition);
+
+	optimizer.branches++;
+	optimizer.optimize(consequence);
+	if (alternative)
+		optimizer.optimize(alternative);
+	optimizer.branches--;
+
+	if (!optimizer.enabled(Optimizer::Prune))
+		return nullptr;
+
+	const auto value = condition->constant();
+	if (!value)
+		return nullptr;
+
+	const auto test = truthy(*value);
+	if (test.failed())
+		return nullptr;
+
+	if (test.get<bool>())
+		return std::move(consequence);
+	if (alternative)
+		return std::move(alternative);
+	return std::make_unique<StatementList>(std::vector<StatementP>{});
+}
+
+ExpressionP StatementList::optimize(Optimizer& optimizer)
+{
+	for (auto& statement : statements)
+		optimizer.optimize(statement);
+	return nullptr;
+}
+
+
+// constants
+
+std::optional<Value> IntegerLiteralExpression::constant() const
+{
+	return Value{value};
+}
+
+std::optional<Value> BooleanLiteralExpression::constant() const
+{
+	return Value{value};
+}
+
+std::optional<Value> StringLiteralExpression::constant() const
+{
+	return Value{value};
+}
+
+
+// copies
+
+ExpressionP IntegerLiteralExpression::copy(Inlining& inlining) const
+{
+	inlining.nodes++;
+	return std::make_unique<IntegerLiteralExpression>(value);
+}
+
+ExpressionP BooleanLiteralExpression::copy(Inlining& inlining) const
+{
+	inlining.nodes++;
+	return std::make_unique<BooleanLiteralExpression>(value);
+}
+
+ExpressionP StringLiteralExpression::copy(Inlining& inlining) const
+{
+	inlining.nodes++;
+	auto string = value;
+	return std::make_unique<StringLiteralExpression>(string);
+}
+
+ExpressionP IdentifierExpression::copy(Inlining& inlining) const
+{
+	if (global())
+		return copyIdentifier(inlining);
+
+	inlining.nodes++;
+
+	if (depth == 0) {
+		inlining.uses.push_back(slot);
+		if (inlining.branches > 0)
+			inlining.conditional = true;
+		if (inlining.operations > 0)
+			inlining.late = true;
+	}
+
+	if (!inlining.arguments) {
+		auto copied = std::make_unique<IdentifierExpression>(identifier);
+		copied->bind(depth, slot);
+		return copied;
+	}
+
+	// a parameter of the inlined function: the argument, as evaluated at the call site
+	if (depth != 0 || slot >= inlining.arguments->size())
+		return nullptr;
+	Inlining argument;
+	return (*inlining.arguments)[slot]->copy(argument);
+}
+
+// a global, rebound to the call site when inlining
+std::unique_ptr<IdentifierExpression> IdentifierExpression::copyIdentifier(Inlining& inlining) const
+{
+	inlining.nodes++;
+	inlining.operations++;	// it may not be bound
+	if (inlining.function && identifier == *inlining.function)
+		return nullptr;
+
+	auto copied = std::make_unique<IdentifierExpression>(identifier);
+	copied->bind(inlining.arguments ? inlining.depth : depth, slot);
+	return copied;
+}
+
+ExpressionP UnaryExpression::copy(Inlining& inlining) const
+{
+	inlining.nodes++;
+	auto copied = value->copy(inlining);
+	if (!copied)
+		return nullptr;
+	inlining.operations++;
+	return std::make_unique<UnaryExpression>(op, std::move(copied));
+}
+
+ExpressionP BinaryExpression::copy(Inlining& inlining) const
+{
+	inlining.nodes++;
+	auto leftCopy = left->copy(inlining);
+	if (!leftCopy)
+		return nullptr;
+	auto rightCopy = right->copy(inlining);
+	if (!rightCopy)
+		return nullptr;
+	inlining.operations++;
+	return std::make_unique<BinaryExpression>(fn, std::move(leftCopy), std::move(rightCopy));
+}
+
+ExpressionP CallExpression::copy(Inlining& inlining) const
+{
+	inlining.nodes++;
+	auto functionCopy = function->copy(inlining);
+	if (!functionCopy)
+		return nullptr;
+
+	std::vector<ExpressionP> argumentCopies;
+	for (const auto& argument : arguments) {
+		auto copied = argument->copy(inlining);
+		if (!copied)
+			return nullptr;
+		argumentCopies.push_back(std::move(copied));
+	}
+	inlining.operations++;
+	return std::make_unique<CallExpression>(std::move(functionCopy), std::move(argumentCopies));
+}
+
+ExpressionP ArrayLiteralExpression::copy(Inlining& inlining) const
+{
+	inlining.nodes++;
+	std::vector<ExpressionP> elementCopies;
+	for (const auto& element : elements) {
+		auto copied = element->copy(inlining);
+		if (!copied)
+			return nullptr;
+		elementCopies.push_back(std::move(copied));
+	}
+	return std::make_unique<ArrayLiteralExpression>(std::move(elementCopies));
+}
+
+ExpressionP IndexExpression::copy(Inlining& inlining) const
+{
+	inlining.nodes++;
+	auto arrayCopy = array->copy(inlining);
+	if (!arrayCopy)
+		return nullptr;
+	auto indexCopy = index->copy(inlining);
+	if (!indexCopy)
+		return nullptr;
+	inlining.operations++;
+	return std::make_unique<IndexExpression>(std::move(arrayCopy), std::move(indexCopy));
+}
+
+ExpressionP InlinedCallExpression::copy(Inlining& inlining) const
+{
+	inlining.nodes++;
+	auto calleeCopy = callee->copyIdentifier(inlining);
+	if (!calleeCopy)
+		return nullptr;
+
+	// only one of the body and the call is evaluated
+	inlining.branches++;
+	auto bodyCopy = body->copy(inlining);
+	auto callCopy = call->copy(inlining);
+	inlining.branches--;
+
+	if (!bodyCopy || !callCopy)
+		return nullptr;
+	return std::make_unique<InlinedCallExpression>(std::move(calleeCopy), function, std::move(bodyCopy), std::move(callCopy));
+}
+
+ExpressionP IfStatement::copy(Inlining& inlining) const
+{
+	inlining.nodes++;
+	auto conditionCopy = condition->copy(inlining);
+	if (!conditionCopy)
+		return nullptr;
+	inlining.operations++;	// the condition may not be a boolean
+
+	inlining.branches++;
+	auto consequenceCopy = consequence->copy(inlining);
+	auto alternativeCopy = alternative ? alternative->copy(inlining) : nullptr;
+	inlining.branches--;
+
+	if (!consequenceCopy || (alternative && !alternativeCopy))
+		return nullptr;
+	return std::make_unique<IfStatement>(std::move(conditionCopy), std::move(consequenceCopy), std::move(alternativeCopy));
+}
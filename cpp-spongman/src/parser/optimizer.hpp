@@ -0,0 +1,84 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "expression.hpp"
+
+// rewrites resolved statements before they are evaluated.
+// a single bottom-up walk runs every enabled pass: each node optimizes its children,
+// then may return a replacement for itself.
+struct Optimizer
+{
+	enum Pass : unsigned
+	{
+		Fold   = 1 << 0,	// evaluate operators over literals
+		Inline = 1 << 1,	// replace calls to small global functions with their bodies
+		Prune  = 1 << 2,	// replace an if with a constant condition by the branch it takes
+	};
+
+	// the passes of -O0, -O1
+	static constexpr unsigned levels[] = { 0, Fold | Inline | Prune };
+
+	// copies are cheap: a function whose body is parsed on its first call keeps one, to optimize the body with
+	explicit Optimizer(unsigned passes = levels[1])
+	: passes{passes} {}
+
+	bool enabled(Pass pass) const noexcept { return passes & pass; }
+
+	// an optimizer with the same passes, which has seen no definitions
+	Optimizer restarted() const { return Optimizer{passes}; }
+
+	// optimize a resolved expression in place
+	void optimize(ExpressionP& expression);
+
+	// a global is (re)defined: calls to a small, non-recursive function may be inlined from here on
+	void define(const Identifier& name, const Expression& value);
+	void undefine(const Identifier& name);
+
+	// the call, inlined, or nullptr if it can't be inlined
+	ExpressionP expand(const Expression& call, const Expression& callee, const std::vector<ExpressionP>& arguments);
+
+	// a literal expression for value, or nullptr if it has none
+	static ExpressionP literal(const Value& value);
+
+	size_t depth = 0;		// of the global environment from the node being optimized: 0 outside any function
+	size_t branches = 0;	// conditionals enclosing it
+
+private:
+	struct Candidate
+	{
+		const FunctionExpression* function;
+		bool linear;	// evaluates every parameter exactly once, unconditionally and in order
+	};
+
+	using Candidates = std::unordered_map<Identifier, Candidate>;
+
+	// the candidates, copied first if they're shared with a copy of this optimizer
+	Candidates& edit();
+
+	static constexpr size_t maxNodes = 12;
+	static constexpr size_t maxExpansions = 8;
+
+	unsigned passes;
+	size_t expansions = 0;
+	std::shared_ptr<Candidates> candidates = std::make_shared<Candidates>();	// shared by copies until either changes them
+};
+
+// state for copying the body of an inlined function
+struct Inlining
+{
+	// the arguments of the call, which replace the parameters, or nullptr for a plain copy
+	const std::vector<ExpressionP>* arguments = nullptr;
+	size_t depth = 0;	// of the global environment from the call site, which global references are rebound to
+	const Identifier* function = nullptr;	// the function being copied, which mustn't call itself
+
+	size_t nodes = 0;
+	size_t branches = 0;
+	std::vector<size_t> uses;	// parameters in the order they are evaluated
+	bool conditional = false;	// some parameter is only evaluated in a branch
+	size_t operations = 0;	// evaluated so far that may fail or have an effect: calls, operators, indexes, globals
+	bool late = false;	// some parameter is evaluated after one of those
+};
@@ -0,0 +1,134 @@
+#include "pool.hpp"
+#include "value.hpp"
+#include "environment.hpp"
+
+
+thread_local size_t ThreadPool::current = ThreadPool::external;
+std::atomic<size_t> ThreadPool::configured{0};
+std::atomic<bool> ThreadPool::started{false};
+
+ThreadPool::ThreadPool(size_t workers)
+: workers{workers}, queues{std::make_unique<Queue[]>(workers + 1)}
+{
+	threads.reserve(workers);
+	for (size_t i = 0; i < workers; i++)
+		threads.emplace_back([this, i]() { work(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock{sleep};
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+ThreadPool& ThreadPool::instance()
+{
+	static ThreadPool pool{[]() {
+		started = true;
+		const size_t concurrency = configured ? configured.load() : std::thread::hardware_concurrency();
+		return std::max<size_t>(concurrency, 1) - 1;
+	}()};
+	return pool;
+}
+
+bool ThreadPool::configure(size_t concurrency)
+{
+	configured = concurrency;
+	return !started;
+}
+
+void ThreadPool::run(Job& job)
+{
+	if (job.remaining == 0)
+		return;
+
+	const Object::Sharing sharing;
+	const Collector::Section section;
+	job.heap = &section.heap;
+	job.global = Environment::running();
+	const auto self = current == external ? workers : current;
+
+	pending.fetch_add(job.remaining, std::memory_order_acq_rel);
+	{
+		std::lock_guard lock{queues[self].mutex};
+		for (size_t i = 0; i < job.remaining; i++)
+			queues[self].tasks.push_back({&job, i});
+	}
+	{
+		// a worker about to sleep holds the lock while it checks pending, so it can't miss the notification
+		std::lock_guard lock{sleep};
+	}
+	wake.notify_all();
+
+	while (job.remaining.load(std::memory_order_acquire) > 0) {
+		if (!execute(self))
+			std::this_thread::yield();
+	}
+
+	if (job.exception)
+		std::rethrow_exception(job.exception);
+}
+
+void ThreadPool::work(size_t self)
+{
+	current = self;
+	for (;;) {
+		if (execute(self))
+			continue;
+
+		std::unique_lock lock{sleep};
+		wake.wait(lock, [this]() { return stopping || pending.load(std::memory_order_acquire) > 0; });
+		if (stopping)
+			return;
+	}
+}
+
+bool ThreadPool::execute(size_t self)
+{
+	const auto count = workers + 1;
+
+	Task task;
+	auto found = take(self, true, task);
+	for (size_t i = 1; !found && i < count; i++)
+		found = take((self + i) % count, false, task);
+	if (!found)
+		return false;
+
+	auto& job = *task.job;
+	try {
+		const Collector::Task running{*job.heap};
+		const Environment::Running global{job.global};
+		job.invoke(job.body, task.index);
+	}
+	catch (...) {
+		std::lock_guard lock{job.mutex};
+		if (!job.exception)
+			job.exception = std::current_exception();
+	}
+	job.remaining.fetch_sub(1, std::memory_order_acq_rel);
+	return true;
+}
+
+bool ThreadPool::take(size_t queue, bool back, Task& task)
+{
+	auto& [mutex, tasks] = queues[queue];
+	std::lock_guard lock{mutex};
+	if (tasks.empty())
+		return false;
+
+	if (back) {
+		task = tasks.back();
+		tasks.pop_back();
+	}
+	else {
+		task = tasks.front();
+		tasks.pop_front();
+	}
+	pending.fetch_sub(1, std::memory_order_acq_rel);
+	return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "collector.hpp"
+
+struct Environment;
+
+// a work-stealing thread pool for the parallel builtins (pmap, psort, ...).
+// each worker runs tasks from the back of its own queue and, when that is empty, steals from the front of the others'.
+// a thread waiting for its tasks to finish runs tasks too, so parallel sections can nest.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(size_t workers);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// the pool, started on first use with a worker for each hardware thread but the caller's
+	static ThreadPool& instance();
+
+	// the threads instance() is to start with, instead. false if it has already started
+	static bool configure(size_t concurrency);
+
+	// the threads that run tasks: the workers and the caller
+	size_t concurrency() const noexcept { return workers + 1; }
+
+	// call body(i) for each i in [0, count), concurrently, returning when all calls have returned.
+	// values may be shared between the calls. the first exception thrown by a call is rethrown here.
+	template<typename Body>
+	void run(size_t count, const Body& body)
+	{
+		Job job{[](const void* body, size_t index) { (*static_cast<const Body*>(body))(index); }, &body, count};
+		run(job);
+	}
+
+private:
+	struct Job
+	{
+		Job(void (*invoke)(const void*, size_t), const void* body, size_t count) noexcept
+		: invoke{invoke}, body{body}, remaining{count} {}
+
+		void (*invoke)(const void* body, size_t index);
+		const void* body;
+		std::atomic<size_t> remaining;
+		Collector::Heap* heap = nullptr;	// of the thread that runs the job, which its tasks track closures in
+		const Environment* global = nullptr;	// the program runs over, which its tasks run over too
+
+		std::mutex mutex;
+		std::exception_ptr exception;
+	};
+
+	struct Task
+	{
+		Job* job;
+		size_t index;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void run(Job& job);
+	void work(size_t self);
+
+	// run a task from queue self or, failing that, one stolen from another queue. false if there were none
+	bool execute(size_t self);
+	bool take(size_t queue, bool back, Task& task);
+
+	static std::atomic<size_t> configured;
+	static std::atomic<bool> started;
+
+	static constexpr size_t external = SIZE_MAX;
+	static thread_local size_t current;	// the queue of the current thread, or external
+
+	const size_t workers;	// threads.size(), which the workers can't read while it grows
+	std::unique_ptr<Queue[]> queues;	// one per worker, and the last for threads outside the pool
+	std::vector<std::thread> threads;
+
+	std::atomic<size_t> pending{0};	// tasks queued and not yet taken
+	std::mutex sleep;
+	std::condition_variable wake;
+	bool stopping = false;
+};
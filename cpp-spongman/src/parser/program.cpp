@@ -3,19 +3,37 @@
 #include "lexer.hh"
 #include "statement.hpp"
 #include "builtins.hpp"
+#include "vm.hpp"
 
-Program::Program()
+Program::Program(unsigned passes)
 : global{std::make_shared<Environment>()}
+, optimizer{passes}
 {
 	for (const auto& builtin : BuiltinFunctionExpression::builtins)
 		global->set(builtin.name, Value{BoundFunction{&builtin, {}}});
+	for (const auto& builtin : BuiltinFunctionExpression::library)
+		global->set(builtin.name, Value{BoundFunction{&builtin, {}}});
 	for (const auto& [token, builtin] : BuiltinBinaryFunctionExpression::builtins)
 		global->set(builtin->name, Value{BoundFunction{builtin, {}}});
 }
 
-ProgramP Program::parse(Lexer& lexer)
+Program::Program(PreludeP prelude, unsigned passes)
+: prelude{std::move(prelude)}
+, global{std::make_shared<Environment>(this->prelude->program->global)}
+, optimizer{passes}
 {
-	auto program = std::make_unique<Program>();
+}
+
+Program::Program(PreludeP prelude, EnvironmentP global, Optimizer optimizer)
+: prelude{std::move(prelude)}
+, global{std::move(global)}
+, optimizer{optimizer}
+{
+}
+
+ProgramP Program::parse(Lexer& lexer, unsigned passes)
+{
+	auto program = std::make_unique<Program>(passes);
 	program->add(lexer);
 	return program;
 }
@@ -25,28 +43,57 @@ void Program::add(Lexer& lexer)
 	while (!lexer.eof()) {
 		auto statement = Statement::parseStatement(lexer);
 		if (statement) {
+			Scope::resolve(*statement);
+			optimizer.optimize(statement);
 			statements.push_back(std::move(statement));
 			lexer.get(TokenType::Semicolon);
 		}
 	}
 }
 
-Value Program::run()
+ProgramP Program::fork()
 {
-	return eval(global);
+	// the fork's calls mustn't inline this program's functions, whose globals are looked up here
+	return ProgramP{new Program{prelude, global->fork(), optimizer.restarted()}};
 }
 
-Value Program::eval(EnvironmentP env) const
+Value Program::run(Engine engine)
 {
-	try {
-		Value value;
-		for (const auto& statement : statements)
-			value = statement->eval(env);
-		return value;
-	}
-	catch (Value& value) {
-		return std::move(value);
+	const Environment::Running running{global.get()};
+	if (engine == Engine::Vm)
+		return VM{}.run(statements, global);
+	return eval(*global);
+}
+
+PreludeP Prelude::seal(ProgramP program, Engine engine)
+{
+	auto prelude = std::make_shared<Prelude>();
+	prelude->result = program->run(engine);
+	prelude->program = std::move(program);
+	prelude->program->global->seal();
+	return prelude;
+}
+
+Prelude::~Prelude()
+{
+	// no program runs over the globals any more, so cycles through them can be collected
+	if (program)
+		program->global->seal(false);
+}
+
+Value Program::eval(Environment& env) const
+{
+	Value value;
+	for (const auto& statement : statements) {
+		value = statement->eval(env);
+		if (value.abrupt())
+			break;
 	}
+
+	// a return at the top level ends the program
+	if (value.completion() == Completion::Return)
+		value.setCompletion(Completion::Normal);
+	return value;
 }
 
 void Program::print(std::ostream& os) const
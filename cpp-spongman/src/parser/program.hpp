@@ -3,24 +3,63 @@
 #include <vector>
 
 #include "statement.hpp"
+#include "optimizer.hpp"
 
 struct Program;
 using ProgramP = std::unique_ptr<Program>;
 
+struct Prelude;
+using PreludeP = std::shared_ptr<const Prelude>;
+
+enum class Engine
+{
+	Ast,	// walk the expression tree
+	Vm,	// compile to bytecode and run on the stack vm
+};
+
 class Lexer;
 struct Program : Expression
 {
-	Program();
-	static ProgramP parse(Lexer& lexer);
+	explicit Program(unsigned passes = Optimizer::levels[1]);
+	// a program whose globals are looked up in its own environment, then the prelude's
+	explicit Program(PreludeP prelude, unsigned passes = Optimizer::levels[1]);
+	static ProgramP parse(Lexer& lexer, unsigned passes = Optimizer::levels[1]);
 	void add(Lexer& lexer);
 
-	Value run();
+	// a program over a fork of this one's globals, made in constant time, which it can add to and run
+	// without changing this one. this program must outlive it: its functions may be bound in the fork
+	ProgramP fork();
+
+	Value run(Engine engine = Engine::Ast);
 
-	Value eval(EnvironmentP env) const override;
+	void resolve(Scope& scope) override;
+	Value eval(Environment& env) const override;
+	void compile(Compiler& compiler) const override;
 	void print(std::ostream& str) const override;
 
 	std::vector<StatementP> statements;
+	PreludeP prelude;	// outlives global, which may refer to its values
 	std::shared_ptr<Environment> global;
+	Optimizer optimizer;
+
+private:
+	Program(PreludeP prelude, EnvironmentP global, Optimizer optimizer);
+};
+
+// a program that has been run, with its globals sealed: programs on any number of threads can run over them,
+// without evaluating it again, and without locking to look them up.
+// values are shared between threads for as long as a prelude is alive (see Object::Sharing).
+struct Prelude
+{
+	// run program, which is sealed even if it failed
+	static PreludeP seal(ProgramP program, Engine engine = Engine::Ast);
+	~Prelude();
+
+	const Object::Sharing sharing;
+	ProgramP program;	// owns the functions the globals are bound to
+	Value result;	// the value of the program, or the error it failed with
+
+	std::shared_ptr<const Environment> global() const noexcept { return program->global; }
 };
 
 std::ostream& operator<<(std::ostream& os, const Program& program);
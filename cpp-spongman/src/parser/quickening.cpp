@@ -0,0 +1,239 @@
+#include <functional>
+
+#include "quickening.hpp"
+#include "expression.hpp"
+#include "builtins.hpp"
+
+
+namespace
+{
+	template<typename Op>
+	Value integers(const Value& left, const Value& right)
+	{
+		return Value{Op{}(left.get<Integer>(), right.get<Integer>())};
+	}
+
+	template<typename Op>
+	Value booleans(const Value& left, const Value& right)
+	{
+		return Value{Op{}(left.get<bool>(), right.get<bool>())};
+	}
+}
+
+
+// Feedback
+
+Feedback::Shape Feedback::shape(const Value& value) noexcept
+{
+	switch (value.type()) {
+		case ValueType::Integer: return Integers;
+		case ValueType::String:  return Strings;
+		case ValueType::Bool:    return Booleans;
+		case ValueType::Array:   return Arrays;
+		default:                 return Other;
+	}
+}
+
+Feedback::Shape Feedback::shape(const Value& left, const Value& right) noexcept
+{
+	return left.type() == right.type() ? shape(left) : Other;
+}
+
+
+// BinaryExpression
+
+Value BinaryExpression::eval(Environment& env) const
+{
+	const auto leftValue = left->eval(env);
+	if (leftValue.abrupt())
+		return leftValue;
+	const auto rightValue = right->eval(env);
+	if (rightValue.abrupt())
+		return rightValue;
+
+	const auto type = leftValue.type();
+	const bool integer = type == ValueType::Integer && rightValue.is<Integer>();
+	const bool boolean = type == ValueType::Bool && rightValue.is<bool>();
+
+	switch (quickened.load(std::memory_order_relaxed)) {
+		case Quickened::Uninitialized:
+			return profile(leftValue, rightValue);
+		case Quickened::Generic:
+			return fn.call(leftValue, rightValue);
+
+		case Quickened::IntAdd:      if (integer) return integers<std::plus<Integer>>(leftValue, rightValue);          break;
+		case Quickened::IntSubtract: if (integer) return integers<std::minus<Integer>>(leftValue, rightValue);         break;
+		case Quickened::IntMultiply: if (integer) return integers<std::multiplies<Integer>>(leftValue, rightValue);    break;
+		case Quickened::IntBitAnd:   if (integer) return integers<std::bit_and<Integer>>(leftValue, rightValue);       break;
+		case Quickened::IntBitOr:    if (integer) return integers<std::bit_or<Integer>>(leftValue, rightValue);        break;
+		case Quickened::IntBitEor:   if (integer) return integers<std::bit_xor<Integer>>(leftValue, rightValue);       break;
+		case Quickened::IntLt:       if (integer) return integers<std::less<Integer>>(leftValue, rightValue);          break;
+		case Quickened::IntGt:       if (integer) return integers<std::greater<Integer>>(leftValue, rightValue);       break;
+		case Quickened::IntLe:       if (integer) return integers<std::less_equal<Integer>>(leftValue, rightValue);    break;
+		case Quickened::IntGe:       if (integer) return integers<std::greater_equal<Integer>>(leftValue, rightValue); break;
+		case Quickened::IntEq:       if (integer) return integers<std::equal_to<Integer>>(leftValue, rightValue);      break;
+		case Quickened::IntNeq:      if (integer) return integers<std::not_equal_to<Integer>>(leftValue, rightValue);  break;
+
+		case Quickened::StringConcat:
+			if (type == ValueType::String && rightValue.is<String>())
+				return Value{leftValue.get<String>() + rightValue.get<String>()};
+			break;
+
+		case Quickened::BoolAnd:     if (boolean) return booleans<std::logical_and<bool>>(leftValue, rightValue);     break;
+		case Quickened::BoolOr:      if (boolean) return booleans<std::logical_or<bool>>(leftValue, rightValue);      break;
+		case Quickened::BoolEq:      if (boolean) return booleans<std::equal_to<bool>>(leftValue, rightValue);        break;
+		case Quickened::BoolNeq:     if (boolean) return booleans<std::not_equal_to<bool>>(leftValue, rightValue);    break;
+	}
+	return deoptimize(leftValue, rightValue);
+}
+
+Value BinaryExpression::profile(const Value& leftValue, const Value& rightValue) const
+{
+	if (const auto shapes = feedback.record(Feedback::shape(leftValue, rightValue)))
+		quickened.store(specialize(shapes), std::memory_order_relaxed);
+	return fn.call(leftValue, rightValue);
+}
+
+BinaryExpression::Quickened BinaryExpression::specialize(uint8_t shapes) const
+{
+	using B = BuiltinBinaryFunctionExpression;
+
+	switch (shapes) {
+		case Feedback::Integers:
+			if (&fn == &B::plus)     return Quickened::IntAdd;
+			if (&fn == &B::minus)    return Quickened::IntSubtract;
+			if (&fn == &B::asterisk) return Quickened::IntMultiply;
+			if (&fn == &B::bitAnd)   return Quickened::IntBitAnd;
+			if (&fn == &B::bitOr)    return Quickened::IntBitOr;
+			if (&fn == &B::bitEor)   return Quickened::IntBitEor;
+			if (&fn == &B::lt)       return Quickened::IntLt;
+			if (&fn == &B::gt)       return Quickened::IntGt;
+			if (&fn == &B::le)       return Quickened::IntLe;
+			if (&fn == &B::ge)       return Quickened::IntGe;
+			if (&fn == &B::eq)       return Quickened::IntEq;
+			if (&fn == &B::neq)      return Quickened::IntNeq;
+			break;
+		case Feedback::Strings:
+			if (&fn == &B::plus)     return Quickened::StringConcat;
+			break;
+		case Feedback::Booleans:
+			if (&fn == &B::and_)     return Quickened::BoolAnd;
+			if (&fn == &B::or_)      return Quickened::BoolOr;
+			if (&fn == &B::eq)       return Quickened::BoolEq;
+			if (&fn == &B::neq)      return Quickened::BoolNeq;
+			break;
+	}
+	// division and modulo stay generic, as does anything polymorphic
+	return Quickened::Generic;
+}
+
+Value BinaryExpression::deoptimize(const Value& leftValue, const Value& rightValue) const
+{
+	quickened.store(Quickened::Generic, std::memory_order_relaxed);
+	return fn.call(leftValue, rightValue);
+}
+
+
+// UnaryExpression
+
+Value UnaryExpression::eval(Environment& env) const
+{
+	const auto evaluatedValue = value->eval(env);
+	if (evaluatedValue.abrupt())
+		return evaluatedValue;
+
+	switch (quickened.load(std::memory_order_relaxed)) {
+		case Quickened::Uninitialized:
+			return profile(evaluatedValue);
+		case Quickened::Generic:
+			return apply(op, evaluatedValue);
+
+		case Quickened::IntNegate:
+			if (evaluatedValue.is<Integer>())
+				return Value{-evaluatedValue.get<Integer>()};
+			break;
+		case Quickened::IntComplement:
+			if (evaluatedValue.is<Integer>())
+				return Value{~evaluatedValue.get<Integer>()};
+			break;
+		case Quickened::BoolNot:
+			if (evaluatedValue.is<bool>())
+				return Value{!evaluatedValue.get<bool>()};
+			break;
+	}
+	return deoptimize(evaluatedValue);
+}
+
+Value UnaryExpression::profile(const Value& evaluatedValue) const
+{
+	if (const auto shapes = feedback.record(Feedback::shape(evaluatedValue)))
+		quickened.store(specialize(shapes), std::memory_order_relaxed);
+	return apply(op, evaluatedValue);
+}
+
+UnaryExpression::Quickened UnaryExpression::specialize(uint8_t shapes) const
+{
+	if (shapes == Feedback::Integers && op == TokenType::Minus)
+		return Quickened::IntNegate;
+	if (shapes == Feedback::Integers && op == TokenType::Tilde)
+		return Quickened::IntComplement;
+	if (shapes == Feedback::Booleans && op == TokenType::Bang)
+		return Quickened::BoolNot;
+	return Quickened::Generic;
+}
+
+Value UnaryExpression::deoptimize(const Value& evaluatedValue) const
+{
+	quickened.store(Quickened::Generic, std::memory_order_relaxed);
+	return apply(op, evaluatedValue);
+}
+
+
+// IndexExpression
+
+Value IndexExpression::eval(Environment& env) const
+{
+	const auto container = array->eval(env);
+	if (container.abrupt())
+		return container;
+	const auto evaluatedIndex = index->eval(env);
+	if (evaluatedIndex.abrupt())
+		return evaluatedIndex;
+
+	switch (quickened.load(std::memory_order_relaxed)) {
+		case Quickened::Uninitialized:
+			return profile(container, evaluatedIndex);
+		case Quickened::Generic:
+			return lookup(container, evaluatedIndex);
+
+		case Quickened::ArrayElement:
+			if (container.is<Array>() && evaluatedIndex.is<Integer>()) {
+				const auto& elements = container.get<Array>();
+				const auto i = evaluatedIndex.get<Integer>();
+				if (i < 0 || i >= static_cast<Integer>(elements.size()))
+					return {};
+				return elements[i];
+			}
+			break;
+	}
+	return deoptimize(container, evaluatedIndex);
+}
+
+Value IndexExpression::profile(const Value& container, const Value& evaluatedIndex) const
+{
+	const auto shape = evaluatedIndex.is<Integer>() ? Feedback::shape(container) : Feedback::Other;
+	if (const auto shapes = feedback.record(shape))
+		quickened.store(specialize(shapes), std::memory_order_relaxed);
+	return lookup(container, evaluatedIndex);
+}
+
+IndexExpression::Quickened IndexExpression::specialize(uint8_t shapes) const
+{
+	return shapes == Feedback::Arrays ? Quickened::ArrayElement : Quickened::Generic;
+}
+
+Value IndexExpression::deoptimize(const Value& container, const Value& evaluatedIndex) const
+{
+	quickened.store(Quickened::Generic, std::memory_order_relaxed);
+	return lookup(container, evaluatedIndex);
+}
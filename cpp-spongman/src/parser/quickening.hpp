@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "value.hpp"
+
+// type feedback for self-specializing nodes.
+// a node evaluates generically for its first few evaluations, recording the shape of its operands, then
+// quickens: it rewrites itself into a specialization for the single shape it has seen (IntAdd, StringConcat, ...).
+// a specialization guards on that shape, and on a miss deoptimizes the node back to the generic path for good.
+struct Feedback
+{
+	enum Shape : uint8_t
+	{
+		Integers = 1 << 0,
+		Strings  = 1 << 1,
+		Booleans = 1 << 2,
+		Arrays   = 1 << 3,
+		Other    = 1 << 7,
+	};
+
+	// evaluations before a node quickens
+	static constexpr uint8_t warmup = 4;
+
+	static Shape shape(const Value& value) noexcept;
+	static Shape shape(const Value& left, const Value& right) noexcept;
+
+	// record the shape of one evaluation. once warmed up, the shapes seen so far, otherwise 0.
+	// nodes may be shared between threads, so feedback is only ever approximately counted.
+	uint8_t record(Shape shape) noexcept
+	{
+		const uint8_t seen = shapes.fetch_or(shape, std::memory_order_relaxed) | shape;
+		if (evaluations.fetch_add(1, std::memory_order_relaxed) + 1 != warmup)
+			return 0;
+		return seen;
+	}
+
+private:
+	std::atomic<uint8_t> shapes{0};
+	std::atomic<uint8_t> evaluations{0};
+};
@@ -0,0 +1,365 @@
+#include <algorithm>
+
+#include "scope.hpp"
+#include "expression.hpp"
+#include "statement.hpp"
+#include "program.hpp"
+
+
+void Scope::resolve(Expression& statement)
+{
+	Scope scope;
+	statement.resolve(scope);
+	scope.close();
+}
+
+size_t Scope::parameter(std::string_view name)
+{
+	names.push_back(name);
+	declared.push_back(0);
+	assigned.push_back(0);
+	return names.size() - 1;
+}
+
+size_t Scope::declare(std::string_view name, const Expression* value)
+{
+	if (!parent)
+		return global;
+
+	auto slot = find(name);
+	if (slot == global) {
+		slot = parameter(name);
+		declared[slot] = time + 1;
+	}
+	assigned[slot] = ++time;
+
+	// a function let to a name may refer to itself by it
+	if (value && !scopes.empty() && value == scopes.back().function) {
+		scopes.back().self = slot;
+		scopes.back().named = time;
+	}
+	return slot;
+}
+
+void Scope::reference(IdentifierExpression& identifier)
+{
+	references.push_back({identifier.name(), &identifier, time});
+}
+
+Scope& Scope::open(FunctionExpression& function)
+{
+	auto& scope = scopes.emplace_back(this, &function);
+	scope.made = ++time;
+	return scope;
+}
+
+void Scope::refer(std::string_view name)
+{
+	references.push_back({name, nullptr, time});
+}
+
+Scope& Scope::reopen(Scope& top, const std::vector<Layout>& enclosing, FunctionExpression& function, const std::vector<std::string>& captures)
+{
+	auto* scope = &top;
+	scope->laid = true;
+	for (const auto& layout : enclosing) {
+		scope = &scope->scopes.emplace_back(scope);
+		for (const auto& name : layout.names)
+			scope->parameter(name);
+		scope->captures.assign(layout.captures.begin(), layout.captures.end());
+		scope->flat = layout.flat;
+		scope->laid = true;
+		scope->deepen();
+	}
+
+	auto& locals = scope->open(function);
+	locals.captures.assign(captures.begin(), captures.end());
+	locals.flat = function.flat;
+	locals.laid = true;
+	locals.deepen();
+	return locals;
+}
+
+void Scope::close()
+{
+	collect();
+	for (auto& scope : scopes)
+		lay(scope);
+	bind();
+}
+
+// later parameters shadow earlier ones of the same name
+size_t Scope::find(std::string_view name) const noexcept
+{
+	for (auto slot = names.size(); slot-- > 0; ) {
+		if (names[slot] == name)
+			return slot;
+	}
+	return global;
+}
+
+size_t Scope::find(std::string_view name, size_t time) const noexcept
+{
+	for (auto slot = names.size(); slot-- > 0; ) {
+		if (names[slot] == name)
+			return declared[slot] <= time ? slot : global;
+	}
+	return global;
+}
+
+size_t Scope::capture(std::string_view name) const noexcept
+{
+	const auto iter = std::find(captures.begin(), captures.end(), name);
+	return iter == captures.end() ? global : iter - captures.begin();
+}
+
+void Scope::collect()
+{
+	const auto note = [this](std::string_view name) {
+		if (find(name) == global && std::find(free.begin(), free.end(), name) == free.end())
+			free.push_back(name);
+	};
+
+	for (auto& scope : scopes) {
+		scope.collect();
+		for (const auto name : scope.free)
+			note(name);
+	}
+	for (const auto& reference : references) {
+		if (find(reference.name, reference.time) == global && std::find(free.begin(), free.end(), reference.name) == free.end())
+			free.push_back(reference.name);
+	}
+}
+
+void Scope::lay(Scope& scope)
+{
+	if (!scope.laid) {
+		scope.laid = true;
+
+		// what it refers to of the enclosing functions'
+		for (const auto name : scope.free) {
+			for (auto* enclosing = this; enclosing->parent; enclosing = enclosing->parent) {
+				if (enclosing->find(name) != global) {
+					scope.captures.push_back(name);
+					break;
+				}
+			}
+		}
+
+		// copied when it's made, the captures mustn't be assigned afterwards: a function let to a name
+		// is assigned to it afterwards, and captures itself
+		for (const auto name : scope.captures) {
+			const auto slot = find(name);
+			if (slot == global)
+				scope.flat = scope.flat && flat;
+			else if (assigned[slot] > scope.made && !(slot == scope.self && assigned[slot] == scope.named))
+				scope.flat = false;
+		}
+		if (!scope.flat)
+			scope.captures.clear();
+		scope.deepen();
+
+		auto& function = *scope.function;
+		function.flat = scope.flat;
+		function.enclosing = depth;
+		function.captures.clear();
+		for (const auto name : scope.captures) {
+			if (const auto slot = find(name); slot == global)
+				function.captures.push_back({1, capture(name)});
+			else
+				function.captures.push_back({0, slot == scope.self ? global : slot});
+		}
+
+		// its body is resolved later, in the scopes as they are now
+		if (function.deferred()) {
+			auto& source = *function.source;
+			source.captured.assign(scope.captures.begin(), scope.captures.end());
+			source.enclosing.clear();
+			for (auto* enclosing = this; enclosing->parent; enclosing = enclosing->parent) {
+				source.enclosing.insert(source.enclosing.begin(), {
+					{enclosing->names.begin(), enclosing->names.end()},
+					{enclosing->captures.begin(), enclosing->captures.end()},
+					enclosing->flat
+				});
+			}
+		}
+	}
+
+	for (auto& nested : scope.scopes)
+		scope.lay(nested);
+}
+
+void Scope::deepen() noexcept
+{
+	depth = flat ? (captures.empty() ? 1 : 2) : parent->depth + 1;
+}
+
+// a reference is to the first scope out that declares the name (its own, once the let has been made), through
+// the frames of those it passes, or to the captures of the first flat one, or else to a global
+void Scope::bind()
+{
+	for (const auto& [name, identifier, time] : references) {
+		if (!identifier)
+			continue;
+
+		size_t up = 0;
+		for (const auto* scope = this; ; scope = scope->parent, up++) {
+			if (!scope->parent) {
+				identifier->bind(up, global);
+				break;
+			}
+			if (const auto slot = up == 0 ? scope->find(name, time) : scope->find(name); slot != global) {
+				identifier->bind(up, slot);
+				break;
+			}
+			if (scope->flat) {
+				if (const auto slot = scope->capture(name); slot != global)
+					identifier->bind(up + 1, slot);
+				else
+					identifier->bind(up + scope->depth, global);
+				break;
+			}
+		}
+	}
+	references.clear();
+
+	for (auto& scope : scopes)
+		scope.bind();
+}
+
+
+// Expressions
+
+void BinaryExpression::resolve(Scope& scope)
+{
+	left->resolve(scope);
+	right->resolve(scope);
+}
+
+void UnaryExpression::resolve(Scope& scope)
+{
+	value->resolve(scope);
+}
+
+void CallExpression::resolve(Scope& scope)
+{
+	function->resolve(scope);
+	for (const auto& argument : arguments)
+		argument->resolve(scope);
+}
+
+void AbstractFunctionExpression::resolve(Scope& scope)
+{
+}
+
+// created by the optimizer, from expressions already resolved
+void InlinedCallExpression::resolve(Scope& scope)
+{
+}
+
+void FunctionExpression::resolve(Scope& scope)
+{
+	auto& locals = scope.open(*this);
+	if (!deferred()) {
+		resolveBody(locals);
+		return;
+	}
+
+	for (const auto& parameter : parameters)
+		locals.parameter(parameter);
+	for (const auto& identifier : source->identifiers)
+		locals.refer(identifier);
+}
+
+void FunctionExpression::resolveBody(Scope& locals)
+{
+	for (const auto& parameter : parameters)
+		locals.parameter(parameter);
+	body->resolve(locals);
+	slots = locals.size();
+}
+
+// a body parsed on the first call is resolved in scopes laid out as the enclosing ones were
+void FunctionExpression::resolveDeferred()
+{
+	Scope top;
+	resolveBody(Scope::reopen(top, source->enclosing, *this, source->captured));
+	top.close();
+}
+
+void IdentifierExpression::resolve(Scope& scope)
+{
+	scope.reference(*this);
+}
+
+void IdentifierExpression::bind(size_t depth, size_t slot) noexcept
+{
+	this->depth = depth;
+	this->slot = slot;
+}
+
+void IntegerLiteralExpression::resolve(Scope& scope)
+{
+}
+
+void BooleanLiteralExpression::resolve(Scope& scope)
+{
+}
+
+void StringLiteralExpression::resolve(Scope& scope)
+{
+}
+
+void ArrayLiteralExpression::resolve(Scope& scope)
+{
+	for (const auto& element : elements)
+		element->resolve(scope);
+}
+
+void IndexExpression::resolve(Scope& scope)
+{
+	array->resolve(scope);
+	index->resolve(scope);
+}
+
+void HashLiteralExpression::resolve(Scope& scope)
+{
+	for (const auto& [key, value] : elements) {
+		key->resolve(scope);
+		value->resolve(scope);
+	}
+}
+
+
+// Statements
+
+void LetStatement::resolve(Scope& scope)
+{
+	value->resolve(scope);
+	slot = scope.declare(name, value.get());
+}
+
+void ReturnStatement::resolve(Scope& scope)
+{
+	value->resolve(scope);
+}
+
+void IfStatement::resolve(Scope& scope)
+{
+	condition->resolve(scope);
+	consequence->resolve(scope);
+	if (alternative)
+		alternative->resolve(scope);
+}
+
+void StatementList::resolve(Scope& scope)
+{
+	for (const auto& statement : statements)
+		statement->resolve(scope);
+}
+
+void Program::resolve(Scope& scope)
+{
+	for (const auto& statement : statements)
+		statement->resolve(scope);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Expression;
+struct IdentifierExpression;
+struct FunctionExpression;
+
+// lexical scope of a function body during resolution.
+// every parameter and let of a function gets a slot in its frame; names that no enclosing function declares
+// are globals, and are still looked up by name so the repl can add them at any time.
+// a function is flat if the bindings of enclosing functions it refers to can't change once it's made: its closure
+// copies just those (its captures), so the frame it's made in can go when that call returns. a function that
+// captures nothing is bound to the global environment. one that refers to a binding a later let may change
+// is bound to the frame it's made in, and reaches its captures through that.
+struct Scope
+{
+	// slot of a name that lives in the global environment
+	static constexpr size_t global = SIZE_MAX;
+
+	// the layout of a scope closed before this one, as kept by a deferred function (see resolveDeferred)
+	struct Layout
+	{
+		std::vector<std::string> names;
+		std::vector<std::string> captures;
+		bool flat;
+	};
+
+	explicit Scope(Scope* parent = nullptr, FunctionExpression* function = nullptr)
+	: parent{parent}, function{function} {}
+
+	// resolve a top-level statement
+	static void resolve(Expression& statement);
+
+	size_t parameter(std::string_view name);
+	// a let of value
+	size_t declare(std::string_view name, const Expression* value = nullptr);
+	void reference(IdentifierExpression& identifier);
+
+	// the scope of the body of a function made in this one
+	Scope& open(FunctionExpression& function);
+	// a function whose body hasn't been parsed refers to names it may have, which it captures if they're enclosing ones
+	void refer(std::string_view name);
+
+	// the scope of a function whose body is resolved after the scopes enclosing it closed, under top as
+	// they were laid out then. its captures are given: it was made before its body was seen
+	static Scope& reopen(Scope& top, const std::vector<Layout>& enclosing, FunctionExpression& function, const std::vector<std::string>& captures);
+
+	// lay out the functions made in this scope, and bind the references made in it and them. a let may be
+	// made after a function that refers to it, so this is done once the whole top-level statement has been
+	// seen. a reference made in the body itself before a let reads the name from outside
+	void close();
+
+	size_t size() const noexcept { return names.size(); }
+
+private:
+	struct Reference
+	{
+		std::string_view name;
+		IdentifierExpression* identifier;	// or nullptr for a name a deferred function may refer to
+		size_t time;	// of the lets and functions made before it
+	};
+
+	size_t find(std::string_view name) const noexcept;
+	// the slot of a name a reference made at time reads: a let that follows it hasn't been made yet
+	size_t find(std::string_view name, size_t time) const noexcept;
+	size_t capture(std::string_view name) const noexcept;
+
+	// the names this scope, and those it opened, refer to that it doesn't declare
+	void collect();
+	// decide how closures of the function of the scope opened in this one are made
+	void lay(Scope& scope);
+	// the depth of the global environment, once the scope is laid out
+	void deepen() noexcept;
+	void bind();
+
+	Scope* parent;
+	FunctionExpression* function;	// whose body this is, or nullptr at the top level
+	std::vector<std::string_view> names;
+	std::vector<size_t> declared;	// the time each slot was first assigned at
+	std::vector<size_t> assigned;	// the time each slot was last assigned at
+	std::vector<Reference> references;
+	std::list<Scope> scopes;	// of the functions made in this one
+	size_t time = 0;	// of the lets and functions made so far
+
+	// as a function made in the parent
+	size_t made = 0;	// the time it was made at
+	size_t self = global;	// the slot of the let it's the value of
+	size_t named = 0;	// the time of that let
+
+	// what close() decides
+	std::vector<std::string_view> free;
+	std::vector<std::string_view> captures;	// of a flat function
+	bool flat = true;
+	bool laid = false;
+	size_t depth = 0;	// of the global environment from a frame of the scope
+};
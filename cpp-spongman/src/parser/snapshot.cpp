@@ -0,0 +1,918 @@
+#include <fstream>
+#include <cstdio>
+#include <stdexcept>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.hpp"
+#include "environment.hpp"
+#include "expression.hpp"
+#include "statement.hpp"
+#include "builtins.hpp"
+#include "collector.hpp"
+#include "memo.hpp"
+
+
+namespace
+{
+	constexpr char magic[8] = { 'm', 'o', 'n', 'k', 'e', 'y', 's', 's' };
+	constexpr uint32_t format = 4;
+
+	// magic, format, the checksum of what follows it, then the offsets of the binding, function and frame tables
+	constexpr size_t checksumOffset = sizeof(magic) + sizeof(uint32_t);
+	constexpr size_t tablesOffset = checksumOffset + sizeof(uint32_t);
+	constexpr size_t headerSize = tablesOffset + 3 * sizeof(uint32_t);
+
+	// a binding is the offset and length of its name, and the offset of its value
+	constexpr size_t bindingSize = 3 * sizeof(uint32_t);
+
+	enum class Tag : uint8_t
+	{
+		Null,
+		False,
+		True,
+		Integer,
+		String,
+		Array,
+		Hash,
+		Builtin,	// by name
+		Closure,	// a function, and 0 for the global environment or the number of a frame + 1
+		Memo,	// the function memoized, whose results aren't kept
+	};
+
+	[[noreturn]] void corrupt()
+	{
+		throw std::runtime_error("corrupt snapshot");
+	}
+
+	// fnv-1a of bytes, folded to 32 bits
+	uint32_t checksum(std::string_view bytes)
+	{
+		uint64_t h = 0xcbf29ce484222325;
+		for (const auto byte : bytes)
+			h = (h ^ static_cast<uint8_t>(byte)) * 0x100000001b3;
+		return static_cast<uint32_t>(h ^ h >> 32);
+	}
+
+	// the builtin called name
+	const AbstractFunctionExpression* builtin(std::string_view name)
+	{
+		for (const auto& builtin : BuiltinFunctionExpression::builtins) {
+			if (builtin.name == name)
+				return &builtin;
+		}
+		for (const auto& builtin : BuiltinFunctionExpression::library) {
+			if (builtin.name == name)
+				return &builtin;
+		}
+		for (const auto& [token, builtin] : BuiltinBinaryFunctionExpression::builtins) {
+			if (builtin->name == name)
+				return builtin;
+		}
+		return nullptr;
+	}
+
+	const BuiltinBinaryFunctionExpression& binary(std::string_view name)
+	{
+		for (const auto& [token, builtin] : BuiltinBinaryFunctionExpression::builtins) {
+			if (builtin->name == name)
+				return *builtin;
+		}
+		corrupt();
+	}
+
+	template<typename T>
+	std::unique_ptr<T> expect(ExpressionP expression)
+	{
+		auto* node = dynamic_cast<T*>(expression.get());
+		if (!node)
+			corrupt();
+		expression.release();
+		return std::unique_ptr<T>{node};
+	}
+}
+
+
+// Snapshot
+
+void Snapshot::save(const std::string& path, const Environment& env)
+{
+	SnapshotWriter writer{env};
+	writer.image.resize(headerSize);
+
+	// the values, then the names in the order of the table
+	const auto bindings = env.bindings();
+	std::vector<uint32_t> offsets;
+	for (const auto& [name, value] : bindings) {
+		offsets.push_back(writer.image.size());
+		writer.value(value);
+	}
+	std::vector<uint32_t> names;
+	for (const auto& [name, value] : bindings) {
+		names.push_back(writer.image.size());
+		writer.image += name;
+	}
+	const auto [functionTable, frameTable] = writer.finish();
+
+	const auto bindingTable = writer.image.size();
+	writer.u32(bindings.size());
+	size_t i = 0;
+	for (const auto& [name, value] : bindings) {
+		writer.u32(names[i]);
+		writer.u32(name.size());
+		writer.u32(offsets[i++]);
+	}
+	if (writer.image.size() > UINT32_MAX)
+		throw std::runtime_error("snapshot too large");
+
+	std::memcpy(writer.image.data(), magic, sizeof(magic));
+	writer.patch(sizeof(magic), format);
+	writer.patch(tablesOffset, bindingTable);
+	writer.patch(tablesOffset + sizeof(uint32_t), functionTable);
+	writer.patch(tablesOffset + 2 * sizeof(uint32_t), frameTable);
+	writer.patch(checksumOffset, checksum(std::string_view{writer.image}.substr(tablesOffset)));
+
+	// written aside and renamed over path, as the image at path may be mapped, by the environment being saved
+	const auto written = path + ".tmp";
+	{
+		std::ofstream ofs{written, std::ios::binary};
+		ofs.write(writer.image.data(), writer.image.size());
+		if (!ofs.flush()) {
+			std::remove(written.c_str());
+			throw std::runtime_error("could not write snapshot: " + path);
+		}
+	}
+	if (std::rename(written.c_str(), path.c_str()) != 0) {
+		std::remove(written.c_str());
+		throw std::runtime_error("could not write snapshot: " + path);
+	}
+}
+
+std::shared_ptr<Snapshot> Snapshot::open(const std::string& path)
+{
+	const auto fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("could not open snapshot: " + path);
+
+	struct stat status{};
+	void* mapping = MAP_FAILED;
+	if (::fstat(fd, &status) == 0 && status.st_size > 0)
+		mapping = ::mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mapping == MAP_FAILED)
+		throw std::runtime_error("could not map snapshot: " + path);
+
+	return std::shared_ptr<Snapshot>{new Snapshot{static_cast<const char*>(mapping), static_cast<size_t>(status.st_size)}};
+}
+
+Snapshot::Snapshot(const char* image, size_t size)
+: image{image}, size{size}
+{
+	if (size < headerSize || std::memcmp(image, magic, sizeof(magic)) != 0) {
+		::munmap(const_cast<char*>(image), size);
+		throw std::runtime_error("not a snapshot");
+	}
+	try {
+		if (u32(sizeof(magic)) != format)
+			throw std::runtime_error("snapshot of another format");
+		if (u32(checksumOffset) != checksum(std::string_view{image, size}.substr(tablesOffset)))
+			corrupt();
+		bindingTable = u32(tablesOffset);
+		functionTable = u32(tablesOffset + sizeof(uint32_t));
+		frameTable = u32(tablesOffset + 2 * sizeof(uint32_t));
+
+		// the tables, and what their entries point to, within the image, so lookups can't read past it
+		const auto count = table(bindingTable, bindingSize);
+		for (uint32_t i = 0; i < count; i++) {
+			const auto binding = entry(bindingTable, i, bindingSize);
+			const auto nameOffset = u32(binding);
+			if (nameOffset > size || u32(binding + sizeof(uint32_t)) > size - nameOffset || u32(binding + 2 * sizeof(uint32_t)) >= size)
+				corrupt();
+		}
+		for (const auto offsets : { functionTable, frameTable }) {
+			const auto count = table(offsets, sizeof(uint32_t));
+			for (uint32_t i = 0; i < count; i++) {
+				if (u32(entry(offsets, i, sizeof(uint32_t))) >= size)
+					corrupt();
+			}
+		}
+		bindings = std::make_unique<std::atomic<const Value*>[]>(count);
+	}
+	catch (...) {
+		::munmap(const_cast<char*>(image), size);
+		throw;
+	}
+}
+
+Snapshot::~Snapshot()
+{
+	::munmap(const_cast<char*>(image), size);
+}
+
+void Snapshot::restore(const EnvironmentP& env)
+{
+	std::lock_guard lock{mutex};
+	global = env;
+}
+
+const Value* Snapshot::find(std::string_view name)
+{
+	const auto index = lookup(name);
+	if (index == missing)
+		return nullptr;
+	if (const auto* value = bindings[index].load(std::memory_order_acquire))
+		return value;
+
+	std::lock_guard lock{mutex};
+	return decode(index);
+}
+
+void Snapshot::decode(string_map<Value>& bindings)
+{
+	std::lock_guard lock{mutex};
+	const auto count = u32(bindingTable);
+	for (uint32_t i = 0; i < count; i++) {
+		const auto binding = entry(bindingTable, i, bindingSize);
+		const std::string_view name{image + u32(binding), u32(binding + sizeof(uint32_t))};
+		if (bindings.contains(name))
+			continue;
+
+		bindings.emplace(name, *decode(i));
+	}
+}
+
+size_t Snapshot::decoded() const
+{
+	std::lock_guard lock{mutex};
+	return values.size();
+}
+
+const Value* Snapshot::decode(uint32_t index)
+{
+	if (const auto* value = bindings[index].load(std::memory_order_relaxed))
+		return value;
+
+	const auto binding = entry(bindingTable, index, bindingSize);
+	const std::string_view name{image + u32(binding), u32(binding + sizeof(uint32_t))};
+	auto decoded = SnapshotReader{*this, u32(binding + 2 * sizeof(uint32_t))}.value();
+	const auto* value = &values.emplace(std::string{name}, std::move(decoded)).first->second;
+	bindings[index].store(value, std::memory_order_release);
+	return value;
+}
+
+uint32_t Snapshot::lookup(std::string_view name) const
+{
+	// a binary search of the table, which is in the order of the names
+	uint32_t first = 0;
+	uint32_t last = u32(bindingTable);
+	while (first < last) {
+		const auto middle = first + (last - first) / 2;
+		const auto binding = entry(bindingTable, middle, bindingSize);
+		const auto order = std::string_view{image + u32(binding), u32(binding + sizeof(uint32_t))}.compare(name);
+		if (order == 0)
+			return middle;
+		if (order < 0)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return missing;
+}
+
+const FunctionExpression* Snapshot::function(uint32_t index)
+{
+	const auto [iter, added] = functions.try_emplace(index);
+	if (!added)
+		return iter->second.get();
+
+	try {
+		auto function = expect<FunctionExpression>(SnapshotReader{*this, u32(entry(functionTable, index, sizeof(uint32_t)))}.expression());
+		// decoding may have added functions, moving this one's entry
+		return (functions[index] = std::move(function)).get();
+	}
+	catch (...) {
+		functions.erase(index);
+		throw;
+	}
+}
+
+EnvironmentP Snapshot::frame(uint32_t index)
+{
+	if (const auto iter = frames.find(index); iter != frames.end())
+		return iter->second;
+
+	SnapshotReader reader{*this, u32(entry(frameTable, index, sizeof(uint32_t)))};
+	const auto parent = reader.u32();
+	if (parent == index + 1)
+		corrupt();
+	auto parentEnv = parent == 0 ? global.lock() : frame(parent - 1);
+	const auto slots = reader.u32();
+	if (slots > size)
+		corrupt();
+
+	// in place before its slots are decoded, as closures in them may be bound to it
+	auto env = Environment::frame(std::move(parentEnv), slots);
+	frames.emplace(index, env);
+	for (uint32_t slot = 0; slot < slots; slot++)
+		(*env)[slot] = reader.value();
+	return env;
+}
+
+uint32_t Snapshot::u32(size_t offset) const
+{
+	if (offset > size || size - offset < sizeof(uint32_t))
+		corrupt();
+
+	const auto* bytes = reinterpret_cast<const uint8_t*>(image + offset);
+	return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+uint32_t Snapshot::table(uint32_t table, size_t size) const
+{
+	const auto count = u32(table);
+	if (count > (this->size - table - sizeof(uint32_t)) / size)
+		corrupt();
+	return count;
+}
+
+size_t Snapshot::entry(uint32_t table, uint32_t index, size_t size) const
+{
+	if (index >= u32(table))
+		corrupt();
+	return table + sizeof(uint32_t) + size_t{index} * size;
+}
+
+
+// SnapshotWriter
+
+void SnapshotWriter::u8(uint8_t value)
+{
+	image.push_back(static_cast<char>(value));
+}
+
+void SnapshotWriter::u32(uint32_t value)
+{
+	for (size_t i = 0; i < sizeof(value); i++)
+		u8(value >> (8 * i));
+}
+
+void SnapshotWriter::i64(Integer value)
+{
+	const auto bits = static_cast<uint64_t>(value);
+	for (size_t i = 0; i < sizeof(bits); i++)
+		u8(bits >> (8 * i));
+}
+
+void SnapshotWriter::patch(size_t offset, uint32_t value)
+{
+	for (size_t i = 0; i < sizeof(value); i++)
+		image[offset + i] = static_cast<char>(value >> (8 * i));
+}
+
+void SnapshotWriter::string(std::string_view value)
+{
+	u32(value.size());
+	image += value;
+}
+
+void SnapshotWriter::slot(size_t slot)
+{
+	u32(slot == Scope::global ? UINT32_MAX : slot);
+}
+
+void SnapshotWriter::expression(const Expression& expression)
+{
+	expression.save(*this);
+}
+
+void SnapshotWriter::value(const Value& value)
+{
+	visit(overloaded{
+		[this](const NullValue&) { u8(static_cast<uint8_t>(Tag::Null)); },
+		[this](bool value) { u8(static_cast<uint8_t>(value ? Tag::True : Tag::False)); },
+		[this](Integer value) {
+			u8(static_cast<uint8_t>(Tag::Integer));
+			i64(value);
+		},
+		[this](const String& value) {
+			u8(static_cast<uint8_t>(Tag::String));
+			string(value);
+		},
+		[this](const Array& value) {
+			u8(static_cast<uint8_t>(Tag::Array));
+			u32(value.size());
+			for (const auto& element : value)
+				this->value(element);
+		},
+		[this](const Hash& value) {
+			u8(static_cast<uint8_t>(Tag::Hash));
+			u32(value.size());
+			for (const auto& [key, element] : value) {
+				this->value(key);
+				this->value(element);
+			}
+		},
+		[this](const BoundFunction& value) {
+			const auto& [fn, env] = value;
+			if (fn == &MemoFunctionExpression::instance) {
+				u8(static_cast<uint8_t>(Tag::Memo));
+				this->value((*env)[0]);
+				return;
+			}
+			const auto* function = fn->interpreted();
+			if (!function) {
+				const auto* builtin = fn->builtin();
+				const auto* binary = dynamic_cast<const BuiltinBinaryFunctionExpression*>(fn);
+				u8(static_cast<uint8_t>(Tag::Builtin));
+				string(builtin ? builtin->name : binary ? binary->name : throw std::runtime_error("can't save a native function"));
+				return;
+			}
+			u8(static_cast<uint8_t>(Tag::Closure));
+			u32(this->function(*function));
+			u32(env.get() == &global ? 0 : frame(*env) + 1);
+		},
+	}, value);
+}
+
+uint32_t SnapshotWriter::function(const FunctionExpression& function)
+{
+	const auto [iter, added] = functionNumbers.emplace(&function, functions.size());
+	if (added)
+		functions.push_back(&function);
+	return iter->second;
+}
+
+uint32_t SnapshotWriter::frame(const Environment& env)
+{
+	// only frames hold slots, global environments hold named values
+	if (!env.values.empty() || env.layers || !env.parent)
+		throw std::runtime_error("can't save a closure over another global environment");
+
+	const auto [iter, added] = frameNumbers.emplace(&env, frames.size());
+	if (added)
+		frames.push_back(&env);
+	return iter->second;
+}
+
+std::pair<uint32_t, uint32_t> SnapshotWriter::finish()
+{
+	while (functionOffsets.size() < functions.size() || frameOffsets.size() < frames.size()) {
+		while (functionOffsets.size() < functions.size()) {
+			functionOffsets.push_back(image.size());
+			functions[functionOffsets.size() - 1]->save(*this);
+		}
+		while (frameOffsets.size() < frames.size()) {
+			frameOffsets.push_back(image.size());
+			const auto& env = *frames[frameOffsets.size() - 1];
+			u32(env.parent.get() == &global ? 0 : frame(*env.parent) + 1);
+			u32(env.slotCount);
+			for (size_t slot = 0; slot < env.slotCount; slot++)
+				value(env[slot]);
+		}
+	}
+
+	// the tables, whose offsets go in the header
+	const auto functionTable = image.size();
+	u32(functionOffsets.size());
+	for (const auto offset : functionOffsets)
+		u32(offset);
+
+	const auto frameTable = image.size();
+	u32(frameOffsets.size());
+	for (const auto offset : frameOffsets)
+		u32(offset);
+
+	return {functionTable, frameTable};
+}
+
+
+// SnapshotReader
+
+const char* SnapshotReader::read(size_t count)
+{
+	if (offset > snapshot.size || snapshot.size - offset < count)
+		corrupt();
+	const auto* bytes = snapshot.image + offset;
+	offset += count;
+	return bytes;
+}
+
+uint8_t SnapshotReader::u8()
+{
+	return static_cast<uint8_t>(*read(1));
+}
+
+uint32_t SnapshotReader::u32()
+{
+	const auto value = snapshot.u32(offset);
+	offset += sizeof(value);
+	return value;
+}
+
+Integer SnapshotReader::i64()
+{
+	const auto* bytes = reinterpret_cast<const uint8_t*>(read(sizeof(uint64_t)));
+	uint64_t bits = 0;
+	for (size_t i = 0; i < sizeof(bits); i++)
+		bits |= uint64_t{bytes[i]} << (8 * i);
+	return static_cast<Integer>(bits);
+}
+
+std::string SnapshotReader::string()
+{
+	const auto size = u32();
+	return std::string{read(size), size};
+}
+
+size_t SnapshotReader::count()
+{
+	// every element takes at least a byte, so a count can't be more than are left
+	const auto count = u32();
+	if (count > snapshot.size - offset)
+		corrupt();
+	return count;
+}
+
+size_t SnapshotReader::slot()
+{
+	const auto slot = u32();
+	return slot == UINT32_MAX ? Scope::global : slot;
+}
+
+ExpressionP SnapshotReader::expression()
+{
+	using Node = Snapshot::Node;
+
+	switch (node()) {
+		case Node::Unary:       return UnaryExpression::load(*this);
+		case Node::Call:        return CallExpression::load(*this);
+		case Node::InlinedCall: return InlinedCallExpression::load(*this);
+		case Node::Function:    return FunctionExpression::load(*this);
+		case Node::Binary:      return BinaryExpression::load(*this);
+		case Node::Identifier:  return IdentifierExpression::load(*this);
+		case Node::Integer:     return IntegerLiteralExpression::load(*this);
+		case Node::Boolean:     return BooleanLiteralExpression::load(*this);
+		case Node::String:      return StringLiteralExpression::load(*this);
+		case Node::Array:       return ArrayLiteralExpression::load(*this);
+		case Node::Index:       return IndexExpression::load(*this);
+		case Node::Hash:        return HashLiteralExpression::load(*this);
+		case Node::Let:         return LetStatement::load(*this);
+		case Node::Return:      return ReturnStatement::load(*this);
+		case Node::If:          return IfStatement::load(*this);
+		case Node::List:        return StatementList::load(*this);
+		case Node::Block:       return BlockStatement::load(*this);
+	}
+	corrupt();
+}
+
+Value SnapshotReader::value()
+{
+	switch (static_cast<Tag>(u8())) {
+		case Tag::Null:    return {};
+		case Tag::False:   return Value{false};
+		case Tag::True:    return Value{true};
+		case Tag::Integer: return Value{i64()};
+		case Tag::String:  return Value{string()};
+		case Tag::Array:
+		{
+			std::vector<Value> elements(count());
+			for (auto& element : elements)
+				element = value();
+			return Value{Array{std::move(elements)}};
+		}
+		case Tag::Hash:
+		{
+			Hash hash;
+			for (auto remaining = count(); remaining > 0; remaining--) {
+				auto key = value();
+				hash.emplace(std::move(key), value());
+			}
+			return Value{std::move(hash)};
+		}
+		case Tag::Builtin:
+		{
+			const auto* fn = builtin(string());
+			if (!fn)
+				corrupt();
+			return Value{BoundFunction{fn, {}}};
+		}
+		case Tag::Closure:
+		{
+			const auto* fn = function(u32());
+			const auto env = u32();
+			if (!fn)
+				corrupt();
+			auto closure = env == 0 ? snapshot.global.lock() : snapshot.frame(env - 1);
+			Collector::track(closure);
+			return Value{BoundFunction{fn, std::move(closure)}};
+		}
+		case Tag::Memo:
+			return MemoFunctionExpression::wrap(value());
+	}
+	corrupt();
+}
+
+
+// Expressions
+
+void Expression::save(SnapshotWriter& writer) const
+{
+	throw std::runtime_error("can't save this expression");
+}
+
+void UnaryExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Unary);
+	writer.u8(static_cast<uint8_t>(op));
+	writer.expression(*value);
+}
+
+ExpressionP UnaryExpression::load(SnapshotReader& reader)
+{
+	const auto op = static_cast<TokenType>(reader.u8());
+	return std::make_unique<UnaryExpression>(op, reader.expression());
+}
+
+void CallExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Call);
+	writer.expression(*function);
+	writer.u32(arguments.size());
+	for (const auto& argument : arguments)
+		writer.expression(*argument);
+}
+
+ExpressionP CallExpression::load(SnapshotReader& reader)
+{
+	auto function = reader.expression();
+	std::vector<ExpressionP> arguments(reader.count());
+	for (auto& argument : arguments)
+		argument = reader.expression();
+	return std::make_unique<CallExpression>(std::move(function), std::move(arguments));
+}
+
+void InlinedCallExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::InlinedCall);
+	writer.expression(*callee);
+	writer.u32(writer.function(function));
+	writer.expression(*body);
+	writer.expression(*call);
+}
+
+ExpressionP InlinedCallExpression::load(SnapshotReader& reader)
+{
+	auto callee = expect<IdentifierExpression>(reader.expression());
+	const auto* function = reader.function(reader.u32());
+	auto body = reader.expression();
+	auto call = reader.expression();
+
+	// an inlined function inlining this one, through a redefinition: make the call
+	if (!function)
+		return call;
+	return std::make_unique<InlinedCallExpression>(std::move(callee), *function, std::move(body), std::move(call));
+}
+
+void FunctionExpression::save(SnapshotWriter& writer) const
+{
+	materialize();
+	writer.node(Snapshot::Node::Function);
+	writer.u32(parameters.size());
+	for (const auto& parameter : parameters)
+		writer.string(parameter);
+	writer.u32(slots);
+	writer.u32(flat);
+	writer.u32(enclosing);
+	writer.u32(captures.size());
+	for (const auto& [depth, slot] : captures) {
+		writer.u32(depth);
+		writer.slot(slot);
+	}
+	writer.expression(*body);
+}
+
+ExpressionP FunctionExpression::load(SnapshotReader& reader)
+{
+	std::vector<std::string> parameters(reader.count());
+	for (auto& parameter : parameters)
+		parameter = reader.string();
+	const auto slots = reader.u32();
+	const auto flat = reader.u32() != 0;
+	const auto enclosing = reader.u32();
+	std::vector<Capture> captures(reader.count());
+	for (auto& [depth, slot] : captures) {
+		depth = reader.u32();
+		slot = reader.slot();
+	}
+
+	auto function = std::make_unique<FunctionExpression>(std::move(parameters), reader.expression());
+	function->slots = slots;
+	function->flat = flat;
+	function->enclosing = enclosing;
+	function->captures = std::move(captures);
+	return function;
+}
+
+void BinaryExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Binary);
+	writer.string(fn.name);
+	writer.expression(*left);
+	writer.expression(*right);
+}
+
+ExpressionP BinaryExpression::load(SnapshotReader& reader)
+{
+	const auto& fn = binary(reader.string());
+	auto left = reader.expression();
+	return std::make_unique<BinaryExpression>(fn, std::move(left), reader.expression());
+}
+
+void IdentifierExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Identifier);
+	writer.string(identifier);
+	writer.slot(depth);
+	writer.slot(slot);
+}
+
+ExpressionP IdentifierExpression::load(SnapshotReader& reader)
+{
+	auto identifier = std::make_unique<IdentifierExpression>(reader.string());
+	const auto depth = reader.slot();
+	identifier->bind(depth, reader.slot());
+	return identifier;
+}
+
+void IntegerLiteralExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Integer);
+	writer.i64(value);
+}
+
+ExpressionP IntegerLiteralExpression::load(SnapshotReader& reader)
+{
+	return std::make_unique<IntegerLiteralExpression>(reader.i64());
+}
+
+void BooleanLiteralExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Boolean);
+	writer.u8(value);
+}
+
+ExpressionP BooleanLiteralExpression::load(SnapshotReader& reader)
+{
+	return std::make_unique<BooleanLiteralExpression>(reader.u8() != 0);
+}
+
+void StringLiteralExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::String);
+	writer.string(value);
+}
+
+ExpressionP StringLiteralExpression::load(SnapshotReader& reader)
+{
+	auto value = reader.string();
+	return std::make_unique<StringLiteralExpression>(value);
+}
+
+void ArrayLiteralExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Array);
+	writer.u32(elements.size());
+	for (const auto& element : elements)
+		writer.expression(*element);
+}
+
+ExpressionP ArrayLiteralExpression::load(SnapshotReader& reader)
+{
+	std::vector<ExpressionP> elements(reader.count());
+	for (auto& element : elements)
+		element = reader.expression();
+	return std::make_unique<ArrayLiteralExpression>(std::move(elements));
+}
+
+void IndexExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Index);
+	writer.expression(*array);
+	writer.expression(*index);
+}
+
+ExpressionP IndexExpression::load(SnapshotReader& reader)
+{
+	auto array = reader.expression();
+	return std::make_unique<IndexExpression>(std::move(array), reader.expression());
+}
+
+void HashLiteralExpression::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Hash);
+	writer.u32(elements.size());
+	for (const auto& [key, value] : elements) {
+		writer.expression(*key);
+		writer.expression(*value);
+	}
+}
+
+ExpressionP HashLiteralExpression::load(SnapshotReader& reader)
+{
+	std::vector<std::pair<ExpressionP, ExpressionP>> elements(reader.count());
+	for (auto& [key, value] : elements) {
+		key = reader.expression();
+		value = reader.expression();
+	}
+	return std::make_unique<HashLiteralExpression>(std::move(elements));
+}
+
+
+// Statements
+
+void LetStatement::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Let);
+	writer.string(name);
+	writer.slot(slot);
+	writer.expression(*value);
+}
+
+StatementP LetStatement::load(SnapshotReader& reader)
+{
+	auto name = reader.string();
+	const auto slot = reader.slot();
+	auto let = std::make_unique<LetStatement>(std::move(name), reader.expression());
+	let->slot = slot;
+	return let;
+}
+
+void ReturnStatement::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Return);
+	writer.expression(*value);
+}
+
+StatementP ReturnStatement::load(SnapshotReader& reader)
+{
+	return std::make_unique<ReturnStatement>(reader.expression());
+}
+
+void IfStatement::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::If);
+	writer.expression(*condition);
+	writer.expression(*consequence);
+	writer.u8(alternative != nullptr);
+	if (alternative)
+		writer.expression(*alternative);
+}
+
+StatementP IfStatement::load(SnapshotReader& reader)
+{
+	auto condition = reader.expression();
+	auto consequence = reader.expression();
+	auto alternative = reader.u8() ? reader.expression() : nullptr;
+	return std::make_unique<IfStatement>(std::move(condition), std::move(consequence), std::move(alternative));
+}
+
+void StatementList::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::List);
+	saveStatements(writer);
+}
+
+void StatementList::saveStatements(SnapshotWriter& writer) const
+{
+	writer.u32(statements.size());
+	for (const auto& statement : statements)
+		writer.expression(*statement);
+}
+
+std::vector<StatementP> StatementList::loadStatements(SnapshotReader& reader)
+{
+	std::vector<StatementP> statements(reader.count());
+	for (auto& statement : statements)
+		statement = reader.expression();
+	return statements;
+}
+
+StatementP StatementList::load(SnapshotReader& reader)
+{
+	return std::make_unique<StatementList>(loadStatements(reader));
+}
+
+void BlockStatement::save(SnapshotWriter& writer) const
+{
+	writer.node(Snapshot::Node::Block);
+	saveStatements(writer);
+}
+
+StatementP BlockStatement::load(SnapshotReader& reader)
+{
+	return std::make_unique<BlockStatement>(loadStatements(reader));
+}
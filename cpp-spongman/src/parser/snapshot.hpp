@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "value.hpp"
+#include "utils.hpp"
+
+struct Expression;
+struct FunctionExpression;
+using ExpressionP = std::unique_ptr<Expression>;
+
+// a binary image of the bindings of a global environment, with the functions and closure frames they refer to.
+// --snapshot-out writes one, --snapshot-in maps it into memory and restores it (see Environment::restore):
+// a binding, and the functions and frames it needs, are only decoded when it is first looked up.
+//
+// the image is a header, then the encoded values, functions and frames, then the tables that index them:
+// the bindings by name, in order, and the functions and frames by the number values refer to them by.
+// the tables are searched where they are mapped. opening an image checks its checksum, and that the tables
+// and what they point to are within it, so a truncated or corrupted image is rejected then.
+// numbers are little-endian, strings are a u32 length and their bytes.
+class Snapshot
+{
+public:
+	// write the bindings of env, but not of its parent, to path
+	static void save(const std::string& path, const Environment& env);
+
+	// map the image at path, to be restored into an environment
+	static std::shared_ptr<Snapshot> open(const std::string& path);
+
+	Snapshot(const Snapshot&) = delete;
+	Snapshot& operator=(const Snapshot&) = delete;
+	~Snapshot();
+
+	// the environment the image's closures over the global environment are bound to
+	void restore(const EnvironmentP& env);
+
+	// the binding of name, decoded on first lookup, or nullptr if the image has none
+	const Value* find(std::string_view name);
+
+	// add the image's bindings to those that aren't already in bindings
+	void decode(string_map<Value>& bindings);
+
+	// the bindings decoded so far
+	size_t decoded() const;
+
+	// the kinds of node in an encoded AST
+	enum class Node : uint8_t
+	{
+		Unary,
+		Call,
+		InlinedCall,
+		Function,
+		Binary,
+		Identifier,
+		Integer,
+		Boolean,
+		String,
+		Array,
+		Index,
+		Hash,
+		Let,
+		Return,
+		If,
+		List,
+		Block,
+	};
+
+private:
+	friend struct SnapshotReader;
+	friend class Collector;
+
+	Snapshot(const char* image, size_t size);
+
+	static constexpr uint32_t missing = UINT32_MAX;
+
+	// the index in the binding table of name, or missing if there's none
+	uint32_t lookup(std::string_view name) const;
+	// the value of the binding at index, decoding it if it's the first lookup. under mutex
+	const Value* decode(uint32_t index);
+
+	const FunctionExpression* function(uint32_t index);
+	EnvironmentP frame(uint32_t index);
+
+	// a u32 of the image, checked to be within it
+	uint32_t u32(size_t offset) const;
+	// the number of entries of size in the table at offset table, checked to be within the image
+	uint32_t table(uint32_t table, size_t size) const;
+	// the offset of entry index of the table at offset table, checked to be within it
+	size_t entry(uint32_t table, uint32_t index, size_t size) const;
+
+	const char* image;
+	size_t size;
+	uint32_t bindingTable = 0;
+	uint32_t functionTable = 0;
+	uint32_t frameTable = 0;
+
+	mutable std::mutex mutex;	// decoding, which threads sharing a restored environment may do at once
+	std::weak_ptr<Environment> global;
+	string_map<Value> values;
+	std::unique_ptr<std::atomic<const Value*>[]> bindings;	// into values, by index, once decoded
+	std::unordered_map<uint32_t, std::unique_ptr<FunctionExpression>> functions;	// nullptr while being decoded
+	std::unordered_map<uint32_t, EnvironmentP> frames;
+};
+
+// appends the encoding of values, and of the ASTs of the functions they refer to, to an image
+struct SnapshotWriter
+{
+	explicit SnapshotWriter(const Environment& global)
+	: global{global} {}
+
+	void u8(uint8_t value);
+	void u32(uint32_t value);
+	void i64(Integer value);
+	void string(std::string_view value);
+	void slot(size_t slot);	// a depth or slot, which may be Scope::global
+	void patch(size_t offset, uint32_t value);	// a u32 written earlier
+
+	void node(Snapshot::Node node) { u8(static_cast<uint8_t>(node)); }
+	void expression(const Expression& expression);
+	void value(const Value& value);
+
+	// the number a function or frame is written under, queueing it to be written if it's new
+	uint32_t function(const FunctionExpression& function);
+	uint32_t frame(const Environment& env);
+
+	// write the queued functions and frames, which may queue more, then the tables that index them,
+	// returning the offsets of the function table and the frame table
+	std::pair<uint32_t, uint32_t> finish();
+
+	std::string image;
+
+private:
+	const Environment& global;
+
+	std::unordered_map<const FunctionExpression*, uint32_t> functionNumbers;
+	std::unordered_map<const Environment*, uint32_t> frameNumbers;
+	std::vector<const FunctionExpression*> functions;
+	std::vector<const Environment*> frames;
+	std::vector<uint32_t> functionOffsets;
+	std::vector<uint32_t> frameOffsets;
+};
+
+// decodes values and ASTs from an image, at a cursor. throws std::runtime_error on reading past its end.
+// the ASTs are trusted like the program they were saved from: their slots aren't checked against their scopes
+struct SnapshotReader
+{
+	SnapshotReader(Snapshot& snapshot, size_t offset)
+	: snapshot{snapshot}, offset{offset} {}
+
+	uint8_t u8();
+	uint32_t u32();
+	Integer i64();
+	std::string string();
+	size_t count();	// of the elements that follow
+	size_t slot();
+
+	Snapshot::Node node() { return static_cast<Snapshot::Node>(u8()); }
+	ExpressionP expression();
+	Value value();
+
+	// a function of the image, or nullptr while it is being decoded
+	const FunctionExpression* function(uint32_t index) { return snapshot.function(index); }
+
+private:
+	const char* read(size_t count);
+
+	Snapshot& snapshot;
+	size_t offset;
+};
@@ -0,0 +1,33 @@
+#include <pthread.h>
+
+#include "stack.hpp"
+
+
+// Stack
+
+std::atomic<size_t> Stack::limit{size_t{1} << 30};
+
+Value Stack::overflow()
+{
+	return Value::error("stack overflow");
+}
+
+void Stack::locate() noexcept
+{
+	pthread_attr_t attributes;
+	void* address = nullptr;
+	size_t bytes = 0;
+	if (pthread_getattr_np(pthread_self(), &attributes) == 0) {
+		pthread_attr_getstack(&attributes, &address, &bytes);
+		pthread_attr_destroy(&attributes);
+	}
+
+	// a stack that can't be found is taken to be as large as the address space below the caller
+	if (!address) {
+		low = reinterpret_cast<const char*>(1);
+		size = static_cast<const char*>(__builtin_frame_address(0)) - low;
+		return;
+	}
+	low = static_cast<const char*>(address);
+	size = bytes;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include "value.hpp"
+
+// bounds how deep evaluation recurses. the tree walk recurses on the native stack of the thread it runs on:
+// once half of that is used, calls continue on a VM, whose frames are on the heap, up to limit bytes of them
+// for each thread. running out of either is a runtime error, which unwinds like any other.
+struct Stack
+{
+	// the native stack is too deep for the tree walk to recurse further
+	static bool deep() noexcept
+	{
+		const auto left = remaining();
+		return left < size / 2;
+	}
+
+	// the native stack is too deep for evaluation to go on
+	static bool exhausted() noexcept { return remaining() < reserved; }
+
+	// account for the heap frames of a VM: false, accounting for nothing, if they would go past the limit
+	static bool reserve(size_t bytes) noexcept
+	{
+		if (used + bytes > limit.load(std::memory_order_relaxed))
+			return false;
+		used += bytes;
+		return true;
+	}
+
+	static void release(size_t bytes) noexcept { used -= bytes; }
+
+	// the error of running out of either stack
+	static Value overflow();
+
+	// the heap frames accounted for when it was made are restored when it goes, however the VM it's in exits
+	struct Mark
+	{
+		Mark() noexcept : saved{used} {}
+		~Mark() { used = saved; }
+		Mark(const Mark&) = delete;
+		Mark& operator=(const Mark&) = delete;
+
+		const size_t saved;
+	};
+
+	static std::atomic<size_t> limit;	// bytes of heap frames, which --max-stack sets in megabytes
+
+private:
+	// bytes of the calling thread's native stack below the caller's frame
+	static size_t remaining() noexcept
+	{
+		if (!low)
+			locate();
+		return static_cast<const char*>(__builtin_frame_address(0)) - low;
+	}
+
+	static void locate() noexcept;
+
+	static constexpr size_t reserved = 64 * 1024;	// for the native code between checks, and the unwinding
+
+	static inline thread_local const char* low = nullptr;
+	static inline thread_local size_t size = 0;
+	static inline thread_local size_t used = 0;
+};
@@ -1,5 +1,6 @@
 #include "statement.hpp"
 #include "expression.hpp"
+#include "memo.hpp"
 #include "lexer.hh"
 
 
@@ -33,15 +34,22 @@ StatementP LetStatement::parse(Lexer& lexer)
 	);
 }
 
-Value LetStatement::eval(EnvironmentP env) const
+Value LetStatement::eval(Environment& env) const
 {
-	env->set(name, value->eval(env));
+	auto evaluatedValue = value->eval(env);
+	if (evaluatedValue.abrupt())
+		return evaluatedValue;
+
+	if (slot == Scope::global)
+		env.set(name, MemoFunctionExpression::define(env, name, std::move(evaluatedValue)));
+	else
+		env[slot] = std::move(evaluatedValue);
 	return {};
 }
 
 void LetStatement::print(std::ostream& os) const
 {
-	os << "let " << name << " = " << *value << ";";
+	os << "let " << name << " = " << *value;
 }
 
 
@@ -61,10 +69,18 @@ StatementP ReturnStatement::parse(Lexer& lexer)
 	);
 }
 
-Value ReturnStatement::eval(EnvironmentP env) const
+Value ReturnStatement::eval(Environment& env) const
 {
-	const auto evaluatedValue = value->eval(env);
-	throw std::move(evaluatedValue);
+	auto evaluatedValue = value->eval(env);
+	if (!evaluatedValue.abrupt())
+		evaluatedValue.setCompletion(Completion::Return);
+	return evaluatedValue;
+}
+
+
+Value ReturnStatement::evalTail(Environment& env, TailCall& tail) const
+{
+	return value->evalTail(env, tail);
 }
 
 
@@ -72,7 +88,7 @@ Value ReturnStatement::eval(EnvironmentP env) const
 
 void ReturnStatement::print(std::ostream& os) const
 {
-	os << "return " << *value << ";";
+	os << "return " << *value;
 }
 
 
@@ -89,15 +105,29 @@ ExpressionP StatementList::parse(Lexer& lexer)
 		: std::make_unique<StatementList>(std::move(expressions));
 }
 
-Value StatementList::eval(EnvironmentP env) const
+Value StatementList::eval(Environment& env) const
 {
 	Value value;
 	for (const auto& statement : statements) {
 		value = statement->eval(env);
+		if (value.abrupt())
+			break;
 	}
 	return value;
 }
 
+Value StatementList::evalTail(Environment& env, TailCall& tail) const
+{
+	if (statements.empty())
+		return {};
+
+	for (auto iter = statements.begin(); iter != statements.end() - 1; ++iter) {
+		if (auto value = (*iter)->eval(env); value.abrupt())
+			return value;
+	}
+	return statements.back()->evalTail(env, tail);
+}
+
 void StatementList::print(std::ostream& os) const
 {
 	for (const auto& statement : statements)
@@ -126,7 +156,7 @@ void BlockStatement::print(std::ostream& os) const
 {
 	os << "{\n";
 	StatementList::print(os);
-	os << "}\n";
+	os << "}";
 }
 
 
@@ -159,19 +189,13 @@ StatementP IfStatement::parse(Lexer& lexer)
 	);
 }
 
-Value IfStatement::eval(EnvironmentP env) const
+Value IfStatement::eval(Environment& env) const
 {
-	auto value = condition->eval(env);
-	auto truthyValue = std::visit(overloaded{
-		[](bool val)                 { return val; },
-		[](Integer val)              { return val != 0; },
-		[](const auto& val) {
-			throw std::runtime_error("invalid condition: " + std::to_string(val));
-			return false;
-		}
-	}, value.data);
+	const auto test = truthy(condition->eval(env));
+	if (test.abrupt())
+		return test;
 
-	if (truthyValue)
+	if (test.get<bool>())
 		return consequence->eval(env);
 
 	if (alternative)
@@ -180,13 +204,43 @@ Value IfStatement::eval(EnvironmentP env) const
 	return {};
 }
 
+Value IfStatement::evalTail(Environment& env, TailCall& tail) const
+{
+	const auto test = truthy(condition->eval(env));
+	if (test.abrupt())
+		return test;
+
+	if (test.get<bool>())
+		return consequence->evalTail(env, tail);
+
+	if (alternative)
+		return alternative->evalTail(env, tail);
+
+	return {};
+}
+
+// the bool a condition tests as, or an error
+Value IfStatement::truthy(const Value& value)
+{
+	if (value.abrupt())
+		return value;
+
+	return visit(overloaded{
+		[](bool val)                 { return Value{val}; },
+		[](Integer val)              { return Value{val != 0}; },
+		[](const auto& val) {
+			return Value::error("invalid condition: " + std::to_string(val));
+		}
+	}, value);
+}
+
 
 void IfStatement::print(std::ostream& os) const
 {
 	os << "if (" << *condition << ")\n";
-	os << "\t" << *consequence << "\n";
+	os << "\t" << *consequence;
 	if (alternative) {
-		os << "else\n";
-		os << "\t" << *alternative << "\n";
+		os << "\nelse\n";
+		os << "\t" << *alternative;
 	}
 }
@@ -18,11 +18,18 @@ struct LetStatement : public Statement
 
 	static StatementP parse(Lexer& lexer);
 	void print(std::ostream& str) const override;
-	virtual Value eval(EnvironmentP env) const;
+	void save(SnapshotWriter& writer) const override;
+	static StatementP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	virtual Value eval(Environment& env) const;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	ExpressionP optimize(Optimizer& optimizer) override;
 
 private:
 	const Identifier name;
-	const ExpressionP value;
+	ExpressionP value;
+	size_t slot = Scope::global;
 };
 
 struct ReturnStatement : public Statement
@@ -31,10 +38,18 @@ struct ReturnStatement : public Statement
 
 	static StatementP parse(Lexer& lexer);
 	void print(std::ostream& str) const override;
-	virtual Value eval(EnvironmentP env) const;
+	void save(SnapshotWriter& writer) const override;
+	static StatementP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	virtual Value eval(Environment& env) const;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	Value evalTail(Environment& env, TailCall& tail) const override;
+	void compileTail(Compiler& compiler) const override;
+	ExpressionP optimize(Optimizer& optimizer) override;
 
 private:
-	const ExpressionP value;
+	ExpressionP value;
 };
 
 struct IfStatement : public Statement
@@ -43,12 +58,23 @@ struct IfStatement : public Statement
 
 	static StatementP parse(Lexer& lexer);
 	void print(std::ostream& str) const override;
-	virtual Value eval(EnvironmentP env) const;
+	void save(SnapshotWriter& writer) const override;
+	static StatementP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	virtual Value eval(Environment& env) const;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	Value evalTail(Environment& env, TailCall& tail) const override;
+	void compileTail(Compiler& compiler) const override;
+	ExpressionP optimize(Optimizer& optimizer) override;
+	ExpressionP copy(Inlining& inlining) const override;
+
+	static Value truthy(const Value& value);
 
 private:
-	const ExpressionP condition;
-	const StatementP consequence;
-	const StatementP alternative;
+	ExpressionP condition;
+	StatementP consequence;
+	StatementP alternative;
 };
 
 struct StatementList : public Statement
@@ -58,9 +84,20 @@ struct StatementList : public Statement
 
 	static ExpressionP parse(Lexer& lexer);
 	void print(std::ostream& str) const override;
-	virtual Value eval(EnvironmentP env) const;
+	void save(SnapshotWriter& writer) const override;
+	static StatementP load(SnapshotReader& reader);
+	void resolve(Scope& scope) override;
+	virtual Value eval(Environment& env) const;
+	void compile(Compiler& compiler) const override;
+	bool pure(Purity& purity) const override;
+	Value evalTail(Environment& env, TailCall& tail) const override;
+	void compileTail(Compiler& compiler) const override;
+	ExpressionP optimize(Optimizer& optimizer) override;
 
 protected:
+	void saveStatements(SnapshotWriter& writer) const;
+	static std::vector<StatementP> loadStatements(SnapshotReader& reader);
+
 	std::vector<StatementP> statements;
 };
 
@@ -70,4 +107,6 @@ struct BlockStatement : public StatementList
 
 	static StatementP parse(Lexer& lexer);
 	void print(std::ostream& str) const override;
+	void save(SnapshotWriter& writer) const override;
+	static StatementP load(SnapshotReader& reader);
 };
@@ -1,12 +1,85 @@
 #include <iostream>
 #include <sstream>
+#include <bit>
 
 #include "value.hpp"
 #include "expression.hpp"
 
-std::string std::to_string(const ValueType& data)
+
+namespace
+{
+	// every bit of the result depends on every bit of x (the finalizer of MurmurHash3)
+	uint64_t mix(uint64_t x) noexcept
+	{
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccd;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53;
+		x ^= x >> 33;
+		return x;
+	}
+
+	// a hash of the sequence of h and x
+	uint64_t combine(uint64_t h, uint64_t x) noexcept
+	{
+		return (std::rotl(h, 5) ^ x) * 0x100000001b3;
+	}
+}
+
+Value::Value(String value)
+: type_{ValueType::String}, payload_{.object = new Boxed<String>(std::move(value))}
+{
+}
+
+Value::Value(Array value)
+: type_{ValueType::Array}, payload_{.object = new Boxed<Array>(std::move(value))}
+{
+}
+
+Value::Value(Hash value)
+: type_{ValueType::Hash}, payload_{.object = new Boxed<Hash>(std::move(value))}
+{
+}
+
+Value::Value(BoundFunction value)
+: type_{ValueType::Function}, payload_{.object = new Boxed<BoundFunction>(std::move(value))}
+{
+}
+
+Value Value::error(std::string message)
+{
+	Value value{std::move(message)};
+	value.completion_ = Completion::Error;
+	return value;
+}
+
+void Value::destroy() noexcept
+{
+	switch (type_) {
+		case ValueType::String:   delete static_cast<const Boxed<String>*>(payload_.object);        break;
+		case ValueType::Function: delete static_cast<const Boxed<BoundFunction>*>(payload_.object); break;
+		case ValueType::Array:    delete static_cast<const Boxed<Array>*>(payload_.object);         break;
+		case ValueType::Hash:     delete static_cast<const Boxed<Hash>*>(payload_.object);          break;
+	}
+}
+
+std::string std::to_string(ValueType type)
 {
-	return std::visit(overloaded{
+	switch (type) {
+		case ValueType::Null:     return "nil";
+		case ValueType::Bool:     return "bool";
+		case ValueType::Integer:  return "Integer";
+		case ValueType::String:   return "String";
+		case ValueType::Function: return "fn";
+		case ValueType::Array:    return "Array";
+		case ValueType::Hash:     return "Hash";
+	}
+	return "unknown";
+}
+
+std::string std::to_string(const Value& data)
+{
+	return visit(overloaded{
 		[](const NullValue& value) -> std::string {
 			return "nil";
 		},
@@ -37,7 +110,7 @@ std::string std::to_string(const ValueType& data)
 						isString = false;
 						break;
 					}
-					const auto& elementString = element.as<std::string>();
+					const auto& elementString = element.get<std::string>();
 					if (elementString.length() != 1) {
 						isString = false;
 						break;
@@ -53,7 +126,7 @@ std::string std::to_string(const ValueType& data)
 				if (!first)
 					str += ",";
 				first = false;
-				str += std::to_string(element.data);
+				str += std::to_string(element);
 			}
 			return str + "]";
 		},
@@ -64,35 +137,95 @@ std::string std::to_string(const ValueType& data)
 				if (!first)
 					str += ",";
 				first = false;
-				str += std::to_string(key.data);
+				str += std::to_string(key);
 				str += ":";
-				str += std::to_string(value.data);
+				str += std::to_string(value);
 			}
 			return str + "}";
-		},
-		[](const auto& _) -> std::string {
-			return "unknown value";
 		}
 	},
 	data);
 }
 
+size_t ValueHash::operator()(const Value& value) const
+{
+	const auto* object = value.object();
+	if (object && value.type() != ValueType::Function)
+		if (const auto cached = std::atomic_ref{object->hash}.load(std::memory_order_relaxed))
+			return mix(cached);
+
+	const auto hash = visit(overloaded{
+		[](const NullValue&) { return uint64_t{0}; },
+		[](const bool val) { return uint64_t{val ? 1u : 2u}; },
+		[](const Integer val) { return static_cast<uint64_t>(val); },
+		[](const String& val) { return uint64_t{std::hash<std::string>{}(val)}; },
+		[](const BoundFunction& val) {
+			return combine(reinterpret_cast<uintptr_t>(val.first), reinterpret_cast<uintptr_t>(val.second.get()));
+		},
+		[](const Array& val) {
+			uint64_t h = val.size();
+			for (const auto& element : val)
+				h = combine(h, ValueHash{}(element));
+			return h;
+		},
+		[](const Hash& val) {
+			// a sum of the entries' hashes is the same in any order
+			uint64_t h = val.size();
+			val.each([&h](const Value& key, const Value& element) {
+				h += mix(combine(ValueHash{}(key), ValueHash{}(element)));
+			});
+			return h;
+		}
+	}, value) + static_cast<uint64_t>(value.type());
+
+	if (!object || value.type() == ValueType::Function)
+		return mix(hash);
+
+	// folded into the 32 bits there's room for, never 0, which is not found yet
+	const auto folded = static_cast<uint32_t>(hash ^ (hash >> 32)) | 1;
+	std::atomic_ref{object->hash}.store(folded, std::memory_order_relaxed);
+	return mix(folded);
+}
+
+
+bool operator==(const Value& v1, const Value& v2)
+{
+	if (v1.type() != v2.type())
+		return false;
+
+	switch (v1.type()) {
+		case ValueType::Null:     return true;
+		case ValueType::Bool:     return v1.get<bool>() == v2.get<bool>();
+		case ValueType::Integer:  return v1.get<Integer>() == v2.get<Integer>();
+		case ValueType::String:   return v1.get<String>() == v2.get<String>();
+		case ValueType::Function:
+		{
+			// the same function bound to the same environment, as ValueHash hashes them
+			const auto& [fn1, env1] = v1.get<BoundFunction>();
+			const auto& [fn2, env2] = v2.get<BoundFunction>();
+			return fn1 == fn2 && env1.get() == env2.get();
+		}
+		case ValueType::Array:
+		{
+			const auto& a1 = v1.get<Array>();
+			const auto& a2 = v2.get<Array>();
+			return a1.size() == a2.size() && std::equal(a1.begin(), a1.end(), a2.begin());
+		}
+		case ValueType::Hash:
+		{
+			return v1.get<Hash>() == v2.get<Hash>();
+		}
+	}
+	return false;
+}
+
 std::ostream& operator<<(std::ostream& os, const Value& value)
 {
-	os << std::to_string(value.data);
+	os << std::to_string(value);
 	return os;
 }
 
 std::string Value::typeName() const
 {
-	return std::visit(overloaded{
-		[](const NullValue& value) { return "nil"; },
-		[](const bool value)       { return "bool"; },
-		[](const Integer value)    { return "Integer"; },
-		[](const String& value)    { return "String"; },
-		[](const BoundFunction& value) { return "fn"; },
-		[](const Array& value)     { return "Array"; },
-		[](const auto& _)          { return "unknown"; }
-	},
-	data);
+	return std::to_string(type_);
 }
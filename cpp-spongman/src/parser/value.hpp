@@ -1,11 +1,14 @@
 #pragma once
 
 #include <string>
-#include <variant>
 #include <memory>
 #include <iosfwd>
 #include <vector>
-#include <unordered_map>
+#include <span>
+#include <concepts>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
 
 struct AbstractFunctionExpression;
 
@@ -13,7 +16,7 @@ struct Environment;
 using EnvironmentP = std::shared_ptr<Environment>;
 
 
-// helper type for std::visit
+// helper type for visit()
 template<class... Ts>
 struct overloaded : Ts... { using Ts::operator()...; };
 
@@ -24,101 +27,288 @@ struct NullValue
 };
 
 struct Value;
+// well mixed, so that any of its bits can pick a slot. an Array's depends on the order of its elements, a Hash's doesn't,
+// and a function's is its identity. that of a String, Array or Hash is found once, and kept in its box
 struct ValueHash { size_t operator()(const Value& value) const; };
 
 using String = std::string;
 using Integer = int64_t;
 using BoundFunction = std::pair<const AbstractFunctionExpression*, EnvironmentP>;
-using Array = std::vector<Value>;
-using Hash = std::unordered_map<Value, Value, ValueHash>;
+class Array;
+class Hash;
 
-using ValueType = std::variant<
-	NullValue,
-	bool,
+// evaluated arguments passed to a function call, wherever the caller keeps them
+using Arguments = std::span<const Value>;
+
+enum class ValueType : uint8_t
+{
+	Null,
+	Bool,
 	Integer,
 	String,
-	BoundFunction,
+	Function,
 	Array,
-	Hash
->;
+	Hash,
+};
+
+// how the evaluation that produced a value completed. anything but Normal unwinds evaluation:
+// a Return up to the enclosing function call, an Error up to the top level, with its message as a String.
+enum class Completion : uint8_t
+{
+	Normal,
+	Return,
+	Error,
+};
+
+template<typename T> inline constexpr ValueType valueTypeOf = ValueType::Null;
+template<> inline constexpr ValueType valueTypeOf<bool>          = ValueType::Bool;
+template<> inline constexpr ValueType valueTypeOf<Integer>       = ValueType::Integer;
+template<> inline constexpr ValueType valueTypeOf<String>        = ValueType::String;
+template<> inline constexpr ValueType valueTypeOf<BoundFunction> = ValueType::Function;
+template<> inline constexpr ValueType valueTypeOf<Array>         = ValueType::Array;
+template<> inline constexpr ValueType valueTypeOf<Hash>          = ValueType::Hash;
 
 namespace std
 {
-	std::string to_string(const ValueType&);
+	std::string to_string(ValueType type);
+	std::string to_string(const Value& value);
 }
 
+// reference-counted header of a heap-allocated payload.
+// payloads are immutable once boxed, so copying a Value only bumps the count.
+// counts are updated atomically only while values may be shared between threads (see Sharing).
+struct Object
+{
+	mutable uint32_t refs = 1;
+	mutable uint32_t hash = 0;	// of the payload, once ValueHash has found it, which fits in the padding before it
+
+	void retain() const noexcept
+	{
+		if (sharers.load(std::memory_order_relaxed))
+			std::atomic_ref{refs}.fetch_add(1, std::memory_order_relaxed);
+		else
+			refs++;
+	}
+
+	// true when the last reference is gone
+	bool release() const noexcept
+	{
+		if (sharers.load(std::memory_order_relaxed))
+			return std::atomic_ref{refs}.fetch_sub(1, std::memory_order_acq_rel) == 1;
+		return --refs == 0;
+	}
+
+	// the current count, which other threads may be changing (see Collector)
+	uint32_t refcount() const noexcept { return std::atomic_ref{refs}.load(std::memory_order_relaxed); }
+
+	// while any Sharing is alive, values may be shared between threads.
+	// one must be created before values are handed to another thread, and outlive their use there.
+	struct Sharing
+	{
+		Sharing() noexcept { sharers.fetch_add(1, std::memory_order_acq_rel); }
+		~Sharing() { sharers.fetch_sub(1, std::memory_order_acq_rel); }
+		Sharing(const Sharing&) = delete;
+		Sharing& operator=(const Sharing&) = delete;
+	};
+
+private:
+	static inline std::atomic<uint32_t> sharers{0};
+};
+
+// intrusive pointer to an Object
+template<typename T>
+class Ref
+{
+public:
+	Ref() noexcept = default;
+
+	// adopts the initial reference of a newly allocated object
+	explicit Ref(T* object) noexcept
+	: object{object} {}
+
+	Ref(const Ref& other) noexcept
+	: object{other.object}
+	{
+		if (object)
+			object->retain();
+	}
+
+	Ref(Ref&& other) noexcept
+	: object{other.object}
+	{
+		other.object = nullptr;
+	}
+
+	Ref& operator=(Ref other) noexcept
+	{
+		std::swap(object, other.object);
+		return *this;
+	}
+
+	~Ref()
+	{
+		if (object && object->release())
+			delete object;
+	}
+
+	T* get() const noexcept { return object; }
+	T* operator->() const noexcept { return object; }
+	T& operator*() const noexcept { return *object; }
+	explicit operator bool() const noexcept { return object != nullptr; }
+
+private:
+	T* object = nullptr;
+};
+
+template<typename T>
+struct Boxed : Object
+{
+	template<typename... Args>
+	Boxed(Args&&... args)
+	: value(std::forward<Args>(args)...) {}
+
+	const T value;
+};
+
+// a 16-byte tagged value: nil, bools and Integers are stored inline, everything else is a shared, immutable box on the heap.
 struct Value
 {
-	ValueType data;
+	constexpr Value() noexcept
+	: type_{ValueType::Null}, payload_{.integer = 0} {}
 
-	/*
-	Value() : data{NullValue{}} {}
-	Value(Value&& other) = default;
-	constexpr Value& operator=(Value&& other) = default;
+	constexpr Value(NullValue) noexcept
+	: Value{} {}
 
-	Value(const Value& other) = delete;
-	constexpr Value& operator=(const Value& other) = delete;
+	template<std::same_as<bool> T>
+	constexpr Value(T value) noexcept
+	: type_{ValueType::Bool}, payload_{.boolean = value} {}
 
-	template<typename T>
-	Value(T&& other)
-	: data{std::move(other)} {}
-	*/
+	template<std::integral T> requires (!std::same_as<T, bool>)
+	constexpr Value(T value) noexcept
+	: type_{ValueType::Integer}, payload_{.integer = static_cast<Integer>(value)} {}
+
+	Value(const char* value)
+	: Value{String{value}} {}
+
+	Value(String value);
+	Value(Array value);
+	Value(Hash value);
+	Value(BoundFunction value);
+
+	Value(const Value& other) noexcept
+	: type_{other.type_}, completion_{other.completion_}, payload_{other.payload_}
+	{
+		if (boxed())
+			payload_.object->retain();
+	}
+
+	Value(Value&& other) noexcept
+	: type_{other.type_}, completion_{other.completion_}, payload_{other.payload_}
+	{
+		other.type_ = ValueType::Null;
+	}
+
+	Value& operator=(const Value& other) noexcept
+	{
+		Value copy{other};
+		swap(copy);
+		return *this;
+	}
+
+	Value& operator=(Value&& other) noexcept
+	{
+		Value moved{std::move(other)};
+		swap(moved);
+		return *this;
+	}
+
+	~Value()
+	{
+		if (boxed() && payload_.object->release())
+			destroy();
+	}
+
+	void swap(Value& other) noexcept
+	{
+		std::swap(type_, other.type_);
+		std::swap(completion_, other.completion_);
+		std::swap(payload_, other.payload_);
+	}
+
+	// a runtime error
+	static Value error(std::string message);
+
+	constexpr ValueType type() const noexcept { return type_; }
+
+	constexpr Completion completion() const noexcept { return completion_; }
+	constexpr void setCompletion(Completion completion) noexcept { completion_ = completion; }
+	constexpr bool abrupt() const noexcept { return completion_ != Completion::Normal; }
+	constexpr bool failed() const noexcept { return completion_ == Completion::Error; }
 
 	template<typename T>
-	constexpr bool is() const { return std::holds_alternative<T>(data); }
+	constexpr bool is() const noexcept { return type_ == valueTypeOf<T>; }
 
+	// unchecked access, the caller must have tested is<T>()
 	template<typename T>
-	const T& as() const {
-		if (!is<T>())
-			throw std::runtime_error("Error trying to convert " + std::to_string(data) + " to " + Value{T{}}.typeName());
-		return std::get<T>(data);
+	const T& get() const noexcept {
+		if constexpr (std::is_same_v<T, bool>)               return payload_.boolean;
+		else if constexpr (std::is_same_v<T, Integer>)       return payload_.integer;
+		else if constexpr (std::is_same_v<T, NullValue>)     return nil;
+		else                                                 return static_cast<const Boxed<T>*>(payload_.object)->value;
 	}
 
 	std::string typeName() const;
+
+	// the box of a String, function, Array or Hash, or nullptr
+	const Object* object() const noexcept { return boxed() ? payload_.object : nullptr; }
+
+private:
+	constexpr bool boxed() const noexcept { return type_ >= ValueType::String; }
+	void destroy() noexcept;
+
+	static constexpr NullValue nil{};
+
+	ValueType type_;
+	Completion completion_ = Completion::Normal;
+	union Payload {
+		bool boolean;
+		Integer integer;
+		const Object* object;
+	} payload_;
 };
 
-inline size_t ValueHash::operator()(const Value& value) const
+static_assert(sizeof(Value) == 16);
+
+
+// call f with the unboxed contents of value
+template<typename F>
+constexpr decltype(auto) visit(F&& f, const Value& value)
 {
-	return std::visit(overloaded{
-		[](const NullValue& v1, const NullValue& v2) { return size_t{0}; },
-		[](const bool val) { return std::hash<bool>{}(val); },
-		[](const Integer val) { return std::hash<int64_t>{}(val); },
-		[](const String& val) { return std::hash<std::string>{}(val); },
-		[](const BoundFunction& val) { return size_t{0}; },	// TODO: ?
-		[](const Array& val) {
-			size_t h = 0;
-			for (const auto& value : val)
-				h ^= ValueHash{}(value);
-			return h;
-		},
-		[](const Hash& val) { 
-			size_t h = 0;
-			for (const auto& [key, value] : val)
-				h ^= ValueHash{}(key) ^ ValueHash{}(value);
-			return h;
-		},
-		[](const auto& val) { return size_t{0}; }
-	}, value.data);
+	switch (value.type()) {
+		case ValueType::Bool:     return f(value.get<bool>());
+		case ValueType::Integer:  return f(value.get<Integer>());
+		case ValueType::String:   return f(value.get<String>());
+		case ValueType::Function: return f(value.get<BoundFunction>());
+		case ValueType::Array:    return f(value.get<Array>());
+		case ValueType::Hash:     return f(value.get<Hash>());
+		default:                  return f(value.get<NullValue>());
+	}
 }
 
-
-inline constexpr bool operator==(const Value& v1, const Value& v2)
+template<typename F>
+constexpr decltype(auto) visit(F&& f, const Value& value1, const Value& value2)
 {
-	return std::visit(overloaded{
-		[](const NullValue& v1, const NullValue& v2) { return true; },
-		[](const bool v1, const bool v2) { return v1 == v2; },
-		[](const Integer v1, const Integer v2) { return v1 == v2; },
-		[](const String& v1, const String& v2) { return v1 == v2; },
-		[](const BoundFunction& v1, const BoundFunction& v2) { return false; },	// TODO: ?
-		[](const Array& v1, const Array& v2) {
-			return v1.size() == v2.size() && std::equal(v1.begin(), v1.end(), v2.begin());
-		},
-		[](const Hash& v1, const Hash& v2) {
-			return v1.size() == v2.size() && std::equal(v1.begin(), v1.end(), v2.begin());
-		},
-		[](const auto& v1, const auto& v2) { return false; }
-	}, v1.data, v2.data);
+	return visit([&f, &value2](const auto& v1) -> decltype(auto) {
+		return visit([&f, &v1](const auto& v2) -> decltype(auto) {
+			return f(v1, v2);
+		}, value2);
+	}, value1);
 }
 
 
+bool operator==(const Value& v1, const Value& v2);
+
 std::ostream& operator<<(std::ostream& os, const Value& value);
+
+#include "array.hpp"
+#include "hash.hpp"
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "value.hpp"
+#include "environment.hpp"
+
+// bytecode for the stack vm. operands are 16-bit, little-endian, and follow the opcode byte.
+
+enum class OpCode : uint8_t
+{
+	Constant,       // u16 constant index      -> value
+	Nil,            //                         -> nil
+	True,           //                         -> true
+	False,          //                         -> false
+	Pop,            // value                   ->
+
+	GetLocal,       // u16 slot                -> value
+	SetLocal,       // u16 slot, value         ->
+	GetOuter,       // u16 depth, u16 slot     -> value
+	GetGlobal,      // u16 depth, u16 name     -> value
+	SetGlobal,      // u16 name index, value   ->
+
+	Closure,        // u16 function index      -> fn
+
+	Negate,         // value                   -> -value
+	Not,            // value                   -> !value
+	BitNot,         // value                   -> ~value
+
+	Add,            // left, right             -> left + right
+	Subtract,
+	Multiply,
+	Divide,
+	Modulo,
+	BitAnd,
+	BitOr,
+	BitEor,
+	Less,
+	Greater,
+	LessEqual,
+	GreaterEqual,
+	Equal,
+	NotEqual,
+	And,
+	Or,
+
+	Array,          // u16 count, elements     -> array
+	Hash,           // u16 count, key/values   -> hash
+	Index,          // container, index        -> element
+
+	Jump,           // u16 forward offset
+	JumpIfFalse,    // u16 forward offset, condition ->
+	JumpIfGlobal,   // u16 depth, u16 name index, u16 function index, u16 forward offset : jump if the global is a closure of that function
+
+	Call,           // u16 argc, fn, args      -> result
+	TailCall,       // u16 argc, fn, args      -> result, replacing the current frame for interpreted functions
+	Return,         // value                   -> (caller) value
+};
+
+struct Chunk
+{
+	std::vector<uint8_t> code;
+	std::vector<Value> constants;
+	std::vector<std::string> names;
+	std::unique_ptr<GlobalCache[]> caches;	// GetGlobal's inline cache, per name
+	std::vector<const AbstractFunctionExpression*> functions;
+	size_t slots = 0;	// frame size of a function body
+};
@@ -0,0 +1,379 @@
+#include <stdexcept>
+#include <mutex>
+
+#include "compiler.hpp"
+#include "expression.hpp"
+#include "statement.hpp"
+#include "program.hpp"
+#include "builtins.hpp"
+
+
+// Compiler
+
+std::shared_ptr<const Chunk> Compiler::compile(const Expression& body, size_t slots)
+{
+	auto chunk = std::make_shared<Chunk>();
+	chunk->slots = slots;
+	Compiler compiler{*chunk};
+	body.compileTail(compiler);
+	chunk->caches = std::make_unique<GlobalCache[]>(chunk->names.size());
+	return chunk;
+}
+
+std::shared_ptr<const Chunk> Compiler::compile(const std::vector<std::unique_ptr<Expression>>& statements)
+{
+	auto chunk = std::make_shared<Chunk>();
+	Compiler compiler{*chunk};
+	compiler.statements(statements);
+	compiler.emit(OpCode::Return);
+	chunk->caches = std::make_unique<GlobalCache[]>(chunk->names.size());
+	return chunk;
+}
+
+void Compiler::emit(OpCode op)
+{
+	chunk.code.push_back(static_cast<uint8_t>(op));
+}
+
+void Compiler::emit(OpCode op, uint16_t operand)
+{
+	emit(op);
+	chunk.code.push_back(static_cast<uint8_t>(operand & 0xff));
+	chunk.code.push_back(static_cast<uint8_t>(operand >> 8));
+}
+
+void Compiler::emit(OpCode op, uint16_t operand1, uint16_t operand2)
+{
+	emit(op, operand1);
+	chunk.code.push_back(static_cast<uint8_t>(operand2 & 0xff));
+	chunk.code.push_back(static_cast<uint8_t>(operand2 >> 8));
+}
+
+void Compiler::emit(OpCode op, uint16_t operand1, uint16_t operand2, uint16_t operand3)
+{
+	emit(op, operand1, operand2);
+	chunk.code.push_back(static_cast<uint8_t>(operand3 & 0xff));
+	chunk.code.push_back(static_cast<uint8_t>(operand3 >> 8));
+}
+
+void Compiler::emit(OpCode op, uint16_t operand1, uint16_t operand2, uint16_t operand3, uint16_t operand4)
+{
+	emit(op, operand1, operand2, operand3);
+	chunk.code.push_back(static_cast<uint8_t>(operand4 & 0xff));
+	chunk.code.push_back(static_cast<uint8_t>(operand4 >> 8));
+}
+
+void Compiler::emit(const BuiltinBinaryFunctionExpression& fn)
+{
+	using B = BuiltinBinaryFunctionExpression;
+	static const std::pair<const B*, OpCode> ops[] {
+		{ &B::asterisk, OpCode::Multiply     },
+		{ &B::slash,    OpCode::Divide       },
+		{ &B::percent,  OpCode::Modulo       },
+		{ &B::plus,     OpCode::Add          },
+		{ &B::minus,    OpCode::Subtract     },
+		{ &B::bitAnd,   OpCode::BitAnd       },
+		{ &B::bitOr,    OpCode::BitOr        },
+		{ &B::bitEor,   OpCode::BitEor       },
+		{ &B::lt,       OpCode::Less         },
+		{ &B::gt,       OpCode::Greater      },
+		{ &B::le,       OpCode::LessEqual    },
+		{ &B::ge,       OpCode::GreaterEqual },
+		{ &B::eq,       OpCode::Equal        },
+		{ &B::neq,      OpCode::NotEqual     },
+		{ &B::and_,     OpCode::And          },
+		{ &B::or_,      OpCode::Or           },
+	};
+	for (const auto& [builtin, op] : ops) {
+		if (builtin == &fn)
+			return emit(op);
+	}
+	throw std::runtime_error("can't compile infix operator " + fn.name);
+}
+
+size_t Compiler::emitJump(OpCode op)
+{
+	emit(op, 0);
+	return offset();
+}
+
+size_t Compiler::offset() const noexcept
+{
+	return chunk.code.size();
+}
+
+void Compiler::patchJump(size_t offset)
+{
+	const auto distance = chunk.code.size() - offset;
+	if (distance > UINT16_MAX)
+		throw std::runtime_error("jump too large");
+	chunk.code[offset - 2] = static_cast<uint8_t>(distance & 0xff);
+	chunk.code[offset - 1] = static_cast<uint8_t>(distance >> 8);
+}
+
+uint16_t Compiler::constant(Value&& value)
+{
+	if (chunk.constants.size() > UINT16_MAX)
+		throw std::runtime_error("too many constants");
+	chunk.constants.push_back(std::move(value));
+	return static_cast<uint16_t>(chunk.constants.size() - 1);
+}
+
+uint16_t Compiler::operand(size_t value)
+{
+	if (value > UINT16_MAX)
+		throw std::runtime_error("operand too large");
+	return static_cast<uint16_t>(value);
+}
+
+uint16_t Compiler::name(std::string_view name)
+{
+	for (size_t i = 0; i < chunk.names.size(); i++) {
+		if (chunk.names[i] == name)
+			return static_cast<uint16_t>(i);
+	}
+	if (chunk.names.size() > UINT16_MAX)
+		throw std::runtime_error("too many names");
+	chunk.names.emplace_back(name);
+	return static_cast<uint16_t>(chunk.names.size() - 1);
+}
+
+uint16_t Compiler::function(const AbstractFunctionExpression* function)
+{
+	if (chunk.functions.size() > UINT16_MAX)
+		throw std::runtime_error("too many functions");
+	chunk.functions.push_back(function);
+	return static_cast<uint16_t>(chunk.functions.size() - 1);
+}
+
+void Compiler::statements(const std::vector<std::unique_ptr<Expression>>& statements)
+{
+	if (statements.empty())
+		return emit(OpCode::Nil);
+
+	auto first = true;
+	for (const auto& statement : statements) {
+		if (!first)
+			emit(OpCode::Pop);
+		first = false;
+		statement->compile(*this);
+	}
+}
+
+
+// Expressions
+
+void Expression::compileTail(Compiler& compiler) const
+{
+	compile(compiler);
+	compiler.emit(OpCode::Return);
+}
+
+void BinaryExpression::compile(Compiler& compiler) const
+{
+	left->compile(compiler);
+	right->compile(compiler);
+	compiler.emit(fn);
+}
+
+void UnaryExpression::compile(Compiler& compiler) const
+{
+	value->compile(compiler);
+	switch(op) {
+		case TokenType::Minus: return compiler.emit(OpCode::Negate);
+		case TokenType::Bang:  return compiler.emit(OpCode::Not);
+		case TokenType::Tilde: return compiler.emit(OpCode::BitNot);
+	}
+	throw std::runtime_error("invalid unary operation: " + std::to_string(op));
+}
+
+void CallExpression::compile(Compiler& compiler) const
+{
+	function->compile(compiler);
+	for (const auto& argument : arguments)
+		argument->compile(compiler);
+	compiler.emit(OpCode::Call, compiler.operand(arguments.size()));
+}
+
+// a TailCall to a native function leaves its result for the Return
+void CallExpression::compileTail(Compiler& compiler) const
+{
+	function->compile(compiler);
+	for (const auto& argument : arguments)
+		argument->compile(compiler);
+	compiler.emit(OpCode::TailCall, compiler.operand(arguments.size()));
+	compiler.emit(OpCode::Return);
+}
+
+void AbstractFunctionExpression::compile(Compiler& compiler) const
+{
+	compiler.emit(OpCode::Closure, compiler.function(this));
+}
+
+const Chunk* FunctionExpression::code() const
+{
+	if (const auto* code = compiled.load(std::memory_order_acquire))
+		return code;
+
+	materialize();
+	static std::mutex compiling;
+	std::lock_guard lock{compiling};
+	if (!chunk) {
+		chunk = Compiler::compile(*body, slots);
+		compiled.store(chunk.get(), std::memory_order_release);
+	}
+	return chunk.get();
+}
+
+void IdentifierExpression::compile(Compiler& compiler) const
+{
+	if (slot == Scope::global)
+		compiler.emit(OpCode::GetGlobal, compiler.operand(depth), compiler.name(identifier));
+	else if (depth == 0)
+		compiler.emit(OpCode::GetLocal, compiler.operand(slot));
+	else
+		compiler.emit(OpCode::GetOuter, compiler.operand(depth), compiler.operand(slot));
+}
+
+void IntegerLiteralExpression::compile(Compiler& compiler) const
+{
+	compiler.emit(OpCode::Constant, compiler.constant(Value{value}));
+}
+
+void BooleanLiteralExpression::compile(Compiler& compiler) const
+{
+	compiler.emit(value ? OpCode::True : OpCode::False);
+}
+
+void StringLiteralExpression::compile(Compiler& compiler) const
+{
+	compiler.emit(OpCode::Constant, compiler.constant(Value{value}));
+}
+
+void ArrayLiteralExpression::compile(Compiler& compiler) const
+{
+	for (const auto& element : elements)
+		element->compile(compiler);
+	compiler.emit(OpCode::Array, compiler.operand(elements.size()));
+}
+
+void IndexExpression::compile(Compiler& compiler) const
+{
+	array->compile(compiler);
+	index->compile(compiler);
+	compiler.emit(OpCode::Index);
+}
+
+void HashLiteralExpression::compile(Compiler& compiler) const
+{
+	for (const auto& [key, value] : elements) {
+		key->compile(compiler);
+		value->compile(compiler);
+	}
+	compiler.emit(OpCode::Hash, compiler.operand(elements.size()));
+}
+
+
+// Statements
+
+void LetStatement::compile(Compiler& compiler) const
+{
+	value->compile(compiler);
+	if (slot == Scope::global)
+		compiler.emit(OpCode::SetGlobal, compiler.name(name));
+	else
+		compiler.emit(OpCode::SetLocal, compiler.operand(slot));
+	compiler.emit(OpCode::Nil);
+}
+
+void ReturnStatement::compile(Compiler& compiler) const
+{
+	value->compile(compiler);
+	compiler.emit(OpCode::Return);
+}
+
+void ReturnStatement::compileTail(Compiler& compiler) const
+{
+	value->compileTail(compiler);
+}
+
+void InlinedCallExpression::compile(Compiler& compiler) const
+{
+	compiler.emit(OpCode::JumpIfGlobal, compiler.operand(callee->scopeDepth()), compiler.name(callee->name()), compiler.function(&function), 0);
+	const auto inlinedJump = compiler.offset();
+
+	call->compile(compiler);
+	const auto endJump = compiler.emitJump(OpCode::Jump);
+
+	compiler.patchJump(inlinedJump);
+	body->compile(compiler);
+
+	compiler.patchJump(endJump);
+}
+
+void InlinedCallExpression::compileTail(Compiler& compiler) const
+{
+	compiler.emit(OpCode::JumpIfGlobal, compiler.operand(callee->scopeDepth()), compiler.name(callee->name()), compiler.function(&function), 0);
+	const auto inlinedJump = compiler.offset();
+
+	call->compileTail(compiler);
+
+	compiler.patchJump(inlinedJump);
+	body->compileTail(compiler);
+}
+
+void IfStatement::compile(Compiler& compiler) const
+{
+	condition->compile(compiler);
+	const auto elseJump = compiler.emitJump(OpCode::JumpIfFalse);
+
+	consequence->compile(compiler);
+	const auto endJump = compiler.emitJump(OpCode::Jump);
+
+	compiler.patchJump(elseJump);
+	if (alternative)
+		alternative->compile(compiler);
+	else
+		compiler.emit(OpCode::Nil);
+
+	compiler.patchJump(endJump);
+}
+
+void IfStatement::compileTail(Compiler& compiler) const
+{
+	condition->compile(compiler);
+	const auto elseJump = compiler.emitJump(OpCode::JumpIfFalse);
+
+	consequence->compileTail(compiler);
+
+	compiler.patchJump(elseJump);
+	if (alternative) {
+		alternative->compileTail(compiler);
+	}
+	else {
+		compiler.emit(OpCode::Nil);
+		compiler.emit(OpCode::Return);
+	}
+}
+
+void StatementList::compile(Compiler& compiler) const
+{
+	compiler.statements(statements);
+}
+
+void StatementList::compileTail(Compiler& compiler) const
+{
+	if (statements.empty())
+		return Expression::compileTail(compiler);
+
+	for (auto iter = statements.begin(); iter != statements.end() - 1; ++iter) {
+		(*iter)->compile(compiler);
+		compiler.emit(OpCode::Pop);
+	}
+	statements.back()->compileTail(compiler);
+}
+
+void Program::compile(Compiler& compiler) const
+{
+	compiler.statements(statements);
+}
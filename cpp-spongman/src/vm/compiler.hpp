@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+
+#include "chunk.hpp"
+
+struct Expression;
+struct BuiltinBinaryFunctionExpression;
+
+struct Compiler
+{
+	Compiler(Chunk& chunk)
+	: chunk{chunk} {}
+
+	// compile a function body or top-level statement into a self-contained chunk ending in Return
+	static std::shared_ptr<const Chunk> compile(const Expression& body, size_t slots = 0);
+	static std::shared_ptr<const Chunk> compile(const std::vector<std::unique_ptr<Expression>>& statements);
+
+	void emit(OpCode op);
+	void emit(OpCode op, uint16_t operand);
+	void emit(OpCode op, uint16_t operand1, uint16_t operand2);
+	void emit(OpCode op, uint16_t operand1, uint16_t operand2, uint16_t operand3);
+	void emit(OpCode op, uint16_t operand1, uint16_t operand2, uint16_t operand3, uint16_t operand4);
+	void emit(const BuiltinBinaryFunctionExpression& fn);
+
+	// jumps are patched at the offset just past their last operand
+	size_t emitJump(OpCode op);
+	void patchJump(size_t offset);
+	size_t offset() const noexcept;
+
+	uint16_t constant(Value&& value);
+	uint16_t operand(size_t value);
+	uint16_t name(std::string_view name);
+	uint16_t function(const AbstractFunctionExpression* function);
+
+	void statements(const std::vector<std::unique_ptr<Expression>>& statements);
+
+private:
+	Chunk& chunk;
+};
@@ -0,0 +1,316 @@
+#include <iostream>
+#include <iterator>
+#include <functional>
+
+#include "vm.hpp"
+#include "compiler.hpp"
+#include "expression.hpp"
+#include "statement.hpp"
+#include "builtins.hpp"
+#include "environment.hpp"
+#include "stack.hpp"
+#include "memo.hpp"
+
+
+Value VM::run(const Expression& statement, EnvironmentP env)
+{
+	const auto chunk = Compiler::compile(statement);
+	return execute(*chunk, std::move(env));
+}
+
+Value VM::run(const std::vector<std::unique_ptr<Expression>>& statements, EnvironmentP env)
+{
+	const auto chunk = Compiler::compile(statements);
+	return execute(*chunk, std::move(env));
+}
+
+Value VM::run(const AbstractFunctionExpression& function, EnvironmentP locals)
+{
+	return execute(*function.code(), std::move(locals));
+}
+
+size_t VM::frameBytes(const Chunk& chunk) noexcept
+{
+	return sizeof(Frame) + sizeof(Environment) + chunk.slots * sizeof(Value);
+}
+
+template<typename F>
+void VM::binary(const BuiltinBinaryFunctionExpression& fn, F integerOp)
+{
+	const auto right = std::move(stack.back());
+	stack.pop_back();
+	auto& left = stack.back();
+
+	if (left.is<Integer>() && right.is<Integer>())
+		left = Value{integerOp(left.get<Integer>(), right.get<Integer>())};
+	else
+		left = fn.call(left, right);
+}
+
+// a tail call replaces the calling frame, reusing its Environment when nothing has captured it.
+// false if the call failed, with the error on top of the stack
+bool VM::call(uint16_t argc, bool tail)
+{
+	const auto calleeIndex = stack.size() - argc - 1;
+	if (!stack[calleeIndex].is<BoundFunction>()) {
+		stack.push_back(CallExpression::notCallable(stack[calleeIndex]));
+		return false;
+	}
+	const auto& [fn, closureEnv] = stack[calleeIndex].get<BoundFunction>();
+
+	if (const auto* chunk = fn->code()) {
+		if (tail)
+			Stack::release(frameBytes(*frames.back().chunk));
+		if (!Stack::reserve(frameBytes(*chunk))) {
+			stack.push_back(Stack::overflow());
+			return false;
+		}
+
+		EnvironmentP locals;
+		if (tail && frames.back().env.use_count() == 1) {
+			locals = std::move(frames.back().env);
+			locals->reset(closureEnv, chunk->slots);
+		}
+		else {
+			locals = Environment::frame(closureEnv, chunk->slots);
+		}
+
+		const auto count = std::min<size_t>(fn->params().size(), argc);
+		for (size_t i = 0; i < count; i++)
+			(*locals)[i] = std::move(stack[calleeIndex + 1 + i]);
+
+		if (tail) {
+			auto& frame = frames.back();
+			stack.resize(frame.base);
+			frame = {chunk, chunk->code.data(), std::move(locals), frame.base};
+		}
+		else {
+			frames.push_back({chunk, chunk->code.data(), std::move(locals), calleeIndex});
+		}
+		return true;
+	}
+
+	auto result = fn->apply(closureEnv, Arguments{stack.data() + calleeIndex + 1, argc});
+	stack.resize(calleeIndex);
+	stack.push_back(std::move(result));
+	return !stack.back().failed();
+}
+
+Value VM::execute(const Chunk& chunk, EnvironmentP env)
+{
+	using B = BuiltinBinaryFunctionExpression;
+
+	// the frames this run accounts for, whichever way it ends. the native stack is only used by
+	// calls to builtins, which may call back into a VM
+	const Stack::Mark mark;
+	if (Stack::exhausted() || !Stack::reserve(frameBytes(chunk)))
+		return Stack::overflow();
+
+	stack.clear();
+	frames.clear();
+	frames.push_back({&chunk, chunk.code.data(), std::move(env), 0});
+
+	auto* frame = &frames.back();
+	const auto readShort = [&frame]() {
+		const uint16_t operand = frame->ip[0] | (frame->ip[1] << 8);
+		frame->ip += 2;
+		return operand;
+	};
+	const auto pop = [this]() {
+		auto value = std::move(stack.back());
+		stack.pop_back();
+		return value;
+	};
+
+	// a global, through the chunk's inline cache. found is the global environment of the frame
+	const auto global = [&frame](const Environment& found, uint16_t index) -> const Value& {
+		const auto& env = Environment::resolve(found);
+		auto& cache = frame->chunk->caches[index];
+		const auto version = env.version();
+		if (const auto* binding = cache.get(version))
+			return *binding;
+
+		const auto& name = frame->chunk->names[index];
+		const auto& value = env.get(name);
+		if (value.is<NullValue>())
+			std::cout << "WARNING: identifier '" + name + "' not found\n";
+		else
+			cache.set(version, value);
+		return value;
+	};
+
+	// a failing instruction leaves its error on top of the stack, which unwinds every frame
+	const auto failed = [this]() {
+		return stack.back().failed();
+	};
+	const auto unwind = [this]() {
+		auto error = std::move(stack.back());
+		stack.clear();
+		frames.clear();
+		return error;
+	};
+
+	for (;;) {
+		switch (static_cast<OpCode>(*frame->ip++)) {
+			case OpCode::Constant:
+				stack.push_back(frame->chunk->constants[readShort()]);
+				continue;
+			case OpCode::Nil:
+				stack.emplace_back();
+				continue;
+			case OpCode::True:
+				stack.push_back(Value{true});
+				continue;
+			case OpCode::False:
+				stack.push_back(Value{false});
+				continue;
+			case OpCode::Pop:
+				stack.pop_back();
+				continue;
+
+			case OpCode::GetLocal:
+				stack.push_back((*frame->env)[readShort()]);
+				continue;
+			case OpCode::SetLocal:
+				(*frame->env)[readShort()] = pop();
+				continue;
+			case OpCode::GetOuter:
+			{
+				const auto depth = readShort();
+				stack.push_back(frame->env->outer(depth)[readShort()]);
+				continue;
+			}
+			case OpCode::GetGlobal:
+			{
+				const auto& env = frame->env->outer(readShort());
+				stack.push_back(global(env, readShort()));
+				continue;
+			}
+			case OpCode::SetGlobal:
+			{
+				const auto& name = frame->chunk->names[readShort()];
+				frame->env->set(name, MemoFunctionExpression::define(*frame->env, name, pop()));
+				continue;
+			}
+
+			case OpCode::Closure:
+				stack.push_back(frame->chunk->functions[readShort()]->eval(*frame->env));
+				continue;
+
+			case OpCode::Negate: stack.back() = UnaryExpression::apply(TokenType::Minus, stack.back()); break;
+			case OpCode::Not:    stack.back() = UnaryExpression::apply(TokenType::Bang,  stack.back()); break;
+			case OpCode::BitNot: stack.back() = UnaryExpression::apply(TokenType::Tilde, stack.back()); break;
+
+			case OpCode::Add:          binary(B::plus,     std::plus<Integer>{});          break;
+			case OpCode::Subtract:     binary(B::minus,    std::minus<Integer>{});         break;
+			case OpCode::Multiply:     binary(B::asterisk, std::multiplies<Integer>{});    break;
+			case OpCode::Divide:       binary(B::slash,    std::divides<Integer>{});       break;
+			case OpCode::Modulo:       binary(B::percent,  std::modulus<Integer>{});       break;
+			case OpCode::BitAnd:       binary(B::bitAnd,   std::bit_and<Integer>{});       break;
+			case OpCode::BitOr:        binary(B::bitOr,    std::bit_or<Integer>{});        break;
+			case OpCode::BitEor:       binary(B::bitEor,   std::bit_xor<Integer>{});       break;
+			case OpCode::Less:         binary(B::lt,       std::less<Integer>{});          break;
+			case OpCode::Greater:      binary(B::gt,       std::greater<Integer>{});       break;
+			case OpCode::LessEqual:    binary(B::le,       std::less_equal<Integer>{});    break;
+			case OpCode::GreaterEqual: binary(B::ge,       std::greater_equal<Integer>{}); break;
+			case OpCode::Equal:        binary(B::eq,       std::equal_to<Integer>{});      break;
+			case OpCode::NotEqual:     binary(B::neq,      std::not_equal_to<Integer>{});  break;
+			case OpCode::And:
+			{
+				const auto right = pop();
+				stack.back() = B::and_.call(stack.back(), right);
+				break;
+			}
+			case OpCode::Or:
+			{
+				const auto right = pop();
+				stack.back() = B::or_.call(stack.back(), right);
+				break;
+			}
+
+			case OpCode::Array:
+			{
+				const auto count = readShort();
+				Array array(
+					std::make_move_iterator(stack.end() - count),
+					std::make_move_iterator(stack.end())
+				);
+				stack.resize(stack.size() - count);
+				stack.push_back(Value{std::move(array)});
+				continue;
+			}
+			case OpCode::Hash:
+			{
+				const auto count = readShort();
+				Hash hash{};
+				for (auto iter = stack.end() - 2 * count; iter != stack.end(); iter += 2)
+					hash.emplace(std::move(iter[0]), std::move(iter[1]));
+				stack.resize(stack.size() - 2 * count);
+				stack.push_back(Value{std::move(hash)});
+				continue;
+			}
+			case OpCode::Index:
+			{
+				const auto index = pop();
+				stack.back() = IndexExpression::lookup(stack.back(), index);
+				break;
+			}
+
+			case OpCode::Jump:
+			{
+				const auto offset = readShort();
+				frame->ip += offset;
+				continue;
+			}
+			case OpCode::JumpIfFalse:
+			{
+				const auto offset = readShort();
+				stack.back() = IfStatement::truthy(stack.back());
+				if (failed())
+					return unwind();
+				if (!pop().get<bool>())
+					frame->ip += offset;
+				continue;
+			}
+
+			case OpCode::JumpIfGlobal:
+			{
+				const auto& env = frame->env->outer(readShort());
+				const auto& callee = global(env, readShort());
+				const auto* function = frame->chunk->functions[readShort()];
+				const auto offset = readShort();
+				if (callee.is<BoundFunction>() && callee.get<BoundFunction>().first == function)
+					frame->ip += offset;
+				continue;
+			}
+
+			case OpCode::Call:
+				if (!call(readShort()))
+					return unwind();
+				frame = &frames.back();
+				continue;
+			case OpCode::TailCall:
+				if (!call(readShort(), true))
+					return unwind();
+				frame = &frames.back();
+				continue;
+
+			case OpCode::Return:
+			{
+				auto result = pop();
+				stack.resize(frame->base);
+				Stack::release(frameBytes(*frame->chunk));
+				frames.pop_back();
+				if (frames.empty())
+					return result;
+				frame = &frames.back();
+				stack.push_back(std::move(result));
+				continue;
+			}
+		}
+
+		// only the instructions that can fail break out of the switch
+		if (failed())
+			return unwind();
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "value.hpp"
+#include "chunk.hpp"
+
+struct Expression;
+struct AbstractFunctionExpression;
+struct BuiltinBinaryFunctionExpression;
+
+struct VM
+{
+	Value run(const Expression& statement, EnvironmentP env);
+	Value run(const std::vector<std::unique_ptr<Expression>>& statements, EnvironmentP env);
+	// call function, whose frame is locals, as the tree walk does when the native stack gets deep
+	Value run(const AbstractFunctionExpression& function, EnvironmentP locals);
+
+private:
+	struct Frame
+	{
+		const Chunk* chunk;
+		const uint8_t* ip;
+		EnvironmentP env;
+		size_t base;
+	};
+
+	Value execute(const Chunk& chunk, EnvironmentP env);
+	bool call(uint16_t argc, bool tail = false);
+
+	// the heap a frame of chunk takes, as accounted for by Stack
+	static size_t frameBytes(const Chunk& chunk) noexcept;
+
+	template<typename F>
+	void binary(const BuiltinBinaryFunctionExpression& fn, F integerOp);
+
+	std::vector<Value> stack;
+	std::vector<Frame> frames;
+};
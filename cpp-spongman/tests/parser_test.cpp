@@ -1,26 +1,44 @@
 
 #include <iostream>
+#include <sstream>
+#include <fstream>
 #include <utility>
+#include <array>
+#include <thread>
+#include <filesystem>
+#include <pthread.h>
 #include <gtest/gtest.h>
 
 #include "lexer.hh"
 #include "program.hpp"
+#include "pool.hpp"
+#include "snapshot.hpp"
+#include "collector.hpp"
+#include "stack.hpp"
+#include "memo.hpp"
 
 
-auto testEval(std::string str, const Value& expected)
+auto testEval(std::string str, const Value& expected, Engine engine)
 {
 	try {
 		Lexer lexer{str};
 		auto program = Program::parse(lexer);
-		auto val = program->run();
+		auto val = program->run(engine);
 
-		ASSERT_EQ(val.data, expected.data) << str;
+		ASSERT_FALSE(val.failed()) << val << " : " << str;
+		ASSERT_EQ(val, expected) << str;
 	} catch (const std::exception& ex) {
 		FAIL() << ex.what() << " : " << str;
 		throw;
 	}
 }
 
+void testEval(std::string str, const Value& expected)
+{
+	testEval(str, expected, Engine::Ast);
+	testEval(str, expected, Engine::Vm);
+}
+
 void runTests(const std::vector<std::pair<std::string, Value>>& tests)
 {
 	for (const auto& [program, expected] : tests)
@@ -150,6 +168,54 @@ TEST(TestLexer, TestReturnStatements) {
 }
 
 
+TEST(TestLexer, TestRuntimeErrors) {
+
+	const auto testError = [](const std::string& str, const std::string& message) {
+		for (const auto engine : { Engine::Ast, Engine::Vm }) {
+			Lexer lexer{str};
+			auto program = Program::parse(lexer);
+			const auto val = program->run(engine);
+
+			ASSERT_TRUE(val.failed()) << val << " : " << str;
+			EXPECT_NE(val.get<String>().find(message), std::string::npos) << val << " : " << str;
+		}
+	};
+
+	testError("5 + true; 5", "invalid infix operation");
+	testError("let f = fn(x) { if (x) { 1 } }; let g = fn() { f(\"a\") + 1 }; g()", "invalid condition");
+	testError("let f = fn(n) { if (n == 0) { -true } else { f(n - 1) } }; f(10)", "invalid unary operation");
+	testError("let x = 1; x(2)", "not a function");
+	testError("len(1)", "invalid argument to len()");
+	testError("len(\"one\", \"two\")", "wrong number of arguments to len(): 2");
+	testError("put({}, 1)", "wrong number of arguments to put(): 2");
+	testError("put([], 1, 2)", "invalid argument to put()");
+	testError("keys([1])", "invalid argument to keys()");
+	testError("has(1, 1)", "invalid argument to has()");
+	testError("rest()", "wrong number of arguments to rest(): 0");
+	testError("len([1, 2 * \"a\"])", "invalid infix operation");
+	testError("puts(1, 2, 3, 4, 5, 6 * \"a\")", "invalid infix operation");
+	testError("[1, 2 * \"a\", 3]", "invalid infix operation");
+	testError("1[0]", "can't index into");
+
+	// more elements or arguments than a vm operand counts fail to compile, instead of wrapping around
+	std::string elements = "x", pairs = "x: x";
+	for (size_t i = 0; i < UINT16_MAX; i++) {
+		elements += ", x";
+		pairs += ", x: x";
+	}
+	for (const auto& str : { "let x = 1; len([" + elements + "])", "let x = 1; {" + pairs + "}", "let x = 1; len(" + elements + ")" }) {
+		Lexer lexer{str};
+		auto program = Program::parse(lexer);
+		try {
+			program->run(Engine::Vm);
+			ADD_FAILURE() << "compiled " << str.size() << " characters";
+		}
+		catch (const std::runtime_error& ex) {
+			EXPECT_STREQ(ex.what(), "operand too large");
+		}
+	}
+}
+
 TEST(TestLexer, TestLetStatements2) {
 
 	runTests({
@@ -187,6 +253,185 @@ TEST(TestLexer, TestClosures) {
 	});
 }
 
+TEST(TestLexer, TestLexicalScopes) {
+
+	runTests({
+		{"let x = 1; let f = fn(x) { x * 10 }; f(2) + x", Value{21}},
+		{"let x = 1; let f = fn() { x }; let x = 2; f()", Value{2}},
+		{"let f = fn() { let g = fn() { h() }; let h = fn() { 3 }; g() }; f()", Value{3}},
+		{"let f = fn(n) { let loop = fn(i, r) { if (i > n) { r } else { loop(i + 1, r * i) } }; loop(1, 1) }; f(5)", Value{120}},
+		{"let f = fn(a) { fn(b) { fn(c) { a * 100 + b * 10 + c } } }; let g = f(1); let h = g(2); h(3)", Value{123}},
+		{"let f = fn(a, b) { if (a > b) { let m = a } else { let m = b }; m }; f(3, 7) + f(9, 2)", Value{16}},
+		{"let y = 1; let k = fn() { let z = y; let y = 2; z }; k()", Value{1}},
+		{"let y = 1; let k = fn() { let y = y + 1; y }; k() + y", Value{3}},
+		{"let k = fn(y) { fn() { let z = y; let y = 2; z + y } }; let h = k(1); h()", Value{3}},
+		{"let k = fn(y) { let g = fn() { let z = y; let y = 5; z }; let y = 2; g() }; k(1)", Value{2}},
+	});
+}
+
+TEST(TestLexer, TestFlatClosures) {
+
+	// closures copy what they capture when they can't see it change, and keep the frame they're made in when they can
+	runTests({
+		{"let f = fn(x) { let g = fn() { x }; let x = 2; g() }; f(1)", Value{2}},
+		{"let f = fn() { let g = fn() { let h = fn() { k }; h() }; let k = 10; g() }; f()", Value{10}},
+		{"let f = fn(a) { let b = a + 1; let g = fn() { let h = fn() { a + b }; h }; let b = 100; let h = g(); h() }; f(1)", Value{101}},
+		{"let f = fn(n) { let e = fn(i) { if (i == 0) { true } else { o(i - 1) } }; let o = fn(i) { if (i == 0) { false } else { e(i - 1) } }; e(n) }; f(7)", Value{false}},
+		{"let f = fn(x) { let x = x + 1; fn() { x } }; let g = f(1); g()", Value{2}},
+		{"let f = fn(x) { let g = fn(k) { if (k == 0) { x } else { g(k - 1) } }; let h = fn() { g(3) + x }; h() }; f(4)", Value{8}},
+		{"let f = fn(x) { map(fn(y) { x * y }, [1, 2, 3]) }; f(3)", Value{ Array{ Value{3}, Value{6}, Value{9} } }},
+		{R"(
+			let f = fn(a, b) {
+				let c = a * b;
+				let d = fn(e) {
+					let g = fn(h) { h + e + a + b + c + a + b + c + a + b + c };
+					if (e == 0) { 0 } else { g(1) + d(e - 1) }
+				};
+				d(2)
+			}
+			f(1, 2)
+		)", Value{35}},
+	});
+
+	// neither keeps the frame of f's call, which refers to a's array twice: one captures xs, the other nothing
+	const auto str = R"XXX(
+		let a = [1, 2, 3];
+		let f = fn(xs) { let ys = xs; [fn(k) { k + len(xs) }, fn(k) { k * 2 }] };
+		let gs = f(a);
+		let g = gs[0];
+		let h = gs[1];
+		[g(1), h(1)]
+	)XXX";
+	for (const auto engine : {Engine::Ast, Engine::Vm}) {
+		Lexer lexer{str};
+		auto program = Program::parse(lexer);
+		ASSERT_EQ(program->run(engine), (Value{ Array{ Value{4}, Value{2} } }));
+		EXPECT_EQ(program->global->get("a").object()->refcount(), 2);
+		EXPECT_EQ(program->global->get("h").get<BoundFunction>().second, program->global);
+	}
+}
+
+
+TEST(TestLexer, TestTailCalls) {
+
+	runTests({
+		{"let count = fn(n, r) { if (n == 0) { r } else { count(n - 1, r + 1) } }; count(200000, 0)", Value{200000}},
+		{"let count = fn(n, r) { let m = n - 1; if (n == 0) { return r }; count(m, r + 1) }; count(200000, 0)", Value{200000}},
+		{"let even = fn(n) { if (n == 0) { true } else { odd(n - 1) } }; let odd = fn(n) { if (n == 0) { false } else { even(n - 1) } }; even(200001)", Value{false}},
+		{"let f = fn(n) { let g = fn() { n }; if (n == 0) { g } else { f(n - 1) } }; let g = f(1000); g()", Value{0}},
+	});
+}
+
+
+TEST(TestLexer, TestDeepRecursion) {
+
+	// on a thread with a small native stack, which the tree walk leaves for a vm early
+	const auto onSmallStack = [](void (*body)()) {
+		pthread_attr_t attributes;
+		pthread_attr_init(&attributes);
+		pthread_attr_setstacksize(&attributes, 1024 * 1024);
+		pthread_t thread;
+		ASSERT_EQ(pthread_create(&thread, &attributes, [](void* body) -> void* {
+			reinterpret_cast<void (*)()>(body)();
+			return nullptr;
+		}, reinterpret_cast<void*>(body)), 0);
+		pthread_join(thread, nullptr);
+		pthread_attr_destroy(&attributes);
+	};
+
+	onSmallStack([]() {
+		runTests({
+			{"let f = fn(n) { if (n == 0) { 0 } else { 1 + f(n - 1) } }; f(300000)", Value{300000}},
+			{"let foldr = fn(f, r, xs) { if (len(xs) == 0) { r } else { f(xs[0], foldr(f, r, rest(xs))) } }; foldr($+, 0, rep(2, 100000))", Value{200000}},
+			{"let g = fn(n) { if (n == 0) { 0 } else { 1 + foldl(fn(r, x) { r + g(x) }, 0, [n - 1]) } }; g(30)", Value{30}},
+		});
+	});
+
+	onSmallStack([]() {
+		const auto testOverflow = [](const std::string& str) {
+			for (const auto engine : { Engine::Ast, Engine::Vm }) {
+				Lexer lexer{str};
+				auto program = Program::parse(lexer);
+				const auto val = program->run(engine);
+
+				ASSERT_TRUE(val.failed()) << val << " : " << str;
+				EXPECT_EQ(val.get<String>(), "stack overflow") << str;
+
+				// the program can go on
+				Lexer more{"f(10)"};
+				program->add(more);
+				EXPECT_EQ(program->statements.back()->eval(*program->global), Value{10});
+			}
+		};
+
+		// past the limit of heap frames, and through builtins, which recurse on the native stack
+		const auto limit = Stack::limit.exchange(1 << 20);
+		testOverflow("let f = fn(n) { if (n == 0) { 0 } else { 1 + f(n - 1) } }; f(1000000)");
+		Stack::limit = limit;
+		testOverflow("let f = fn(n) { if (n == 0) { 0 } else { 1 + foldl(fn(r, x) { r + f(x) }, 0, [n - 1]) } }; f(1000000)");
+	});
+}
+
+TEST(TestLexer, TestQuickening) {
+
+	// operands change type after the nodes have specialized, which must deoptimize them
+	runTests({
+		{"let add = fn(a, b) { a + b }; let loop = fn(i, r) { if (i == 10) { r } else { loop(i + 1, add(i, r)) } }; let n = loop(0, 0); add(\"a\", \"b\") + add(n, 1)", Value{"ab46"}},
+		{"let eq = fn(a, b) { a == b }; let loop = fn(i) { if (i == 10) { eq(2, 2) } else { eq(i, 2); loop(i + 1) } }; [loop(0), eq(true, false), eq(\"a\", \"a\"), eq(1, \"1\")]", Value{Array{Value{true}, Value{false}, Value{true}, Value{false}}}},
+		{"let neg = fn(x) { -x }; let not = fn(x) { !x }; let loop = fn(i) { if (i == 10) { 0 } else { neg(i); not(false); loop(i + 1) } }; loop(0); [neg(2), not(true), not(5)]", Value{Array{Value{-2}, Value{false}, Value{false}}}},
+		{"let at = fn(a, i) { a[i] }; let loop = fn(i, r) { if (i == 10) { r } else { loop(i + 1, r + at([1, 2, 3], i % 3)) } }; [loop(0, 0), at({\"k\": 7}, \"k\"), at(\"xyz\", 1)]", Value{Array{Value{19}, Value{7}, Value{"y"}}}},
+	});
+}
+
+TEST(TestLexer, TestOptimizer) {
+
+	const auto optimized = [](const std::string& str, unsigned passes = Optimizer::levels[1]) {
+		Lexer lexer{str};
+		std::ostringstream os;
+		os << *Program::parse(lexer, passes)->statements.back();
+		return os.str();
+	};
+
+	EXPECT_EQ(optimized("1 + 2 * 3"), "7");
+	EXPECT_EQ(optimized("1 + 2 * 3", Optimizer::levels[0]), "(1 + (2 * 3))");
+	EXPECT_EQ(optimized("if (1 < 2) { \"a\" + \"b\" } else { 3 }"), "\"ab\"");
+	EXPECT_EQ(optimized("let neg = fn(a) -a; fn(x) neg(x) + neg(2)"), "fn(x)(-x + -2)");
+	EXPECT_EQ(optimized("let subtract = fn(x, y) y - x; fn(x) subtract(1, x)"), "fn(x)(x - 1)");
+	// not inlined: dropping or reordering an argument with side effects, recursion
+	EXPECT_EQ(optimized("let const = fn(a, b) a; const(1, puts(2))"), "const(1, puts(2))");
+	EXPECT_EQ(optimized("let subtract = fn(x, y) y - x; subtract(puts(1), puts(2))"), "subtract(puts(1), puts(2))");
+	// or evaluating an argument after what may fail before its parameter, as len(a) here would without printing
+	EXPECT_EQ(optimized("let f = fn(a, b) { len(a) + b }; f(5, puts(\"hi\"))"), "f(5, puts(\"hi\"))");
+	EXPECT_EQ(optimized("let add = fn(a, b) a + b; fn(x) add(x * 2, x - 1)"), "fn(x)((x * 2) + (x - 1))");
+	EXPECT_EQ(optimized("let f = fn(n) f(n); f(1)"), "f(1)");
+	// not folded: overflow
+	EXPECT_EQ(optimized("9223372036854775807 + 1"), "(9223372036854775807 + 1)");
+	EXPECT_EQ(optimized("-9223372036854775807 - 2"), "(-9223372036854775807 - 2)");
+	EXPECT_EQ(optimized("4611686018427387904 * 2"), "(4611686018427387904 * 2)");
+	EXPECT_EQ(optimized("-(-9223372036854775807 - 1)"), "--9223372036854775808");
+	EXPECT_EQ(optimized("9223372036854775806 + 1"), "9223372036854775807");
+	// as --dump prints them
+	EXPECT_EQ(optimized("{\"a\": 1 + 1, 2: [3]}"), "{\"a\":2,2:[3]}");
+	EXPECT_EQ(optimized("fn(x) { let y = x; if (y) { return y * 2 }; y }"), "fn(x){\nlet y = x;\nif (y)\n\treturn (y * 2);\ny;\n}");
+
+	runTests({
+		{"let id = fn(a) a; let id = fn(a) a + 1; id(1)", Value{2}},
+		{"let tl = fn(xs) rest(xs); let f = fn(rest) tl(rest); f([1, 2, 3])", Value{Array{Value{2}, Value{3}}}},
+		{"let snd = fn(a, b) b; let f = fn(x) { let y = x * 2; snd(x, y) }; f(4)", Value{8}},
+		{"if (false) { 1 }", Value{}},
+	});
+}
+
+TEST(TestLexer, TestRedefinition) {
+
+	// global lookups and inlined calls are cached until a global is redefined
+	runTests({
+		{"let f = fn() { 1 }; let g = fn() { f() }; let a = g(); let f = fn() { 2 }; a + g()", Value{3}},
+		{"let neg = fn(x) { -x }; let g = fn(x) { neg(x) }; let a = g(1); let neg = fn(x) { x * 10 }; a + g(1)", Value{9}},
+		{"let f = fn(x) { len(x) }; let a = f([1]); let len = fn(x) { 5 }; a + f([1])", Value{6}},
+		{"let k = 1; let g = fn() { k }; let a = g(); let k = fn() { 2 }; let h = g(); a + h()", Value{3}},
+	});
+}
 
 TEST(TestLexer, TestStringLiteralExpression) {
 
@@ -218,6 +463,9 @@ TEST(TestLexer, TestBuiltinFunctions) {
 		{R"XXX( len("") )XXX", Value{0}},
 		{R"XXX( len("four") )XXX", Value{4}},
 		{R"XXX( len("hello world") )XXX", Value{11}},
+		{R"XXX( let apply = fn(f, x) { f(x) }; apply(len, "four") + apply(len, [1]) )XXX", Value{5}},
+		{R"XXX( let f = first; f(rest([1, 2, 3])) )XXX", Value{2}},
+		{R"XXX( puts("a", 1, [2], true, "b", 3) )XXX", Value{}},
 		//{R"XXX( len(1) )XXX", "argument to `len` not supported, got INTEGER"},
 		//{R"XXX( len("one", "two") )XXX", "wrong number of arguments. got=2, want=1"},
 	});
@@ -269,6 +517,25 @@ TEST(TestLexer, TestArrayBuiltinFunction) {
 	});
 }
 
+TEST(TestLexer, TestLargeArrays) {
+	const auto build = R"XXX(
+		let build = fn(n, xs) if (n > 0) build(n - 1, xs + [len(xs)]) else xs;
+		let drop = fn(n, xs) if (n > 0) drop(n - 1, rest(xs)) else xs;
+		let xs = build(100, []);
+	)XXX";
+	const auto test = [&build](const std::string& str, const Value& expected) {
+		testEval(build + str, expected);
+	};
+	test("len(xs)", Value{100});
+	test("xs[0] + xs[31] + xs[32] + xs[99]", Value{0 + 31 + 32 + 99});
+	test("first(drop(40, xs))", Value{40});
+	test("last(rest(xs))", Value{99});
+	test("len(drop(99, xs))", Value{1});
+	test("let ys = drop(30, xs) + drop(60, xs); [len(ys), ys[0], ys[69], ys[70], last(ys)]",
+		Value{ Array{ Value{110}, Value{30}, Value{99}, Value{60}, Value{99} } });
+	test("drop(97, xs) + [1] == [97, 98, 99, 1]", Value{true});
+}
+
 
 TEST(TestLexer, TestStringBuiltinFunction) {
 	runTests({
@@ -315,9 +582,143 @@ TEST(TestLexer, TestHashIndexExpressions) {
 		{R"XXX( {5: 5}[5] )XXX",                        Value{5} },
 		{R"XXX( {true: 5}[true] )XXX",                  Value{5} },
 		{R"XXX( {false: 5}[false] )XXX",                Value{5} },
+		{R"XXX( {[1, 2]: 1, [2, 1]: 2}[[2, 1]] )XXX",   Value{2} },
+		{R"XXX( {{1: 2}: 3}[{1: 2}] )XXX",              Value{3} },
+		{R"XXX( {1: 2, 3: 4} == {3: 4, 1: 2} )XXX",     Value{true} },
+		{R"XXX( {1: 2, 3: 4} == {1: 2, 3: 5} )XXX",     Value{false} },
+		{R"XXX( ({"a": 1} + {"b": 2, "a": 3})["a"] )XXX", Value{3} },
+		// functions are keys by what they are and the environment they're bound to
+		{R"XXX( let f = fn(x) { x }; let g = fn(x) { x }; let h = {f: 1, len: 2}; [h[f], h[g], h[len], f == f, f == g] )XXX",
+			Value{Array{Value{1}, Value{}, Value{2}, Value{true}, Value{false}}} },
+		{R"XXX( let f = fn(x) { x }; len(put(put({}, f, 1), f, 2)) )XXX", Value{1} },
+		{R"XXX( let adder = fn(n) { fn(x) { x + n } }; adder(1) == adder(1) )XXX", Value{false} },
+	});
+}
+
+TEST(TestLexer, TestHashBuiltins) {
+	runTests({
+		{R"XXX( let a = {1: 2}; let b = put(a, 3, 4); [len(a), len(b), has(b, 3), has(a, 3), b[1]] )XXX",
+			Value{Array{Value{1}, Value{2}, Value{true}, Value{false}, Value{2}}} },
+		{R"XXX( let a = {"x": 1, "y": 2}; let b = remove(a, "x"); [len(a), len(b), a["x"], has(b, "x"), b["y"]] )XXX",
+			Value{Array{Value{2}, Value{1}, Value{1}, Value{false}, Value{2}}} },
+		{R"XXX( keys(put(put({}, "x", 1), "y", 2)) )XXX",          Value{Array{Value{"x"}, Value{"y"}}} },
+		{R"XXX( values(put({"x": 1, "y": 2}, "x", 3)) )XXX",        Value{Array{Value{3}, Value{2}}} },
+		{R"XXX( keys(put(remove({"x": 1, "y": 2}, "x"), "x", 3)) )XXX", Value{Array{Value{"y"}, Value{"x"}}} },
+		{R"XXX( remove({1: 2}, 3) == {1: 2} )XXX",                  Value{true} },
+		{R"XXX( len(remove(remove({1: 2}, 1), 1)) )XXX",           Value{0} },
+		{R"XXX( let f = fn(h, i) if (i == 0) h else f(put(h, i, i * i), i - 1); let h = f({}, 1000); [len(h), h[31], len(foldl(fn(h, k) remove(h, k), h, keys(h)))] )XXX",
+			Value{Array{Value{1000}, Value{961}, Value{0}}} },
 	});
 }
 
+TEST(TestLexer, TestHashTable) {
+	constexpr Integer count = 10000;
+
+	Hash hash;
+	for (Integer i = 0; i < count; i++)
+		EXPECT_TRUE(hash.emplace(Value{i * 7919 % count}, Value{i}));
+	EXPECT_FALSE(hash.emplace(Value{0}, Value{-1}));
+	ASSERT_EQ(hash.size(), count);
+
+	// entries are found by their keys, and iterated in the order they were added
+	for (Integer i = 0; i < count; i++) {
+		const auto* found = hash.find(Value{i * 7919 % count});
+		ASSERT_NE(found, nullptr);
+		EXPECT_EQ(*found, Value{i});
+	}
+	EXPECT_EQ(hash.find(Value{count}), nullptr);
+	EXPECT_EQ(hash.find(Value{"0"}), nullptr);
+	Integer i = 0;
+	for (const auto& [key, value] : hash)
+		EXPECT_EQ(value, Value{i++});
+
+	// equal in any order
+	Hash reversed;
+	for (Integer i = count; i-- > 0;)
+		reversed.emplace(Value{i * 7919 % count}, Value{i});
+	EXPECT_TRUE(hash == reversed);
+	EXPECT_EQ(ValueHash{}(Value{hash}), ValueHash{}(Value{reversed}));
+	reversed.insert_or_assign(Value{0}, Value{-1});
+	EXPECT_FALSE(hash == reversed);
+
+	// an array's hash depends on the order of its elements
+	EXPECT_NE(ValueHash{}(Value{Array{Value{1}, Value{2}}}), ValueHash{}(Value{Array{Value{2}, Value{1}}}));
+	EXPECT_EQ(ValueHash{}(Value{Array{Value{1}, Value{2}}}), ValueHash{}(Value{Array{Value{1}, Value{2}}}));
+	EXPECT_NE(ValueHash{}(Value{1}), ValueHash{}(Value{true}));
+}
+
+TEST(TestLexer, TestPersistentHash) {
+	constexpr Integer count = 5000;
+
+	// each version keeps its entries, while the next ones share them
+	std::vector<Hash> versions{Hash{}};
+	for (Integer i = 0; i < count; i++)
+		versions.push_back(versions.back().put(Value{i}, Value{i * i}));
+	for (Integer i = 0; i <= count; i += 499) {
+		ASSERT_EQ(versions[i].size(), static_cast<size_t>(i));
+		EXPECT_TRUE(i == 0 || versions[i].contains(Value{i - 1}));
+		EXPECT_FALSE(versions[i].contains(Value{i}));
+	}
+
+	// removing every other key, in a different order than they were added, leaves the rest in theirs
+	auto full = versions.back();
+	auto hash = full;
+	for (Integer i = count; i-- > 0;)
+		if (i % 2)
+			hash = hash.remove(Value{i});
+	EXPECT_EQ(hash.remove(Value{count}).size(), hash.size());
+	ASSERT_EQ(hash.size(), static_cast<size_t>(count / 2));
+	EXPECT_EQ(full.size(), static_cast<size_t>(count));
+	Integer i = 0;
+	for (const auto& [key, value] : hash) {
+		EXPECT_EQ(key, Value{i});
+		EXPECT_EQ(value, Value{i * i});
+		i += 2;
+	}
+
+	// replacing a value keeps the key's place
+	hash = hash.put(Value{0}, Value{-1}).put(Value{count}, Value{0});
+	EXPECT_EQ(hash.begin()->second, Value{-1});
+	EXPECT_EQ(*full.find(Value{0}), Value{0});
+
+	// removing them all leaves an empty hash, equal to any other
+	for (Integer i = 0; i <= count; i += 2)
+		hash = hash.remove(Value{i});
+	EXPECT_TRUE(hash.empty());
+	EXPECT_TRUE(hash == Hash{});
+	EXPECT_TRUE(hash.begin() == hash.end());
+
+	// a hash whose nodes are only its own is changed in place, after it's been iterated too,
+	// and one it shares them with is left as it was
+	const auto keys = [](const Hash& hash) {
+		std::vector<Value> keys;
+		for (const auto& [key, value] : hash)
+			keys.push_back(key);
+		return keys;
+	};
+	Hash grown;
+	std::vector<Value> added;
+	for (Integer i = 0; i < 2 * count; i++) {
+		grown.emplace(Value{i * 7919 % count}, Value{i});
+		if (i < count)
+			added.push_back(Value{i * 7919 % count});
+		if (i % 1000 == 0) {
+			EXPECT_EQ(keys(grown), added);
+		}
+	}
+	const auto shared = grown;
+	grown.insert_or_assign(Value{0}, Value{-1});
+	grown.insert_or_assign(Value{count}, Value{count});
+	EXPECT_FALSE(grown.emplace(Value{1}, Value{-1}));
+	added.push_back(Value{count});
+	EXPECT_EQ(keys(grown), added);
+	EXPECT_EQ(*grown.find(Value{0}), Value{-1});
+	EXPECT_EQ(*grown.find(Value{1}), *shared.find(Value{1}));
+	EXPECT_EQ(*shared.find(Value{0}), Value{0});
+	EXPECT_EQ(shared.size(), static_cast<size_t>(count));
+	EXPECT_FALSE(shared.contains(Value{count}));
+}
+
 
 TEST(TestLexer, TestFibonacciFunction) {
 	runTests({
@@ -349,5 +750,586 @@ TEST(TestLexer, TestAckermanFunction) {
 	});
 }
 
+TEST(TestLexer, TestMemo) {
+	runTests({
+		// exponential without the memo
+		{"let fib = memo(fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }); fib(80)", Value{23416728348467685}},
+		// results are kept by the captures of a closure, as well as by its arguments
+		{"let adder = fn(a) { memo(fn(b) { a + b }) }; let add2 = adder(2); let add5 = adder(5); [add2(1), add5(1), add2(1)]",
+			Value{ Array{ Value{3}, Value{6}, Value{3} } }},
+		// rebinding a global the function reads forgets its results
+		{"let k = 2; let f = memo(fn(n) { n * k }); let a = f(3); let k = 10; [a, f(3)]", Value{ Array{ Value{6}, Value{30} } }},
+		{"let sq = memo(fn(x) { x * x }); preduce($+, 0, pmap(sq, [1, 2, 3, 4, 1, 2, 3, 4]))", Value{60}},
+	});
+
+	const auto count = [](const std::string& str, const Value& expected, Engine engine) {
+		const auto before = Memo::stats();
+		testEval(str, expected, engine);
+		const auto after = Memo::stats();
+		return std::array{after.hits - before.hits, after.misses - before.misses, after.bypassed - before.bypassed, after.evicted - before.evicted};
+	};
+	using Counts = std::array<size_t, 4>;
+
+	for (const auto engine : {Engine::Ast, Engine::Vm}) {
+		EXPECT_EQ(count("let sq = memo(fn(x) { x * x }); [sq(3), sq(3), sq(4)]", Value{ Array{ Value{9}, Value{9}, Value{16} } }, engine), (Counts{1, 2, 0, 0}));
+
+		// an impure function is called every time: each call prints, to a stream in place of stdout
+		std::ostringstream printed;
+		auto* const out = std::cout.rdbuf(printed.rdbuf());
+		EXPECT_EQ(count("let f = memo(fn(x) { puts(x); x }); f(1) + f(1)", Value{2}, engine), (Counts{0, 0, 2, 0}));
+		EXPECT_EQ(count("let f = memo(fn(x) { map(fn(y) { puts(y) }, x) }); len(f([2])) + len(f([2]))", Value{2}, engine), (Counts{0, 0, 2, 0}));
+		std::cout.rdbuf(out);
+		EXPECT_EQ(printed.str(), "1\n1\n2\n2\n");
+		EXPECT_EQ(count("let f = memo(fn(x) { map(fn(y) { y + 1 }, x) }); f([1]) + f([1])", Value{ Array{ Value{2}, Value{2} } }, engine), (Counts{1, 1, 0, 0}));
+
+		// the least recently used results go first
+		const auto capacity = Memo::capacity.exchange(2);
+		EXPECT_EQ(count("let sq = memo(fn(x) { x * x }); [sq(1), sq(2), sq(3), sq(1), sq(3)]",
+			Value{ Array{ Value{1}, Value{4}, Value{9}, Value{1}, Value{9} } }, engine), (Counts{1, 4, 0, 2}));
+		Memo::capacity = capacity;
+	}
+
+	// --memo: only globals defined as pure recursive functions are memoized
+	Memo::automatic = true;
+	for (const auto engine : {Engine::Ast, Engine::Vm}) {
+		Lexer lexer{R"XXX(
+			let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };
+			let ackerman = fn(m, n) { if (m == 0) { n + 1 } else { if (n == 0) { ackerman(m - 1, 1) } else { ackerman(m - 1, ackerman(m, n - 1)) } } };
+			let twice = fn(x) { x * 2 };
+			let noisy = fn(n) { if (n == 0) { puts("done") } else { noisy(n - 1) } };
+			[fib(90), ackerman(3, 7), twice(2)]
+		)XXX"};
+		auto program = Program::parse(lexer);
+		ASSERT_EQ(program->run(engine), (Value{ Array{ Value{2880067194370816120}, Value{1021}, Value{4} } }));
+		EXPECT_TRUE(MemoFunctionExpression::wrapped(program->global->get("fib")));
+		EXPECT_TRUE(MemoFunctionExpression::wrapped(program->global->get("ackerman")));
+		EXPECT_FALSE(MemoFunctionExpression::wrapped(program->global->get("twice")));
+		EXPECT_FALSE(MemoFunctionExpression::wrapped(program->global->get("noisy")));
+	}
+	Memo::automatic = false;
+}
+
+
+TEST(TestLexer, TestLibrary) {
 
+	const auto read = [](const std::string& name) {
+		std::ifstream ifs{std::string{SOURCE_DIR} + "/" + name};
+		return std::string{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+	};
+	static const auto prelude = read("prelude");
+	static const auto pure = read("prelude.pure");
+	ASSERT_FALSE(prelude.empty());
+	ASSERT_FALSE(pure.empty());
 
+	// the native library against its monkey definitions, which prelude.pure rebinds it to
+	const auto run = [](const std::vector<std::string_view>& sources, Engine engine) {
+		std::vector<Lexer> lexers(sources.begin(), sources.end());
+		Program program;
+		for (auto& lexer : lexers)
+			program.add(lexer);
+		return program.run(engine);
+	};
+	const auto test = [&run](const std::string& str) {
+		for (const auto engine : { Engine::Ast, Engine::Vm }) {
+			const auto native = run({prelude, str}, engine);
+			const auto monkey = run({pure, prelude, str}, engine);
+			// down to the error a call fails with
+			ASSERT_EQ(native.failed(), monkey.failed()) << native << " vs " << monkey << " : " << str;
+			EXPECT_EQ(native, monkey) << native << " vs " << monkey << " : " << str;
+		}
+	};
+	// a call with the wrong number of arguments fails, where the monkey definition takes the missing ones as nil
+	const auto fails = [&run](const std::string& str) {
+		for (const auto engine : { Engine::Ast, Engine::Vm })
+			EXPECT_TRUE(run({prelude, str}, engine).failed()) << str;
+	};
+
+	test("map(fn(x) { x * 2 }, [1, 2, 3])");
+	test("map(fn(x) { x + \"!\" }, \"abc\")");
+	test("map(len, [])");
+	test("map(1, [1])");
+	test("filter(fn(x) { x % 2 == 0 }, [1, 2, 3, 4, 5, 6])");
+	test("filter(fn(x) { 1 }, [1])");
+	test("foldl(fn(a, b) { a - b }, 100, [1, 2, 3])");
+	test("foldr(fn(a, b) { a - b }, 100, [1, 2, 3])");
+	fails("foldl($+, 0)");
+	fails("rep(2)");
+	test("[reverse([1, 2, 3]), reverse(\"abc\"), reverse([])]");
+	test("[take(2, [1, 2, 3]), take(5, \"abc\"), take(0, [1]), take(-1, [])]");
+	test("[drop(2, [1, 2, 3]), drop(3, [1, 2, 3]), drop(4, [1, 2, 3]), drop(1, \"abc\"), drop(0, 5)]");
+	test("drop(5, [1, 2, 3])");
+	test("take(true, [1])");
+	test("[sort([5, 3, 8, 1, 9, 2, 3]), sort([]), sort([1]), sort(\"a\")]");
+	test("sort([\"b\", \"a\"])");
+	test("sort([\"b\", \"a\", \"c\"])");
+	test("sort([3, \"a\", 1, 2])");
+	test("[concat([[1, 2], [3], [], [4, 5]]), concat([])]");
+	test("concat([1])");
+	test("[sum([1, 2, 3, 4]), sum([]), product([2, 3, 4]), max([3, 9, 2]), min([3, 9, 2]), max([\"a\"])]");
+	test("product([])");
+	test("min([1, true])");
+	test("[rep(3, \"x\"), rep(0, 1), rep(-1, 1), len(rep(1000, 1))]");
+	test("rep(\"3\", 1)");
+	// failing as the monkey definitions do
+	test("[map(neg, {}), take(2, {}), sum({}), sort({1: 2}), take(0, {1: 2})]");
+	test("map(neg, 5)");
+	test("foldr($+, 0, {1: 2})");
+	test("take(0, 5)");
+	test("take(\"1\", [])");
+	test("drop(\"a\", [])");
+	test("drop(2, 5)");
+	test("drop(1, {})");
+	test("sort(5)");
+	test("sort({1: 2, 3: 4})");
+	test("sort(\"cba\")");
+	test("sort([[2], [1]])");
+	test("product(5)");
+	test("product(\"\")");
+	test("max({})");
+	test("rep(true, 1)");
+	test("let build = fn(n, xs) if (n > 0) build(n - 1, xs + [(n * 7919) % 101]) else xs; let xs = build(300, []); [sort(xs), map(neg, reverse(sort(xs))) == sort(map(neg, xs)), sum(take(10, drop(5, sort(xs))))]");
+}
+
+
+TEST(TestLexer, TestParallel) {
+
+	// more threads than cores, so that the tasks interleave even on one
+	ThreadPool::configure(4);
+
+	const auto build = std::string{R"XXX(
+		let random = fn(seed) (seed * 1103515245 + 12345) % 2147483648;
+		let randoms = fn(n, seed, xs) if (n == 0) xs else randoms(n - 1, random(seed), xs + [seed % 1000]);
+		let xs = randoms(2000, 42, []);
+		let fib = fn(n) if (n < 2) n else fib(n - 1) + fib(n - 2);
+	)XXX"};
+
+	runTests({
+		{build + "pmap(fn(x) { fib(x % 12) }, xs) == map(fn(x) { fib(x % 12) }, xs)", Value{true}},
+		{build + "let k = 3; pfilter(fn(x) { x % k == 0 }, xs) == filter(fn(x) { x % k == 0 }, xs)", Value{true}},
+		{build + "[preduce($+, 1, xs) == foldl($+, 1, xs), preduce(fn(a, b) { a * b % 1009 }, 1, xs) == foldl(fn(a, b) { a * b % 1009 }, 1, xs)]", Value{ Array{ Value{true}, Value{true} } }},
+		{build + "psort(xs) == sort(xs)", Value{true}},
+		{build + "let ys = map(fn(x) { [x] }, xs); pmap(first, ys) == xs", Value{true}},
+		{build + "pmap(fn(x) { len(pfilter(fn(y) { y < x }, take(50, xs))) }, take(100, xs)) == map(fn(x) { len(filter(fn(y) { y < x }, take(50, xs))) }, take(100, xs))", Value{true}},
+		{"let neg = fn(x) { -x }; [pmap(neg, []), pfilter(neg, []), preduce($+, 5, []), psort([]), psort([1]), pmap(neg, [1])]",
+			Value{ Array{ Value{Array{}}, Value{Array{}}, Value{5}, Value{Array{}}, Value{Array{Value{1}}}, Value{Array{Value{-1}}} } }},
+		{"psort([3, 1, 2, 5, 4, 0, 9, 7, 8, 6])", Value{ Array{ Value{0}, Value{1}, Value{2}, Value{3}, Value{4}, Value{5}, Value{6}, Value{7}, Value{8}, Value{9} } }},
+	});
+
+	const auto testError = [](const std::string& str, const std::string& message) {
+		for (const auto engine : { Engine::Ast, Engine::Vm }) {
+			Lexer lexer{str};
+			auto program = Program::parse(lexer);
+			const auto val = program->run(engine);
+
+			ASSERT_TRUE(val.failed()) << val << " : " << str;
+			EXPECT_NE(val.get<String>().find(message), std::string::npos) << val << " : " << str;
+		}
+	};
+
+	// the error of the element that map, or filter, would fail on
+	testError("pmap(fn(x) { if (x == 3 || x == 7) { x + true } else { x } }, [1, 2, 3, 4, 5, 6, 7, 8])", "3 + true");
+	testError("pfilter(fn(x) { if (x == 3 || x == 7) { x + true } else { true } }, [1, 2, 3, 4, 5, 6, 7, 8])", "7 + true");
+	testError("psort([3, 1, true, 2])", "invalid infix operation");
+	testError("preduce($+, 0, [1, 2, true, 3])", "invalid infix operation");
+
+	// psort fails on the comparison that sort does
+	for (const std::string xs : { "[\"b\", \"a\", \"c\"]", "[4, \"b\", 2, \"a\", true, 1, \"c\", 3, [], 0]" }) {
+		for (const auto engine : { Engine::Ast, Engine::Vm }) {
+			const auto psort = "psort(" + xs + ")", sort = "sort(" + xs + ")";
+			Lexer psortLexer{psort}, sortLexer{sort};
+			const auto psorted = Program::parse(psortLexer)->run(engine);
+			const auto sorted = Program::parse(sortLexer)->run(engine);
+
+			ASSERT_TRUE(sorted.failed()) << sorted << " : " << xs;
+			ASSERT_TRUE(psorted.failed()) << psorted << " : " << xs;
+			EXPECT_EQ(psorted.get<String>(), sorted.get<String>()) << xs;
+		}
+	}
+}
+
+
+TEST(TestLexer, TestPrelude) {
+
+	std::ifstream ifs{std::string{SOURCE_DIR} + "/prelude"};
+	const auto source = std::string{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+	ASSERT_FALSE(source.empty());
+
+	Lexer lexer{source};
+	Lexer definitions{R"XXX(
+		let shared = [5, 3, 8, 1, 9, 2];
+		let twice = fn(f) { fn(x) { f(f(x)) } };
+		let greeting = "hello";
+	)XXX"};
+	auto program = std::make_unique<Program>();
+	program->add(lexer);
+	program->add(definitions);
+	const auto prelude = Prelude::seal(std::move(program));
+	ASSERT_FALSE(prelude->result.failed()) << prelude->result;
+
+	// each program defines the same globals, shadowing some of the prelude's, over the one prelude
+	const auto run = [&prelude](int me, Engine engine) {
+		const auto str = "let me = " + std::to_string(me) + R"XXX(;
+			let add = fn(x) { x + me };
+			let total = foldl1($+, map(fn(x) { x * 2 }, shared));
+			let map = fn(f, xs) { me };
+			let g = twice(add);
+			[me, total, g(1), map(add, shared), sort(reverse(shared)), greeting + me, abs(-me)]
+		)XXX";
+		Lexer lexer{str};
+		Program program{prelude};
+		program.add(lexer);
+		return program.run(engine);
+	};
+	const auto expected = [](int me) {
+		return Value{ Array{
+			Value{me}, Value{56}, Value{1 + 2 * me}, Value{me},
+			Value{ Array{ Value{1}, Value{2}, Value{3}, Value{5}, Value{8}, Value{9} } },
+			Value{"hello" + std::to_string(me)}, Value{me},
+		} };
+	};
+
+	constexpr int threads = 8;
+	constexpr int runs = 25;
+	std::vector<std::vector<Value>> results(threads);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([&, t]() {
+			for (int i = 0; i < runs; i++)
+				results[t].push_back(run(t * runs + i, i % 2 ? Engine::Vm : Engine::Ast));
+		});
+	}
+	for (auto& worker : workers)
+		worker.join();
+
+	for (int t = 0; t < threads; t++) {
+		ASSERT_EQ(results[t].size(), runs);
+		for (int i = 0; i < runs; i++)
+			EXPECT_EQ(results[t][i], expected(t * runs + i)) << results[t][i];
+	}
+
+	// the programs' definitions stayed in their own globals
+	EXPECT_TRUE(prelude->global()->get("me").is<NullValue>());
+	EXPECT_TRUE(prelude->global()->get("add").is<NullValue>());
+	EXPECT_EQ(run(threads * runs, Engine::Vm), expected(threads * runs));
+}
+
+
+TEST(TestLexer, TestFork) {
+
+	// run str in program, after the statements already run, which functions may still be bound to
+	std::vector<StatementP> ran;
+	const auto add = [&ran](Program& program, const std::string& str, Engine engine) {
+		std::move(program.statements.begin(), program.statements.end(), std::back_inserter(ran));
+		program.statements.clear();
+
+		Lexer lexer{str};
+		program.add(lexer);
+		return program.run(engine);
+	};
+
+	for (const auto engine : { Engine::Ast, Engine::Vm }) {
+		Program parent;
+		add(parent, "let x = 1; let f = fn() { x }; let xs = [1, 2, 3]; let g = memo(fn(n) { x + n });", engine);
+
+		// a fork shadows the parent's globals with its own, for the functions it inherited too
+		auto a = parent.fork();
+		EXPECT_EQ(add(*a, "let x = 2; let y = 10; let xs = xs + [4]; [x, y, len(xs), f(), g(1), pmap(fn(i) { f() + i }, [1, 2])]", engine),
+			(Value{ Array{ Value{2}, Value{10}, Value{4}, Value{2}, Value{3}, Value{Array{ Value{3}, Value{4} }} } }));
+
+		auto b = parent.fork();
+		EXPECT_EQ(add(*b, "[x, len(xs), g(1)]", engine), (Value{ Array{ Value{1}, Value{3}, Value{2} } }));
+		EXPECT_TRUE(b->global->get("y").is<NullValue>());
+
+		// and neither it nor its functions see the parent's definitions after it was made
+		add(parent, "let x = 5;", engine);
+		EXPECT_EQ(add(*b, "[x, f(), g(1)]", engine), (Value{ Array{ Value{1}, Value{1}, Value{2} } }));
+		EXPECT_EQ(add(parent, "[x, f(), len(xs), g(1)]", engine), (Value{ Array{ Value{5}, Value{5}, Value{3}, Value{6} } }));
+		EXPECT_TRUE(parent.global->get("y").is<NullValue>());
+
+		// forks of forks, more than the layers that are chained before flattening
+		auto fork = parent.fork();
+		for (int i = 0; i < 20; i++) {
+			add(*fork, "let v" + std::to_string(i) + " = " + std::to_string(i) + "; let x = x + 1;", engine);
+			fork = fork->fork();
+		}
+		EXPECT_EQ(add(*fork, "[x, v0, v9, v19, f()]", engine), (Value{ Array{ Value{25}, Value{0}, Value{9}, Value{19}, Value{25} } }));
+		EXPECT_EQ(add(parent, "x", engine), Value{5});
+
+		// a fork runs while its parent goes on defining names
+		auto c = parent.fork();
+		std::vector<StatementP> ranInThread;
+		std::thread thread{[&c, &ranInThread, engine]() {
+			for (int i = 0; i < 200; i++) {
+				std::move(c->statements.begin(), c->statements.end(), std::back_inserter(ranInThread));
+				c->statements.clear();
+				Lexer lexer{"let x = x + 1; f()"};
+				c->add(lexer);
+				EXPECT_EQ(c->run(engine), Value{6 + i});
+			}
+		}};
+		for (int i = 0; i < 200; i++)
+			add(parent, "let x = " + std::to_string(-i) + "; f()", engine);
+		thread.join();
+	}
+}
+
+
+TEST(TestLexer, TestSnapshot) {
+
+	std::ifstream ifs{std::string{SOURCE_DIR} + "/prelude"};
+	const auto prelude = std::string{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+	ASSERT_FALSE(prelude.empty());
+
+	const auto definitions = std::string{R"XXX(
+		let adder = fn(n) { fn(x) { x + n } };
+		let add3 = adder(3);
+		let again = add3;
+		let make = fn() { let loop = fn(n) { if (n == 0) { "done" } else { loop(n - 1) } }; loop };
+		let looper = make();
+		let evens = fn(xs) { filter(fn(x) { x % 2 == 0 }, xs) };
+		let table = {"one": 1, "two": [2, -2], 3: "three", true: fn(x) { x * 10 }};
+		let times = table[true];
+		let words = ["a", "b"];
+		let plus = $+;
+		let size = len;
+		let sq = fn(x) { x * x };
+		let sumsq = fn(xs) { foldl(fn(a, x) { a + sq(x) }, 0, xs) };
+	)XXX"};
+	const auto query = std::string{R"XXX(
+		[add3(4), again(1), looper(10), evens([1, 2, 3, 4]), table["one"], table["two"], table[3], times(2),
+		 plus(1, 2), size(words), sumsq([1, 2, 3]), foldl1($+, [1, 2, 3]), index("abc"), !true, -sq(2), words[1]]
+	)XXX"};
+
+	// run str in program, after the statements already run, which functions may still be bound to
+	std::vector<StatementP> ran;
+	const auto add = [&ran](Program& program, const std::string& str, Engine engine) {
+		std::move(program.statements.begin(), program.statements.end(), std::back_inserter(ran));
+		program.statements.clear();
+
+		Lexer lexer{str};
+		program.add(lexer);
+		return program.run(engine);
+	};
+
+	const auto path = (std::filesystem::temp_directory_path() / "parser_test.snapshot").string();
+	for (const auto engine : { Engine::Ast, Engine::Vm }) {
+		Program original;
+		add(original, prelude + definitions, engine);
+		Snapshot::save(path, *original.global);
+
+		Program restored;
+		const auto snapshot = Snapshot::open(path);
+		restored.global->restore(snapshot);
+
+		// bindings are decoded as they are looked up
+		EXPECT_EQ(add(restored, "1", engine), Value{1});
+		EXPECT_EQ(snapshot->decoded(), 0);
+		EXPECT_EQ(add(restored, "add3(1)", engine), Value{4});
+		EXPECT_EQ(snapshot->decoded(), 1);
+
+		const auto expected = add(original, query, engine);
+		ASSERT_FALSE(expected.failed()) << expected;
+		EXPECT_EQ(add(restored, query, engine), expected);
+
+		// a global redefined over the image's, which sumsq may have inlined
+		const auto redefine = "let sq = fn(x) { x }; sumsq([1, 2, 3])";
+		EXPECT_EQ(add(restored, redefine, engine), add(original, redefine, engine));
+
+		// an image of a restored environment
+		Snapshot::save(path, *restored.global);
+		Program again;
+		again.global->restore(Snapshot::open(path));
+		EXPECT_EQ(add(again, query, engine), add(restored, query, engine));
+	}
+
+	// a truncated or corrupted image is rejected when it's opened, not on a lookup
+	std::ifstream image{path, std::ios::binary};
+	const auto bytes = std::string{std::istreambuf_iterator<char>(image), std::istreambuf_iterator<char>()};
+	const auto write = [&path](const std::string& bytes) {
+		std::ofstream ofs{path, std::ios::binary};
+		ofs << bytes;
+	};
+	write(bytes.substr(0, bytes.size() / 2));
+	EXPECT_THROW(Snapshot::open(path), std::runtime_error);
+	for (size_t i = 12; i < bytes.size(); i += bytes.size() / 17) {
+		auto corrupted = bytes;
+		corrupted[i] ^= 0x20;
+		write(corrupted);
+		EXPECT_THROW(Snapshot::open(path), std::runtime_error) << "byte " << i;
+	}
+	write(bytes);
+	EXPECT_NE(Snapshot::open(path), nullptr);
+
+	write("not a snapshot");
+	EXPECT_THROW(Snapshot::open(path), std::runtime_error);
+	EXPECT_THROW(Snapshot::open(path + ".missing"), std::runtime_error);
+	std::filesystem::remove(path);
+}
+
+
+TEST(TestLexer, TestLazyParsing) {
+
+	// bodies long enough to be deferred, which must end, and resolve, where they would have if parsed
+	runTests({
+		{R"(
+			let f = fn(n) {
+				let g = fn(k) { if (k > 0) { k * m + g(k - 1) } else { base } };
+				let m = 10;
+				let base = 1000;
+				g(n)
+			}
+			f(3)
+		)", Value{1060}},
+		{R"(
+			let classify = fn(x, limit)
+				if (x < 0) "negative"
+				else if (x == 0) "zero"
+				else if (x > limit * 2 + 1) { "huge" }
+				else { ["small", "big"][x / (limit + 1)] }
+			let xs = [classify(-1, 5), classify(0, 5), classify(3, 5), classify(7, 5), classify(99, 5)]
+			xs[0] + xs[1] + xs[2] + xs[3] + xs[4]
+		)", Value{"negativezerosmallbighuge"}},
+		{R"(
+			let outer = fn(a, b) {
+				let inner = fn(c) {
+					let innermost = fn(d) { [a, b, c, d, a + b + c + d, -a, !true, {"k": c}["k"]] };
+					innermost(c * 2)
+				};
+				inner(a + b)
+			}
+			outer(1, 2)[4]
+		)", Value{12}},
+		{R"(
+			let f = fn(a, a) { let a = a + 1; let b = foldl($+, 0, [a, a, a]); return b * 2; 99 }
+			f(1, 2)
+		)", Value{18}},
+	});
+
+	const auto deferrals = FunctionExpression::deferrals.load();
+	const auto materializations = FunctionExpression::materializations.load();
+
+	Lexer lexer{R"(
+		let used = fn(xs) {
+			let total = foldl($+, 0, xs);
+			let count = len(xs);
+			if (count == 0) { 0 } else { total / count }
+		}
+		let unused = fn(xs) {
+			let total = foldl($*, 1, xs);
+			let count = len(xs);
+			if (count == 0) { 0 } else { total / count }
+		}
+		used([1, 2, 3])
+	)"};
+	auto program = Program::parse(lexer);
+	EXPECT_EQ(FunctionExpression::deferrals - deferrals, 2);
+	EXPECT_EQ(FunctionExpression::materializations - materializations, 0);
+
+	EXPECT_EQ(program->run(), Value{2});
+	EXPECT_EQ(FunctionExpression::materializations - materializations, 1);
+
+	// a syntax error in a body long enough to be deferred is reported where the function is, at its line
+	for (const auto* broken : {
+		"\n\nlet broken = fn(x) {\n\tlet = x + 1;\n\tx + x + x + x + x + x + x + x + x + x + x + x + x + x + x + x\n}",
+		"\n\nlet broken = fn(x) {\n\tlet y = x + (1;\n\tx + x + x + x + x + x + x + x + x + x + x + x + x + x + x + x\n}",
+		"\n\nlet broken = fn(x) {\n\tlet y = [x, fn(1) { x }];\n\tx + x + x + x + x + x + x + x + x + x + x + x + x + x + x + x\n}",
+		"\n\nlet broken = fn(x) {\n\tlet y = {x: 1, 2};\n\tx + x + x + x + x + x + x + x + x + x + x + x + x + x + x + x\n}",
+	}) {
+		Lexer lexer{broken};
+		try {
+			Program::parse(lexer);
+			FAIL() << broken << " parsed";
+		}
+		catch (const std::runtime_error& ex) {
+			EXPECT_NE(std::string{ex.what()}.find("line 4"), std::string::npos) << ex.what();
+		}
+	}
+	EXPECT_EQ(FunctionExpression::deferrals - deferrals, 2);
+}
+
+
+TEST(TestLexer, TestCollector) {
+
+	// a recursive local function captures itself, so each call to f leaves a cycle
+	const auto str = R"XXX(
+		let f = fn(n) { let count = fn(i) { if (i < n) { count(i + 1) } else { i } }; count(0) };
+		let run = fn(k) { if (k == 0) { 0 } else { f(k) + run(k - 1) } };
+		let make = fn(x) { let get = fn(k) { if (k == 0) { x } else { get(k - 1) } }; get };
+		let g = make(7);
+		[run(50), preduce($+, 0, pmap(fn(k) { f(k) }, [1, 2, 3, 4, 5, 6, 7, 8]))]
+	)XXX";
+
+	for (const auto engine : {Engine::Ast, Engine::Vm}) {
+		Collector::collect();
+		const auto before = Collector::stats();
+
+		Lexer lexer{str};
+		auto program = Program::parse(lexer);
+		ASSERT_EQ(program->run(engine), (Value{ Array{ Value{1275}, Value{36} } }));
+
+		// the captures of count made by f's calls, including those on the pool's threads, but not g's, which a global refers to
+		EXPECT_EQ(Collector::collect(), 58);
+		EXPECT_EQ(Collector::collect(), 0);
+		const auto& [get, env] = program->global->get("g").get<BoundFunction>();
+		EXPECT_EQ(get->apply(env, std::vector<Value>{Value{3}}), Value{7});
+
+		// once the program is gone, so are its globals, which its functions are bound to, and g's captures
+		program.reset();
+		EXPECT_EQ(Collector::collect(), 2);
+
+		const auto after = Collector::stats();
+		EXPECT_EQ(after.full, before.full + 3);
+		EXPECT_EQ(after.freed, before.freed + 60);
+	}
+
+	// threads collect what they allocated, while others run programs over the same prelude
+	Lexer lexer{R"XXX(
+		let make = fn(x) { let get = fn(k) { if (k == 0) { x } else { get(k - 1) } }; get };
+		let shared = make(5);
+	)XXX"};
+	const auto prelude = Prelude::seal(Program::parse(lexer));
+	ASSERT_FALSE(prelude->result.failed()) << prelude->result;
+
+	std::vector<std::thread> threads;
+	std::vector<size_t> freed(4);
+	for (size_t t = 0; t < freed.size(); t++) {
+		threads.emplace_back([&, t]() {
+			for (int i = 0; i < 20; i++) {
+				const auto str = "let own = make(" + std::to_string(i) + "); [own(2), shared(3)]";
+				Lexer lexer{str};
+				Program program{prelude};
+				program.add(lexer);
+				EXPECT_EQ(program.run(i % 2 ? Engine::Vm : Engine::Ast), (Value{ Array{ Value{i}, Value{5} } }));
+			}
+			freed[t] = Collector::collect();
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	// own's captures. the programs define no functions, so reference counting freed their globals
+	for (const auto count : freed)
+		EXPECT_EQ(count, 20);
+	const auto& [shared, env] = prelude->global()->get("shared").get<BoundFunction>();
+	EXPECT_EQ(shared->apply(env, std::vector<Value>{Value{1}}), Value{5});
+
+	// a thread collects what it left as it exits, and hands what's still in use to the next collection
+	Collector::collect();
+	const auto before = Collector::stats();
+	std::unique_ptr<Program> kept;
+	std::thread{[&kept]() {
+		for (const auto* str : {"let one = make(1); one(0)", "let two = make(2); two(0)"}) {
+			const auto source = std::string{"let make = fn(x) { let get = fn(k) { if (k == 0) { x } else { get(k - 1) } }; get }; "} + str;
+			Lexer lexer{source};
+			kept = Program::parse(lexer);
+			kept->run(Engine::Vm);
+		}
+	}}.join();
+	EXPECT_EQ(Collector::stats().freed, before.freed + 2);
+
+	// the second program's globals, which its functions are bound to, and two's captures
+	const auto& [two, captured] = kept->global->get("two").get<BoundFunction>();
+	EXPECT_EQ(two->apply(captured, std::vector<Value>{Value{3}}), Value{2});
+	kept.reset();
+	EXPECT_EQ(Collector::collect(), 2);
+}